@@ -0,0 +1,44 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+
+// アプリ全体で使うフォントとアイコンを名前で登録する
+// 登録しただけでは読み込まれず、FontAsset / TextureAsset で初めて使った時にプロセス内で 1 回だけ読み込まれる
+// 最初のフレームで使うフォントは、圧縮されたエンジンのフォントの展開を別スレッドで先に始めておく
+inline void RegisterAppAssets()
+{
+	FontAsset::Register(U"MediumFont", 16);
+	FontAsset::Register(U"LargeFont", 17, Typeface::Bold);
+	FontAsset::Register(U"TitleFont", 18);
+	FontAsset::Register(U"TableFont", 14, Typeface::Regular);
+	FontAsset::Register(U"TableFontBold", 14, Typeface::Bold);
+	FontAsset::Register(U"ProfilerFont", 12, Typeface::Mono);
+
+	// 左右の操作パネルの絵文字
+	TextureAsset::Register(U"UpdateIcon", U"🔃"_emoji);
+	TextureAsset::Register(U"MarkIcon.ShopName", U"🏬"_emoji);
+	TextureAsset::Register(U"MarkIcon.Date", U"🕰️"_emoji);
+	TextureAsset::Register(U"MarkIcon.Goods", U"🍔"_emoji);
+	TextureAsset::Register(U"MarkIcon.Price", U"💴"_emoji);
+	TextureAsset::Register(U"MarkIcon.Unassigned", U"🧹"_emoji);
+	TextureAsset::Register(U"WriteIcon.Save", U"💾"_emoji);
+	TextureAsset::Register(U"WriteIcon.Delete", U"🗑️"_emoji);
+
+	// TileButton のアイコン
+	TextureAsset::Register(U"AddIcon", 0xf0704_icon, 12);
+	TextureAsset::Register(U"ButtonIcon.ShopName", 0xf54f_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Date", 0xf017_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Goods", 0xf805_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Price", 0xf157_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Unassigned", 0xf12d_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Retry", 0xf021_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.BoundingPoly", 0xf247_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Larger", 0xf00e_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Smaller", 0xf010_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Save", 0xf0c7_icon, 15);
+	TextureAsset::Register(U"ButtonIcon.Delete", 0xf1f8_icon, 15);
+
+	for (const auto name : { U"MediumFont", U"LargeFont", U"TitleFont", U"TableFont", U"TableFontBold" })
+	{
+		FontAsset::LoadAsync(name);
+	}
+}
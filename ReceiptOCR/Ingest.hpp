@@ -0,0 +1,531 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include "Vision.hpp"
+#include "Trace.hpp"
+
+// 容量に上限のあるスレッド間のキュー
+// 満杯の時の push と空の時の pop は待ち、close() の後は待たずに失敗する
+template <class Type>
+class BoundedQueue
+{
+public:
+
+	explicit BoundedQueue(size_t capacity)
+		: m_capacity{ capacity } {}
+
+	/// @brief 空きができるまで待って追加します。
+	/// @return close() 済みの場合 false
+	bool push(Type value)
+	{
+		{
+			std::unique_lock lock{ m_mutex };
+			m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+			if (m_closed)
+			{
+				return false;
+			}
+			m_items.push_back(std::move(value));
+		}
+		m_notEmpty.notify_one();
+		return true;
+	}
+
+	/// @brief 要素が来るまで待って取り出します。
+	/// @return close() 済みの場合 none
+	Optional<Type> pop()
+	{
+		Optional<Type> value;
+		{
+			std::unique_lock lock{ m_mutex };
+			m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+			if (m_closed)
+			{
+				return none;
+			}
+			value = std::move(m_items.front());
+			m_items.pop_front();
+		}
+		m_notFull.notify_one();
+		return value;
+	}
+
+	/// @brief 要素があれば待たずに取り出します。
+	Optional<Type> tryPop()
+	{
+		Optional<Type> value;
+		{
+			std::lock_guard lock{ m_mutex };
+			if (m_items.empty())
+			{
+				return none;
+			}
+			value = std::move(m_items.front());
+			m_items.pop_front();
+		}
+		m_notFull.notify_one();
+		return value;
+	}
+
+	/// @brief 待っているスレッドをすべて起こし、以降の push と pop を失敗させます。
+	void close()
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_closed = true;
+		}
+		m_notFull.notify_all();
+		m_notEmpty.notify_all();
+	}
+
+private:
+
+	std::mutex m_mutex;
+	std::condition_variable m_notFull;
+	std::condition_variable m_notEmpty;
+	std::deque<Type> m_items;
+	size_t m_capacity;
+	bool m_closed = false;
+};
+
+/// @brief JPEG の Exif の Orientation（1 - 8）を返します。JPEG でないか、Orientation が無い場合は 1 を返します。
+/// 先頭の 64 KiB だけを読みます。
+inline int32 ReadJPEGOrientation(FilePathView path)
+{
+	BinaryReader reader{ path };
+	if (!reader)
+	{
+		return 1;
+	}
+
+	Array<uint8> bytes(static_cast<size_t>(Min<int64>(reader.size(), (1 << 16))));
+	bytes.resize(static_cast<size_t>(Max<int64>(reader.read(bytes.data(), bytes.size()), 0)));
+
+	if (bytes.size() < 4 || bytes[0] != 0xFF || bytes[1] != 0xD8)
+	{
+		return 1;
+	}
+
+	// TIFF のヘッダーのバイト順で読む
+	const auto readTIFF = [](const uint8* tiff, size_t size) -> int32
+		{
+			if (size < 8 || (tiff[0] != tiff[1]) || (tiff[0] != 'I' && tiff[0] != 'M'))
+			{
+				return 1;
+			}
+
+			const bool littleEndian = (tiff[0] == 'I');
+			const auto read16 = [&](size_t pos) -> uint32
+				{
+					return littleEndian ? (tiff[pos] | (tiff[pos + 1] << 8)) : ((tiff[pos] << 8) | tiff[pos + 1]);
+				};
+			const auto read32 = [&](size_t pos) -> uint32
+				{
+					return littleEndian ? (read16(pos) | (read16(pos + 2) << 16)) : ((read16(pos) << 16) | read16(pos + 2));
+				};
+
+			const size_t ifd = read32(4);
+			if (read16(2) != 42 || size < ifd + 2)
+			{
+				return 1;
+			}
+
+			const size_t entryCount = read16(ifd);
+			for (size_t i = 0; i < entryCount && ifd + 2 + (i + 1) * 12 <= size; ++i)
+			{
+				const size_t entry = ifd + 2 + i * 12;
+				if (read16(entry) == 0x0112) // Orientation
+				{
+					const auto orientation = static_cast<int32>(read16(entry + 8));
+					return InRange(orientation, 1, 8) ? orientation : 1;
+				}
+			}
+			return 1;
+		};
+
+	// APP1 の Exif を探す。画像データ (SOS) より後にはない
+	size_t pos = 2;
+	while (pos + 4 <= bytes.size() && bytes[pos] == 0xFF)
+	{
+		const uint8 marker = bytes[pos + 1];
+		if (marker == 0xDA || marker == 0xD9)
+		{
+			break;
+		}
+
+		const size_t length = ((bytes[pos + 2] << 8) | bytes[pos + 3]);
+		const size_t body = pos + 4;
+		const size_t end = Min(pos + 2 + length, bytes.size());
+		if (marker == 0xE1 && body + 6 <= end && std::memcmp(&bytes[body], "Exif\0\0", 6) == 0)
+		{
+			return readTIFF(&bytes[body + 6], end - (body + 6));
+		}
+		pos += 2 + length;
+	}
+
+	return 1;
+}
+
+// 読み取りキューの画像の状態
+enum class IngestState
+{
+	Waiting,     // 前の画像の処理待ち
+	Decoding,    // 画像の読み込みと向きの補正
+	Recognizing, // CloudVision.exe の出力待ち
+	Analyzing,   // 分割・行のグループ化・推論
+	Ready,       // エディタへの追加待ち
+	Done,
+	Failed,
+};
+
+constexpr StringView IngestStateNames[] = { U"待機中", U"読み込み中", U"OCR 中", U"解析中", U"追加待ち", U"完了", U"失敗" };
+
+struct IngestEntry
+{
+	FilePath path;
+	IngestState state = IngestState::Waiting;
+	String message; // 失敗した理由
+
+	// 段階ごとの処理時間 [ms]
+	double decodeMs = 0.0;
+	double ocrMs = 0.0;
+	double analyzeMs = 0.0;
+};
+
+/// @brief 読み取りキューの状態を、bottomLeft を左下として表示します。
+/// 終わっていない画像と、その直前に終わった画像を MaxRows 件まで表示します。
+inline void DrawIngestEntries(const Array<IngestEntry>& entries, const Font& font, const Vec2& bottomLeft)
+{
+	constexpr size_t MaxRows = 8;
+	constexpr size_t FinishedRows = 2;
+
+	if (entries.empty())
+	{
+		return;
+	}
+
+	size_t firstUnfinished = 0;
+	size_t doneCount = 0;
+	for (const auto& [i, entry] : Indexed(entries))
+	{
+		if (entry.state == IngestState::Done)
+		{
+			++doneCount;
+		}
+		if ((entry.state == IngestState::Done || entry.state == IngestState::Failed) && firstUnfinished == i)
+		{
+			++firstUnfinished;
+		}
+	}
+
+	const size_t begin = (FinishedRows < firstUnfinished) ? Min(firstUnfinished - FinishedRows, entries.size() - Min(entries.size(), MaxRows)) : 0;
+	const size_t end = Min(begin + MaxRows, entries.size());
+
+	Array<std::pair<String, ColorF>> lines;
+	lines.emplace_back(U"読み取りキュー  完了 {} / {} 件"_fmt(doneCount, entries.size()), Palette::White);
+	for (size_t i = begin; i < end; ++i)
+	{
+		const auto& entry = entries[i];
+		String line = U"{}  {}"_fmt(FileSystem::FileName(entry.path), IngestStateNames[static_cast<size_t>(entry.state)]);
+		if (entry.state == IngestState::Failed)
+		{
+			line += U"  " + entry.message;
+		}
+		else if (entry.state == IngestState::Ready || entry.state == IngestState::Done)
+		{
+			line += U"  (読み込み {:.0f} ms, OCR {:.1f} s, 解析 {:.0f} ms)"_fmt(entry.decodeMs, entry.ocrMs / 1000.0, entry.analyzeMs);
+		}
+
+		const ColorF color = (entry.state == IngestState::Failed) ? ColorF{ Palette::Orangered }
+			: (entry.state == IngestState::Done) ? ColorF{ 0.7 }
+			: (entry.state == IngestState::Waiting) ? ColorF{ 0.85 } : ColorF{ Palette::Skyblue };
+		lines.emplace_back(std::move(line), color);
+	}
+
+	const double lineHeight = font.height();
+	double width = 0.0;
+	for (const auto& line : lines)
+	{
+		width = Max(width, font(line.first).region().w);
+	}
+
+	const RectF region{ Arg::bottomLeft = bottomLeft, width + 20, lineHeight * lines.size() + 10 };
+	region.rounded(4).draw(ColorF{ 0.0, 0.6 });
+	for (const auto& [i, line] : Indexed(lines))
+	{
+		font(line.first).draw(region.pos + Vec2(10, 5 + lineHeight * i), line.second);
+	}
+}
+
+// ドロップされた画像を順に読み取るキュー
+// 画像の読み込みと向きの補正・OCR・解析 (analyze) をそれぞれ専用のスレッドで行い、段階の間は容量に上限のあるキューでつなぐ
+// 前の画像を OCR している間に次の画像を読み込み、その前の画像を解析するので、各段階の待ち時間が重なる
+// 解析の結果は take() でメインスレッドから取り出す。取り出さない間は上限で止まり、画像をメモリに溜め込まない
+// analyze は別のスレッドで呼ぶので、テクスチャの作成など、メインスレッドでしかできない処理は取り出した後に行う
+template <class Prepared>
+class IngestQueue
+{
+public:
+
+	// (OCR に渡した画像のパス, その画像, CloudVision.exe の出力) -> 解析の結果
+	using Analyze = std::function<Prepared(const FilePath&, const Image&, const std::string&)>;
+
+	// 段階の間のキューの容量（画像 1 枚は数十 MB になるので小さくする）
+	static constexpr size_t StageCapacity = 2;
+
+	// 画像に Exif の向きがある場合に、向きを反映した画像を保存するディレクトリ
+	static constexpr StringView NormalizedDirectory = U"ingest/";
+
+	explicit IngestQueue(Analyze analyze)
+		: m_analyze{ std::move(analyze) }
+	{
+		m_threads.emplace_back([this] { runDecode(); });
+		m_threads.emplace_back([this] { runRecognize(); });
+		m_threads.emplace_back([this] { runAnalyze(); });
+	}
+
+	~IngestQueue()
+	{
+		m_pending.close();
+		m_decoded.close();
+		m_recognized.close();
+		m_ready.close();
+		for (auto& thread : m_threads)
+		{
+			thread.join();
+		}
+	}
+
+	/// @brief 画像のファイルか、画像を含むディレクトリを追加します。ディレクトリはサブディレクトリまで探します。
+	/// @return 追加した画像の数
+	size_t add(FilePathView path)
+	{
+		Array<FilePath> paths;
+		if (FileSystem::IsDirectory(path))
+		{
+			for (const auto& file : FileSystem::DirectoryContents(path, Recursive::Yes))
+			{
+				if (IsImageFile(file))
+				{
+					paths.push_back(file);
+				}
+			}
+			paths.sort();
+		}
+		else if (IsImageFile(path))
+		{
+			paths.push_back(FileSystem::FullPath(path));
+		}
+
+		for (const auto& file : paths)
+		{
+			size_t id = 0;
+			{
+				std::lock_guard lock{ m_mutex };
+				id = m_entries.size();
+				m_entries.emplace_back().path = file;
+			}
+			m_pending.push(id);
+		}
+		return paths.size();
+	}
+
+	/// @brief 解析が終わった画像があれば取り出します。メインスレッドから毎フレーム呼びます。
+	Optional<Prepared> take()
+	{
+		auto item = m_ready.tryPop();
+		if (!item)
+		{
+			return none;
+		}
+
+		setState(item->first, IngestState::Done);
+		return std::move(item->second);
+	}
+
+	/// @brief すべての画像の状態を返します。
+	Array<IngestEntry> entries() const
+	{
+		std::lock_guard lock{ m_mutex };
+		return m_entries;
+	}
+
+	/// @brief 終わっていない画像がある場合 true を返します。
+	bool busy() const
+	{
+		std::lock_guard lock{ m_mutex };
+		return m_entries.any([](const IngestEntry& entry) { return entry.state != IngestState::Done && entry.state != IngestState::Failed; });
+	}
+
+private:
+
+	struct Decoded
+	{
+		size_t id = 0;
+		FilePath imagePath; // OCR に渡すパス
+		Image image;
+	};
+
+	struct Recognized
+	{
+		Decoded decoded;
+		std::string output;
+	};
+
+	static bool IsImageFile(FilePathView path)
+	{
+		const auto extension = FileSystem::Extension(path);
+		return (extension == U"jpg") || (extension == U"jpeg") || (extension == U"png");
+	}
+
+	// Image は JPEG の Exif の向きを反映して読み込むので、向きのある JPEG は読み込んだ画像を保存し直して OCR に渡す
+	// OCR の座標と、切り抜きに使う画像の座標を一致させるため
+	void runDecode()
+	{
+		while (const auto id = m_pending.pop())
+		{
+			const auto path = setState(id.value(), IngestState::Decoding);
+			Stopwatch timer{ StartImmediately::Yes };
+
+			Decoded decoded;
+			decoded.id = id.value();
+			decoded.imagePath = path;
+			try
+			{
+				ScopedTrace trace(U"ingest.decode", U"pipeline");
+
+				decoded.image = Image{ path };
+				if (decoded.image.isEmpty())
+				{
+					fail(id.value(), U"画像を読み込めませんでした");
+					continue;
+				}
+
+				if (ReadJPEGOrientation(path) != 1)
+				{
+					FileSystem::CreateDirectories(NormalizedDirectory);
+					decoded.imagePath = FileSystem::FullPath(U"{}{}_{:016X}.jpg"_fmt(NormalizedDirectory, FileSystem::BaseName(path), std::hash<String>{}(path)));
+					if (!decoded.image.saveJPEG(decoded.imagePath, 95))
+					{
+						fail(id.value(), U"{} に保存できませんでした"_fmt(decoded.imagePath));
+						continue;
+					}
+				}
+			}
+			catch (const std::exception& e)
+			{
+				fail(id.value(), Unicode::Widen(e.what()));
+				continue;
+			}
+
+			setTime(id.value(), &IngestEntry::decodeMs, timer.msF());
+			if (!m_decoded.push(std::move(decoded)))
+			{
+				return;
+			}
+		}
+	}
+
+	void runRecognize()
+	{
+		while (auto decoded = m_decoded.pop())
+		{
+			const auto id = decoded->id;
+			setState(id, IngestState::Recognizing);
+			Stopwatch timer{ StartImmediately::Yes };
+
+			Recognized recognized;
+			recognized.decoded = std::move(decoded.value());
+			{
+				ScopedTrace trace(U"ingest.ocr", U"pipeline");
+
+				ChildProcess process(VisionExePath, recognized.decoded.imagePath, Pipe::StdIn);
+				if (!process)
+				{
+					fail(id, U"CloudVision.exe を起動できませんでした");
+					continue;
+				}
+				auto& is = process.istream();
+				recognized.output.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+			}
+
+			if (recognized.output.empty())
+			{
+				fail(id, U"OCR の結果が空でした");
+				continue;
+			}
+
+			setTime(id, &IngestEntry::ocrMs, timer.msF());
+			if (!m_recognized.push(std::move(recognized)))
+			{
+				return;
+			}
+		}
+	}
+
+	void runAnalyze()
+	{
+		while (auto recognized = m_recognized.pop())
+		{
+			const auto id = recognized->decoded.id;
+			setState(id, IngestState::Analyzing);
+			Stopwatch timer{ StartImmediately::Yes };
+
+			Optional<Prepared> prepared;
+			try
+			{
+				ScopedTrace trace(U"ingest.analyze", U"pipeline");
+				prepared = m_analyze(recognized->decoded.imagePath, recognized->decoded.image, recognized->output);
+			}
+			catch (const std::exception& e)
+			{
+				fail(id, Unicode::Widen(e.what()));
+				continue;
+			}
+
+			setTime(id, &IngestEntry::analyzeMs, timer.msF());
+			setState(id, IngestState::Ready);
+			if (!m_ready.push({ id, std::move(prepared.value()) }))
+			{
+				return;
+			}
+		}
+	}
+
+	FilePath setState(size_t id, IngestState state)
+	{
+		std::lock_guard lock{ m_mutex };
+		m_entries[id].state = state;
+		return m_entries[id].path;
+	}
+
+	void setTime(size_t id, double IngestEntry::* field, double ms)
+	{
+		std::lock_guard lock{ m_mutex };
+		m_entries[id].*field = ms;
+	}
+
+	void fail(size_t id, const String& message)
+	{
+		std::lock_guard lock{ m_mutex };
+		m_entries[id].state = IngestState::Failed;
+		m_entries[id].message = message;
+	}
+
+	Analyze m_analyze;
+
+	mutable std::mutex m_mutex;
+	Array<IngestEntry> m_entries; // 追加した順。番号は画像の id
+
+	BoundedQueue<size_t> m_pending{ SIZE_MAX };
+	BoundedQueue<Decoded> m_decoded{ StageCapacity };
+	BoundedQueue<Recognized> m_recognized{ StageCapacity };
+	BoundedQueue<std::pair<size_t, Prepared>> m_ready{ StageCapacity };
+
+	// 段階ごとのスレッド。他のメンバーの初期化が終わってから、コンストラクタの本体で起動する
+	Array<std::thread> m_threads;
+};
@@ -0,0 +1,1255 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "Common.hpp"
+#include "Utility.hpp"
+#include "LedgerFile.hpp"
+#include "LedgerCSV.hpp"
+#include "LedgerColumns.hpp"
+#include "LedgerRollup.hpp"
+#include "LedgerSearch.hpp"
+#include "Trace.hpp"
+
+// 同じレシートを 2 回登録したことを見つけるための指紋
+// 店名・レシートID（購入日時）と、品名と値段の組の多重集合から作る
+// 組ごとのハッシュの和を使うので、行の順序によらず、行を 1 つずつ足して作れる
+struct ReceiptFingerprint
+{
+	uint64 header = 0;
+	uint64 itemSum = 0;
+	uint32 itemCount = 0;
+
+	ReceiptFingerprint() = default;
+
+	ReceiptFingerprint(const String& shopName, const String& receiptID)
+		: header{ Mix(Hash(receiptID, Hash(shopName, 14695981039346656037ull))) } {}
+
+	void add(const String& itemName, int32 price)
+	{
+		itemSum += Mix(Hash(itemName, 14695981039346656037ull) ^ Mix(static_cast<uint32>(price)));
+		++itemCount;
+	}
+
+	uint64 value() const
+	{
+		return Mix(header ^ Mix(itemSum + itemCount));
+	}
+
+	/// @brief 1 枚のレシートの行（CSV の列の並び）から指紋を作ります。
+	static uint64 Of(const Array<Array<String>>& rows)
+	{
+		if (rows.empty())
+		{
+			return 0;
+		}
+
+		ReceiptFingerprint fingerprint{ rows.front()[Label::ShopName], rows.front()[Label::ReceiptID] };
+		for (const auto& row : rows)
+		{
+			fingerprint.add(row[Label::ItemName], ParseOr<int32>(row[Label::ItemPrice], 0));
+		}
+		return fingerprint.value();
+	}
+
+private:
+
+	// FNV-1a、区切りとして最後に 0 を混ぜる
+	static uint64 Hash(const String& str, uint64 hash)
+	{
+		for (const auto ch : str)
+		{
+			hash = (hash ^ static_cast<uint64>(ch)) * 1099511628211ull;
+		}
+		return hash * 1099511628211ull;
+	}
+
+	// splitmix64 の最後の混ぜ合わせ
+	static uint64 Mix(uint64 x)
+	{
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+};
+
+// 1 か月分の家計簿（yyyy年MM月.csv）を列ごとに保持する
+// 品名・店名・購入日・登録日時・レシートID は StringPool の番号で持ち、String にするのは row() で行を返す時だけにする
+// 削除は登録日時単位の削除済み印（tombstone）で表し、行そのものはコンパクションまで残す
+// 削除済みでない行の集計（MonthRollup）とレシートの指紋の索引を、追加・削除のたびに更新する
+class LedgerMonth
+{
+public:
+
+	// 削除済みの行も含む
+	size_t size() const
+	{
+		return m_prices.size();
+	}
+
+	size_t liveSize() const
+	{
+		return size() - m_removedRowCount;
+	}
+
+	size_t removedSize() const
+	{
+		return m_removedRowCount;
+	}
+
+	bool empty() const
+	{
+		return liveSize() == 0;
+	}
+
+	void push_back(const Array<String>& row)
+	{
+		pushRow(m_strings.intern(row[Label::ItemName]), ParseOr<int32>(row[Label::ItemPrice], 0),
+			m_strings.intern(row[Label::ShopName]), m_strings.intern(row[Label::BuyDate]),
+			m_strings.intern(row[Label::RegisterDate]), m_strings.intern(row[Label::ReceiptID]),
+			BuyDateDay(row[Label::BuyDate]));
+	}
+
+	/// @brief CSV の列の並びで行を返します。
+	Array<String> row(size_t rowIndex) const
+	{
+		Array<String> result(Label::Size);
+		result[Label::ItemName] = m_strings[m_itemNames[rowIndex]];
+		result[Label::ItemPrice] = Format(m_prices[rowIndex]);
+		result[Label::ShopName] = m_strings[m_shopNames[rowIndex]];
+		result[Label::BuyDate] = m_strings[m_buyDates[rowIndex]];
+		result[Label::RegisterDate] = m_strings[m_registerDates[rowIndex]];
+		result[Label::ReceiptID] = m_strings[m_receiptIDs[rowIndex]];
+		return result;
+	}
+
+	bool removed(size_t rowIndex) const
+	{
+		return m_removedRegisterDates.contains(m_registerDates[rowIndex]);
+	}
+
+	/// @brief 削除済みでない行の集計を返します。
+	const MonthRollup& rollup() const
+	{
+		return m_rollup;
+	}
+
+	/// @brief 指紋が fingerprint のレシートの登録日時を返します。無い場合は none を返します。
+	Optional<String> findReceipt(uint64 fingerprint) const
+	{
+		if (auto it = m_byFingerprint.find(fingerprint); it != m_byFingerprint.end())
+		{
+			return m_strings[it->second.front()];
+		}
+		return none;
+	}
+
+	/// @brief 同じ指紋のレシートのうち、最初に登録したもの以外の登録日時を返します。
+	Array<String> duplicateRegisterDates() const
+	{
+		Array<String> result;
+		for (const auto& [fingerprint, registerDates] : m_byFingerprint)
+		{
+			if (registerDates.size() < 2)
+			{
+				continue;
+			}
+
+			// 登録日時は yyyy-MM-dd HH:mm:ss なので、文字列の順が登録順になる
+			const auto first = *std::min_element(registerDates.begin(), registerDates.end(), [this](uint32 a, uint32 b) { return m_strings[a] < m_strings[b]; });
+			for (const auto registerDate : registerDates)
+			{
+				if (registerDate != first)
+				{
+					result.push_back(m_strings[registerDate]);
+				}
+			}
+		}
+		return result;
+	}
+
+	/// @brief 購入日が buyDate の行番号を返します。削除済みの行も含みます。
+	const Array<uint32>& rowsByBuyDate(const String& buyDate) const
+	{
+		return findRows(m_byBuyDate, buyDate);
+	}
+
+	/// @brief 登録日時が registerDate の行番号を返します。削除済みの行も含みます。
+	const Array<uint32>& rowsByRegisterDate(const String& registerDate) const
+	{
+		return findRows(m_byRegisterDate, registerDate);
+	}
+
+	/// @brief 登録日時が registerDate の行を削除済みにします。
+	/// 月の行全体は走査しませんが、削除した行がある日の行を集計し直し、月全体の集計を日ごとの集計から作り直すので、
+	/// その日の行数と、月の店名・品名の種類数に比例する時間がかかります。
+	/// @return 新たに削除済みになった行数
+	size_t removeByRegisterDate(const String& registerDate)
+	{
+		const auto id = m_strings.intern(registerDate);
+		if (!m_removedRegisterDates.insert(id).second)
+		{
+			return 0;
+		}
+
+		const auto& rows = rowsByRegisterDate(registerDate);
+		m_removedRowCount += rows.size();
+
+		if (auto it = m_fingerprints.find(id); it != m_fingerprints.end())
+		{
+			eraseFingerprint(it->second.value(), id);
+			m_fingerprints.erase(it);
+		}
+
+		// 削除した行がある日だけ、残りの行から集計し直す
+		HashSet<uint8> days;
+		for (const auto rowIndex : rows)
+		{
+			days.insert(m_buyDays[rowIndex]);
+		}
+
+		for (const auto day : days)
+		{
+			m_rollup.clearDay(day);
+			for (const auto& [buyDate, dayRows] : m_byBuyDate)
+			{
+				if (m_buyDays[dayRows.front()] != day)
+				{
+					continue;
+				}
+
+				for (const auto rowIndex : dayRows)
+				{
+					if (!removed(rowIndex))
+					{
+						m_rollup.addToDay(day, m_strings[m_shopNames[rowIndex]], m_strings[m_itemNames[rowIndex]], m_prices[rowIndex]);
+					}
+				}
+			}
+		}
+
+		if (!days.empty())
+		{
+			m_rollup.rebuildMonth();
+		}
+
+		return rows.size();
+	}
+
+	/// @brief 削除済みでない行を返します。
+	Array<Array<String>> liveRows() const
+	{
+		Array<Array<String>> result(Arg::reserve = liveSize());
+		for (size_t i = 0; i < size(); ++i)
+		{
+			if (!removed(i))
+			{
+				result.push_back(row(i));
+			}
+		}
+		return result;
+	}
+
+	/// @brief 削除済みの行を取り除いた家計簿を返します。
+	LedgerMonth compacted() const
+	{
+		LedgerMonth result;
+		for (size_t i = 0; i < size(); ++i)
+		{
+			if (!removed(i))
+			{
+				result.push_back(row(i));
+			}
+		}
+		return result;
+	}
+
+	/// @brief 削除済みでない行を CSV として書き出します。
+	std::string toCSV() const
+	{
+		std::string result;
+		for (size_t i = 0; i < size(); ++i)
+		{
+			if (!removed(i))
+			{
+				AppendCSVRow(result, row(i));
+			}
+		}
+		return result;
+	}
+
+	/// @brief CSV と削除済み印のファイルを読み込みます。列が足りない行は読み飛ばします。
+	/// LedgerColumnStoreEnabled の場合は列形式のファイルを使い、無いか古い場合は CSV から作り直します。
+	static LedgerMonth Load(FilePathView path)
+	{
+		LedgerMonth month;
+
+		for (const auto& registerDate : LoadLedgerTombstones(path))
+		{
+			month.m_removedRegisterDates.insert(month.m_strings.intern(registerDate));
+		}
+
+		if (!LedgerColumnStoreEnabled)
+		{
+			month.pushCSV(path, nullptr);
+			return month;
+		}
+
+		// 列形式のファイルが今の CSV から作ったものなら、CSV を解析せずに読む
+		// 解析中に CSV が書き換わった場合に古い内容を新しい署名で残さないよう、署名は解析の前に取る
+		const auto columnPath = LedgerColumnPath(path);
+		const auto signature = LedgerFileSignature(path);
+		{
+			const LedgerColumnFile columns{ columnPath };
+			if (columns && columns.signature() == signature)
+			{
+				month.pushColumns(columns);
+				return month;
+			}
+		}
+
+		Array<Array<String>> rows;
+		month.pushCSV(path, &rows);
+
+		if (signature != U"-")
+		{
+			ReplaceFileAtomic(columnPath, LedgerColumnFile::Build(rows, signature));
+		}
+
+		return month;
+	}
+
+private:
+
+	void pushRow(uint32 itemName, int32 price, uint32 shopName, uint32 buyDate, uint32 registerDate, uint32 receiptID, uint32 buyDay)
+	{
+		const auto rowIndex = static_cast<uint32>(size());
+
+		m_itemNames.push_back(itemName);
+		m_prices.push_back(price);
+		m_shopNames.push_back(shopName);
+		m_buyDates.push_back(buyDate);
+		m_registerDates.push_back(registerDate);
+		m_receiptIDs.push_back(receiptID);
+		m_buyDays.push_back(static_cast<uint8>(buyDay));
+
+		m_byBuyDate[buyDate].push_back(rowIndex);
+		m_byRegisterDate[registerDate].push_back(rowIndex);
+
+		if (m_removedRegisterDates.contains(registerDate))
+		{
+			++m_removedRowCount;
+		}
+		else
+		{
+			const auto& shop = m_strings[shopName];
+			const auto& item = m_strings[itemName];
+			m_rollup.add(m_buyDays.back(), shop, item, price);
+
+			// 登録日時ごとに指紋を足し込み、索引を差し替える
+			auto [it, inserted] = m_fingerprints.try_emplace(registerDate, shop, m_strings[receiptID]);
+			if (!inserted)
+			{
+				eraseFingerprint(it->second.value(), registerDate);
+			}
+			it->second.add(item, price);
+			m_byFingerprint[it->second.value()].push_back(registerDate);
+		}
+	}
+
+	// CSV の行を追加する。rows が nullptr でなければ、追加した行を CSV に書かれていた通りの文字列でも返す
+	// 品名を含む文字列のセルは、同じバイト列なら 1 回だけ String にして StringPool に登録し、値段は数字だけなら String にせずに読む
+	void pushCSV(FilePathView path, Array<Array<String>>* rows)
+	{
+		LedgerCSVReader reader{ path };
+		if (!reader)
+		{
+			return;
+		}
+
+		HashTable<std::string_view, uint32> ids;
+		const auto intern = [&](const LedgerCSVCell& cell)
+			{
+				if (cell.quoted)
+				{
+					return m_strings.intern(cell.toString());
+				}
+
+				auto [it, inserted] = ids.try_emplace(cell.bytes, 0);
+				if (inserted)
+				{
+					it->second = m_strings.intern(cell.toString());
+				}
+				return it->second;
+			};
+
+		Array<LedgerCSVCell> cells;
+		while (reader.next(cells))
+		{
+			if (cells.size() < Label::Size)
+			{
+				continue;
+			}
+
+			const auto itemName = intern(cells[Label::ItemName]);
+			const auto shopName = intern(cells[Label::ShopName]);
+			const auto buyDate = intern(cells[Label::BuyDate]);
+			const auto registerDate = intern(cells[Label::RegisterDate]);
+			const auto receiptID = intern(cells[Label::ReceiptID]);
+			pushRow(itemName, cells[Label::ItemPrice].parseOr(0),
+				shopName, buyDate, registerDate, receiptID, BuyDateDay(m_strings[buyDate]));
+
+			if (rows)
+			{
+				Array<String> row(Label::Size);
+				row[Label::ItemName] = m_strings[itemName];
+				row[Label::ItemPrice] = cells[Label::ItemPrice].toString();
+				row[Label::ShopName] = m_strings[shopName];
+				row[Label::BuyDate] = m_strings[buyDate];
+				row[Label::RegisterDate] = m_strings[registerDate];
+				row[Label::ReceiptID] = m_strings[receiptID];
+				rows->push_back(std::move(row));
+			}
+		}
+	}
+
+	// 列形式のファイルの行を追加する
+	// 品名・辞書の文字列・整数にした日付は、異なる値ごとに 1 回だけ StringPool に登録する
+	void pushColumns(const LedgerColumnFile& columns)
+	{
+		Array<uint32> shopNames(columns.shopCount());
+		for (uint32 i = 0; i < shopNames.size(); ++i)
+		{
+			shopNames[i] = m_strings.intern(String{ columns.shopName(i) });
+		}
+
+		Array<uint32> receiptIDs(columns.receiptIDCount());
+		for (uint32 i = 0; i < receiptIDs.size(); ++i)
+		{
+			receiptIDs[i] = m_strings.intern(String{ columns.receiptID(i) });
+		}
+
+		HashTable<StringView, uint32> itemNames;
+		HashTable<uint32, uint32> buyDates;
+		HashTable<uint64, uint32> registerDates;
+
+		m_itemNames.reserve(columns.size());
+		m_prices.reserve(columns.size());
+
+		for (size_t rowIndex = 0; rowIndex < columns.size(); ++rowIndex)
+		{
+			uint32 buyDate = 0;
+			uint32 buyDay = 0;
+			if (const auto packed = columns.packedBuyDate(rowIndex))
+			{
+				auto [it, inserted] = buyDates.try_emplace(packed, 0);
+				if (inserted)
+				{
+					it->second = m_strings.intern(LedgerColumnFile::UnpackBuyDate(packed));
+				}
+				buyDate = it->second;
+				buyDay = (1 <= packed % 100 && packed % 100 < MonthRollup::DayCount) ? packed % 100 : 0;
+			}
+			else
+			{
+				const auto str = columns.field(rowIndex, Label::BuyDate);
+				buyDate = m_strings.intern(str);
+				buyDay = BuyDateDay(str);
+			}
+
+			uint32 registerDate = 0;
+			if (const auto packed = columns.packedRegisterDate(rowIndex))
+			{
+				auto [it, inserted] = registerDates.try_emplace(packed, 0);
+				if (inserted)
+				{
+					it->second = m_strings.intern(LedgerColumnFile::UnpackRegisterDate(packed));
+				}
+				registerDate = it->second;
+			}
+			else
+			{
+				registerDate = m_strings.intern(columns.field(rowIndex, Label::RegisterDate));
+			}
+
+			auto [itemName, inserted] = itemNames.try_emplace(columns.itemName(rowIndex), 0);
+			if (inserted)
+			{
+				itemName->second = m_strings.intern(String{ itemName->first });
+			}
+
+			pushRow(itemName->second, columns.price(rowIndex),
+				shopNames[columns.shopIndex(rowIndex)], buyDate, registerDate,
+				receiptIDs[columns.receiptIDIndex(rowIndex)], buyDay);
+		}
+	}
+
+	void eraseFingerprint(uint64 fingerprint, uint32 registerDate)
+	{
+		auto it = m_byFingerprint.find(fingerprint);
+		if (it == m_byFingerprint.end())
+		{
+			return;
+		}
+
+		auto& registerDates = it->second;
+		if (auto pos = std::find(registerDates.begin(), registerDates.end(), registerDate); pos != registerDates.end())
+		{
+			registerDates.erase(pos);
+		}
+		if (registerDates.empty())
+		{
+			m_byFingerprint.erase(it);
+		}
+	}
+
+	const Array<uint32>& findRows(const HashTable<uint32, Array<uint32>>& index, const String& key) const
+	{
+		static const Array<uint32> emptyRows;
+		if (const auto id = m_strings.find(key))
+		{
+			if (auto it = index.find(id.value()); it != index.end())
+			{
+				return it->second;
+			}
+		}
+		return emptyRows;
+	}
+
+	StringPool m_strings;
+
+	Array<uint32> m_itemNames;
+	Array<int32> m_prices;
+	Array<uint32> m_shopNames;
+	Array<uint32> m_buyDates;
+	Array<uint32> m_registerDates;
+	Array<uint32> m_receiptIDs;
+	Array<uint8> m_buyDays; // 購入日の日（BuyDateDay）
+
+	HashTable<uint32, Array<uint32>> m_byBuyDate;
+	HashTable<uint32, Array<uint32>> m_byRegisterDate;
+
+	HashSet<uint32> m_removedRegisterDates;
+	size_t m_removedRowCount = 0;
+
+	MonthRollup m_rollup;
+
+	// 登録日時 -> 削除済みでないレシートの指紋
+	HashTable<uint32, ReceiptFingerprint> m_fingerprints;
+
+	// 指紋 -> 登録日時（同じレシートを重ねて登録していると複数になる）
+	HashTable<uint64, Array<uint32>> m_byFingerprint;
+};
+
+// 家計簿ファイルの読み書きを行う専用スレッド
+// 処理は投入した順に 1 つずつ実行するので、同じファイルへの操作の順序が保たれる
+// 処理が返した完了処理は、メインスレッドで drain() を呼んだ時に同じ順序で実行する
+class LedgerIOThread
+{
+public:
+
+	// 別スレッドで実行し、メインスレッドで実行する完了処理を返す
+	using Job = std::function<std::function<void()>()>;
+
+	LedgerIOThread()
+		: m_thread{ [this] { run(); } } {}
+
+	~LedgerIOThread()
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_quit = true;
+		}
+		m_jobAdded.notify_one();
+		m_thread.join();
+	}
+
+	void post(Job job)
+	{
+		{
+			std::lock_guard lock{ m_mutex };
+			m_jobs.push_back(std::move(job));
+		}
+		m_jobAdded.notify_one();
+	}
+
+	/// @brief 実行中の処理から、処理の終わりを待たずに完了処理を渡します。どのスレッドからでも呼べます。
+	void complete(std::function<void()> completion)
+	{
+		std::lock_guard lock{ m_mutex };
+		m_completions.push_back(std::move(completion));
+	}
+
+	/// @brief 終わった処理の完了処理を実行します。メインスレッドから呼びます。
+	/// 別スレッドで例外が投げられていた場合は、ここで投げ直します。
+	void drain()
+	{
+		for (;;)
+		{
+			std::function<void()> completion;
+			{
+				std::lock_guard lock{ m_mutex };
+				if (m_completions.empty())
+				{
+					return;
+				}
+				completion = std::move(m_completions.front());
+				m_completions.pop_front();
+			}
+			completion();
+		}
+	}
+
+	/// @brief 投入済みの処理がすべて終わるまで待ち、完了処理を実行します。
+	/// 完了処理が新しく投入した処理も待ちます。
+	void waitIdle()
+	{
+		for (;;)
+		{
+			{
+				std::unique_lock lock{ m_mutex };
+				m_idle.wait(lock, [this] { return m_jobs.empty() && !m_running; });
+			}
+
+			drain();
+
+			std::lock_guard lock{ m_mutex };
+			if (m_jobs.empty() && !m_running)
+			{
+				return;
+			}
+		}
+	}
+
+	/// @brief 実行前の処理と未実行の完了処理を捨てます。
+	void discard()
+	{
+		std::unique_lock lock{ m_mutex };
+		m_jobs.clear();
+		m_idle.wait(lock, [this] { return !m_running; });
+		m_completions.clear();
+	}
+
+private:
+
+	void run()
+	{
+		for (;;)
+		{
+			Job job;
+			{
+				std::unique_lock lock{ m_mutex };
+				m_jobAdded.wait(lock, [this] { return m_quit || !m_jobs.empty(); });
+				if (m_jobs.empty())
+				{
+					return;
+				}
+				job = std::move(m_jobs.front());
+				m_jobs.pop_front();
+				m_running = true;
+			}
+
+			std::function<void()> completion;
+			try
+			{
+				completion = job();
+			}
+			catch (...)
+			{
+				completion = [exception = std::current_exception()] { std::rethrow_exception(exception); };
+			}
+
+			{
+				std::lock_guard lock{ m_mutex };
+				if (completion)
+				{
+					m_completions.push_back(std::move(completion));
+				}
+				m_running = false;
+			}
+			m_idle.notify_all();
+		}
+	}
+
+	std::mutex m_mutex;
+	std::condition_variable m_jobAdded;
+	std::condition_variable m_idle;
+	std::deque<Job> m_jobs;
+	std::deque<std::function<void()>> m_completions;
+	bool m_running = false;
+	bool m_quit = false;
+
+	// 他のメンバーの初期化が終わってから起動する
+	std::thread m_thread;
+};
+
+// 月ごとの家計簿をプロセス全体で共有するキャッシュ
+// ファイルの読み書きはすべて LedgerIOThread で行い、キャッシュは完了処理でメインスレッドから更新する
+// 各月のファイルは初回だけ読み込み、以降は更新日時が変わった時だけ読み直す
+// 読み込みが終わるまでの間は月のデータが無いものとして扱い、version() の変化で読み込み完了を知らせる
+// メインスレッドからのみ使う
+class Ledger
+{
+public:
+
+	// 削除済みの行がこの割合を超えたらコンパクションする
+	static constexpr double CompactionRatio = 0.25;
+
+	// 書き込みの成否を受け取る完了処理
+	using Completion = std::function<void(bool)>;
+
+	static Ledger& Instance()
+	{
+		static Ledger instance;
+		return instance;
+	}
+
+	/// @brief 終わった読み書きの結果をキャッシュに反映します。毎フレーム呼びます。
+	void update()
+	{
+		m_io.drain();
+	}
+
+	/// @brief 投入済みの読み書きがすべて終わるまで待ち、結果をキャッシュに反映します。
+	void waitIdle()
+	{
+		m_io.waitIdle();
+	}
+
+	/// @brief 未実行の読み書きとキャッシュを破棄します。次の参照でファイルから読み直します。
+	void clear()
+	{
+		m_io.discard();
+		m_months.clear();
+		m_preloadedCount = 0;
+		m_preloadCount = 0;
+	}
+
+	/// @brief directory のすべての月の家計簿を、複数のスレッドで並べて読み込みます。
+	/// 読み終わった月から順にキャッシュに反映するので、その間も読み込み済みの月は使えます。
+	/// 検索索引も、古い月は作り直し、ファイルが無くなった月は除きます。
+	void preload(FilePathView directory = U"")
+	{
+		auto& index = LedgerSearchIndex::Instance();
+
+		// 読み込み中の月を二重に読まないよう、対象の月はここで読み込み中にしておく
+		Array<std::pair<FilePath, String>> targets;
+		for (const auto& file : FileSystem::DirectoryContents(directory.empty() ? U"./" : directory, Recursive::No))
+		{
+			const auto fileName = FileSystem::FileName(file);
+			if (!IsLedgerMonthFileName(fileName))
+			{
+				continue;
+			}
+
+			const FilePath key = FilePath{ directory } + fileName;
+			auto& cached = m_months[key];
+			if (cached.loaded || cached.pendingCount != 0)
+			{
+				continue;
+			}
+
+			++cached.pendingCount;
+			targets.emplace_back(key, index.signature(key));
+		}
+		m_preloadCount += targets.size();
+
+		Array<FilePath> indexedPaths;
+		for (const auto& [key, signature] : index.signatures())
+		{
+			indexedPaths.push_back(key);
+		}
+
+		m_io.post([this, targets = std::move(targets), indexedPaths = std::move(indexedPaths)]() -> std::function<void()>
+			{
+				ScopedTrace trace(U"preload", U"csv");
+
+				// 月ごとに別のファイルを読むだけなので、読み書きのスレッドの順番は保ったまま並べて読める
+				// 読み終わった月は、全体を待たずに完了処理を渡す
+				std::atomic<size_t> nextIndex = 0;
+				const auto work = [&]
+					{
+						for (size_t i = nextIndex++; i < targets.size(); i = nextIndex++)
+						{
+							std::function<void()> completion;
+							try
+							{
+								completion = loadJob(targets[i].first, targets[i].second)();
+							}
+							catch (...)
+							{
+								completion = [exception = std::current_exception()] { std::rethrow_exception(exception); };
+							}
+
+							m_io.complete([this, completion = std::move(completion)]
+								{
+									++m_preloadedCount;
+									completion();
+								});
+						}
+					};
+
+				const size_t threadCount = Clamp<size_t>(Threading::GetConcurrency(), 1, Max<size_t>(targets.size(), 1));
+				Array<std::thread> workers;
+				for (size_t i = 1; i < threadCount; ++i)
+				{
+					workers.emplace_back(work);
+				}
+				work();
+				for (auto& worker : workers)
+				{
+					worker.join();
+				}
+
+				auto removedPaths = std::make_shared<Array<FilePath>>();
+				for (const auto& key : indexedPaths)
+				{
+					if (!FileSystem::Exists(key))
+					{
+						removedPaths->push_back(key);
+					}
+				}
+
+				return [removedPaths]
+					{
+						for (const auto& path : *removedPaths)
+						{
+							LedgerSearchIndex::Instance().removeMonth(path);
+						}
+					};
+			});
+	}
+
+	/// @brief preload で読み込む月の数と、読み込みが終わった月の数を返します。
+	std::pair<size_t, size_t> preloadProgress() const
+	{
+		return{ m_preloadedCount, m_preloadCount };
+	}
+
+	/// @brief preload の読み込みが終わっていない場合 true を返します。
+	bool preloading() const
+	{
+		return m_preloadedCount < m_preloadCount;
+	}
+
+	/// @brief path の家計簿を返します。読み込み中の場合は nullptr を返します。
+	/// キャッシュが古い場合は読み直しを始めます。
+	const LedgerMonth* month(FilePathView path)
+	{
+		const auto& cached = request(path);
+		return cached.loaded ? &cached.month : nullptr;
+	}
+
+	/// @brief path の家計簿が変わるたびに増える番号を返します。読み込みは始めません。
+	uint64 version(FilePathView path) const
+	{
+		if (auto it = m_months.find(FilePath(path)); it != m_months.end())
+		{
+			return it->second.version;
+		}
+		return 0;
+	}
+
+	/// @brief path への読み書きが終わっていない場合 true を返します。
+	bool busy(FilePathView path) const
+	{
+		if (auto it = m_months.find(FilePath(path)); it != m_months.end())
+		{
+			return it->second.pendingCount != 0;
+		}
+		return false;
+	}
+
+	/// @brief 購入日が buyDate の行を返します。読み込み中の場合は空を返します。
+	Array<Array<String>> rowsByBuyDate(FilePathView path, const String& buyDate)
+	{
+		Array<Array<String>> rows;
+
+		const auto ledgerMonth = month(path);
+		if (!ledgerMonth)
+		{
+			return rows;
+		}
+
+		for (const auto rowIndex : ledgerMonth->rowsByBuyDate(buyDate))
+		{
+			if (!ledgerMonth->removed(rowIndex))
+			{
+				rows.push_back(ledgerMonth->row(rowIndex));
+			}
+		}
+		return rows;
+	}
+
+	/// @brief 購入日が [from, to] の行を集計します。行は読まず、月ごとの集計を足し合わせます。
+	/// 読み込み中の月は含めず、complete を false にします。
+	/// @param directory 家計簿のあるディレクトリ
+	RollupResult aggregate(const Date& from, const Date& to, FilePathView directory = U"")
+	{
+		RollupResult result;
+
+		for (Date first = AddMonths(from, 0); (first.year * 12 + first.month) <= (to.year * 12 + to.month); first = AddMonths(first, 1))
+		{
+			const auto ledgerMonth = month(LedgerMonthPath(first, directory));
+			if (!ledgerMonth)
+			{
+				result.complete = false;
+				continue;
+			}
+
+			const auto& rollup = ledgerMonth->rollup();
+			const bool isFirstMonth = (first.year == from.year && first.month == from.month);
+			const bool isLastMonth = (first.year == to.year && first.month == to.month);
+			const uint32 beginDay = isFirstMonth ? from.day : 1;
+			const uint32 endDay = isLastMonth ? Min<uint32>(to.day, first.daysInMonth()) : first.daysInMonth();
+
+			// 月全体の場合は購入日を読み取れなかった行も含める
+			if (beginDay == 1 && endDay == static_cast<uint32>(first.daysInMonth()))
+			{
+				result.merge(rollup.month());
+				result.byMonth.emplace_back(first, rollup.month().total);
+				continue;
+			}
+
+			RollupStats monthTotal;
+			for (uint32 day = beginDay; day <= endDay; ++day)
+			{
+				result.merge(rollup.day(day));
+				monthTotal.merge(rollup.day(day).total);
+			}
+			result.byMonth.emplace_back(first, monthTotal);
+		}
+
+		return result;
+	}
+
+	/// @brief 1 枚のレシートの行 rows と同じ指紋のレシートが登録済みか、書き込み中の場合、その登録日時を返します。
+	/// 指紋の索引を引くだけなので、行数によらず定数時間で終わります。
+	/// 月の読み込みが終わっていない場合は判定できないので none を返します。
+	Optional<String> findDuplicate(FilePathView path, const Array<Array<String>>& rows)
+	{
+		const auto fingerprint = ReceiptFingerprint::Of(rows);
+		const auto& cached = request(path);
+
+		if (auto it = cached.pendingFingerprints.find(fingerprint); it != cached.pendingFingerprints.end())
+		{
+			return it->second;
+		}
+		if (cached.loaded)
+		{
+			return cached.month.findReceipt(fingerprint);
+		}
+		return none;
+	}
+
+	/// @brief directory のすべての月の家計簿から、同じレシートを重ねて登録した分を削除します。
+	/// 最初に登録したものを残します。削除は removeByRegisterDate と同じく削除済み印の追記で行います。
+	/// @param onComplete 削除を始めたレシートの数を受け取る
+	void removeDuplicates(FilePathView directory = U"", std::function<void(size_t)> onComplete = {})
+	{
+		m_io.post([this, directory = FilePath{ directory }, onComplete = std::move(onComplete)]() -> std::function<void()>
+			{
+				ScopedTrace trace(U"removeDuplicates", U"csv");
+
+				auto duplicates = std::make_shared<Array<std::pair<FilePath, String>>>();
+				for (const auto& file : FileSystem::DirectoryContents(directory.isEmpty() ? U"./" : directory, Recursive::No))
+				{
+					const auto fileName = FileSystem::FileName(file);
+					if (!IsLedgerMonthFileName(fileName))
+					{
+						continue;
+					}
+
+					const FilePath key = directory + fileName;
+					for (const auto& registerDate : LedgerMonth::Load(key).duplicateRegisterDates())
+					{
+						duplicates->emplace_back(key, registerDate);
+					}
+				}
+
+				return [this, duplicates, onComplete]
+					{
+						for (const auto& [key, registerDate] : *duplicates)
+						{
+							removeByRegisterDate(key, registerDate);
+						}
+
+						if (onComplete)
+						{
+							onComplete(duplicates->size());
+						}
+					};
+			});
+	}
+
+	/// @brief 行をファイルに追記します。書き込みが終わったらキャッシュに反映し、onComplete を呼びます。
+	void append(FilePathView path, const Array<Array<String>>& rows, Completion onComplete = {})
+	{
+		const FilePath key{ path };
+		auto& entry = request(key);
+		++entry.pendingCount;
+
+		// 書き込みが終わるまでの間に同じレシートを保存しようとした場合も findDuplicate で見つける
+		const auto fingerprint = ReceiptFingerprint::Of(rows);
+		if (!rows.empty())
+		{
+			entry.pendingFingerprints.emplace(fingerprint, rows.front()[Label::RegisterDate]);
+		}
+
+		std::string data;
+		for (const auto& row : rows)
+		{
+			AppendCSVRow(data, row);
+		}
+
+		m_io.post([this, key, rows, fingerprint, data = std::move(data), onComplete = std::move(onComplete)]() -> std::function<void()>
+			{
+				const bool succeeded = LedgerJournal::Instance().append(key, data);
+				const auto writeTime = FileSystem::WriteTime(key);
+				const auto signature = LedgerSearchIndex::Signature(key);
+
+				return [this, key, rows, fingerprint, onComplete, succeeded, writeTime, signature]
+					{
+						auto& cached = m_months[key];
+						--cached.pendingCount;
+						cached.pendingFingerprints.erase(fingerprint);
+
+						if (succeeded && cached.loaded)
+						{
+							for (const auto& row : rows)
+							{
+								cached.month.push_back(row);
+							}
+							cached.writeTime = writeTime;
+						}
+						else if (!succeeded)
+						{
+							// ファイルがどこまで書かれたか分からないので読み直す
+							cached.loaded = false;
+							cached.writeTime.reset();
+						}
+						++cached.version;
+
+						if (succeeded)
+						{
+							LedgerSearchIndex::Instance().addRows(key, rows, signature);
+						}
+
+						if (onComplete)
+						{
+							onComplete(succeeded);
+						}
+					};
+			});
+	}
+
+	/// @brief 登録日時が registerDate の行を削除します。
+	/// ファイルは書き直さず、削除済み印を追記するだけにします。
+	void removeByRegisterDate(FilePathView path, const String& registerDate, Completion onComplete = {})
+	{
+		const FilePath key{ path };
+		++request(key).pendingCount;
+
+		m_io.post([this, key, registerDate, onComplete = std::move(onComplete)]() -> std::function<void()>
+			{
+				const auto tombstonePath = LedgerTombstonePath(key);
+				const bool succeeded = LedgerJournal::Instance().append(tombstonePath, Unicode::ToUTF8(registerDate) + '\n');
+				const auto tombstoneWriteTime = FileSystem::WriteTime(tombstonePath);
+				const auto signature = LedgerSearchIndex::Signature(key);
+
+				return [this, key, registerDate, onComplete, succeeded, tombstoneWriteTime, signature]
+					{
+						auto& cached = m_months[key];
+						--cached.pendingCount;
+
+						if (succeeded && cached.loaded)
+						{
+							cached.month.removeByRegisterDate(registerDate);
+							cached.tombstoneWriteTime = tombstoneWriteTime;
+
+							if (!cached.compactionQueued && CompactionRatio < static_cast<double>(cached.month.removedSize()) / Max<size_t>(cached.month.size(), 1))
+							{
+								startCompaction(key, cached);
+							}
+						}
+						else if (!succeeded)
+						{
+							cached.loaded = false;
+							cached.tombstoneWriteTime.reset();
+						}
+						++cached.version;
+
+						if (succeeded)
+						{
+							LedgerSearchIndex::Instance().removeByRegisterDate(key, registerDate, signature);
+						}
+
+						if (onComplete)
+						{
+							onComplete(succeeded);
+						}
+					};
+			});
+	}
+
+private:
+
+	struct Entry
+	{
+		LedgerMonth month;
+		bool loaded = false;
+		Optional<DateTime> writeTime;
+		Optional<DateTime> tombstoneWriteTime;
+
+		// キャッシュが変わるたびに増やす
+		uint64 version = 0;
+
+		// 投入済みで完了処理がまだの読み書きの数
+		size_t pendingCount = 0;
+
+		// 書き込み中のレシートの指紋 -> 登録日時
+		HashTable<uint64, String> pendingFingerprints;
+
+		bool compactionQueued = false;
+	};
+
+	struct LoadResult
+	{
+		LedgerMonth month;
+		Optional<DateTime> writeTime;
+		Optional<DateTime> tombstoneWriteTime;
+
+		// 検索索引を作り直す場合の削除済みでない行
+		String signature;
+		Optional<Array<Array<String>>> searchRows;
+	};
+
+	Ledger() = default;
+
+	static LoadResult Load(const FilePath& path)
+	{
+		return LoadResult{ LedgerMonth::Load(path), FileSystem::WriteTime(path), FileSystem::WriteTime(LedgerTombstonePath(path)), LedgerSearchIndex::Signature(path) };
+	}
+
+	// 読み込みが済んでいなければ始める
+	// 自分の書き込みと区別できないので、読み書きの途中は更新日時を確かめない
+	Entry& request(FilePathView path)
+	{
+		const FilePath key{ path };
+		auto& cached = m_months[key];
+
+		if (cached.pendingCount == 0)
+		{
+			// 外部のエディタなどで書き換えられていたら読み直す
+			if (!cached.loaded
+				|| cached.writeTime != FileSystem::WriteTime(key)
+				|| cached.tombstoneWriteTime != FileSystem::WriteTime(LedgerTombstonePath(key)))
+			{
+				startLoad(key, cached);
+			}
+		}
+
+		return cached;
+	}
+
+	void startLoad(const FilePath& key, Entry& cached)
+	{
+		++cached.pendingCount;
+		m_io.post(loadJob(key, LedgerSearchIndex::Instance().signature(key)));
+	}
+
+	// 月を読み込み、キャッシュに反映する完了処理を返す処理
+	// 読み書きのスレッドのほか、preload の読み込みのスレッドでも実行する
+	LedgerIOThread::Job loadJob(const FilePath& key, const String& indexSignature)
+	{
+		return [this, key, indexSignature]() -> std::function<void()>
+			{
+				auto result = std::make_shared<LoadResult>(Load(key));
+
+				// 検索索引が別の時点のファイルから作られていたら作り直す
+				if (result->signature != indexSignature)
+				{
+					result->searchRows = result->month.liveRows();
+				}
+
+				return [this, key, result]
+					{
+						auto& cached = m_months[key];
+						--cached.pendingCount;
+
+						cached.month = std::move(result->month);
+						cached.writeTime = result->writeTime;
+						cached.tombstoneWriteTime = result->tombstoneWriteTime;
+						cached.loaded = true;
+						++cached.version;
+
+						if (result->searchRows)
+						{
+							LedgerSearchIndex::Instance().replaceMonth(key, *result->searchRows, result->signature);
+						}
+					};
+			};
+	}
+
+	// 削除済みの行を除いてファイルを書き直し、削除済み印を空にする
+	// 読み書きのスレッドで順番に実行するので、直前までの追記・削除はすべてファイルに反映されている
+	void startCompaction(const FilePath& key, Entry& cached)
+	{
+		++cached.pendingCount;
+		cached.compactionQueued = true;
+
+		m_io.post([this, key]() -> std::function<void()>
+			{
+				// 置き換えた後に古い追記位置の記録が再生されないよう、先に記録を空にしておく
+				std::shared_ptr<LoadResult> result;
+				if (LedgerJournal::Instance().checkpoint())
+				{
+					auto month = LedgerMonth::Load(key).compacted();
+
+					// 削除済み印は置き換え後のファイルに残っていても害はないので、CSV を先に置き換える
+					if (ReplaceFileAtomic(key, month.toCSV()) && ReplaceFileAtomic(LedgerTombstonePath(key), ""))
+					{
+						auto searchRows = month.liveRows();
+						result = std::make_shared<LoadResult>(LoadResult{ std::move(month), FileSystem::WriteTime(key), FileSystem::WriteTime(LedgerTombstonePath(key)), LedgerSearchIndex::Signature(key), std::move(searchRows) });
+					}
+				}
+
+				return [this, key, result]
+					{
+						auto& cached = m_months[key];
+						--cached.pendingCount;
+						cached.compactionQueued = false;
+
+						if (result)
+						{
+							cached.month = std::move(result->month);
+							cached.writeTime = result->writeTime;
+							cached.tombstoneWriteTime = result->tombstoneWriteTime;
+							cached.loaded = true;
+
+							// 削除済みの行が無くなった分、検索索引も詰める
+							LedgerSearchIndex::Instance().replaceMonth(key, *result->searchRows, result->signature);
+						}
+						else
+						{
+							Console << U"{} のコンパクションに失敗しました"_fmt(key);
+							cached.loaded = false;
+						}
+						++cached.version;
+					};
+			});
+	}
+
+	HashTable<FilePath, Entry> m_months;
+
+	// preload の進み具合
+	size_t m_preloadedCount = 0;
+	size_t m_preloadCount = 0;
+
+	// m_months より先に破棄される。残っている書き込みを終えてからスレッドを止め、完了処理は捨てる
+	LedgerIOThread m_io;
+};
@@ -0,0 +1,260 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <bit>
+#include <string_view>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LEDGER_CSV_SSE2
+#endif
+
+// 家計簿の CSV のセル
+// bytes はファイルの UTF-8 のバイト列をそのまま指す。引用符を含む場合は quoted が true で、bytes は引用符を含む
+struct LedgerCSVCell
+{
+	std::string_view bytes;
+	bool quoted = false;
+
+	/// @brief 引用符を外して String にします。
+	String toString() const
+	{
+		if (!quoted)
+		{
+			return Unicode::FromUTF8(bytes);
+		}
+
+		std::string unquoted;
+		unquoted.reserve(bytes.size());
+		bool inQuotes = false;
+		for (size_t i = 0; i < bytes.size(); ++i)
+		{
+			const char ch = bytes[i];
+			if (ch != '"')
+			{
+				unquoted.push_back(ch);
+			}
+			else if (inQuotes && i + 1 < bytes.size() && bytes[i + 1] == '"')
+			{
+				unquoted.push_back('"');
+				++i;
+			}
+			else
+			{
+				inQuotes = !inQuotes;
+			}
+		}
+		return Unicode::FromUTF8(unquoted);
+	}
+
+	/// @brief ParseOr<int32>(toString(), defaultValue) と同じ値を返します。
+	/// 符号と 9 桁までの数字だけの場合は String にせずに読みます。
+	int32 parseOr(int32 defaultValue) const
+	{
+		size_t pos = ((!bytes.empty() && bytes[0] == '-') ? 1 : 0);
+		if (quoted || bytes.size() <= pos || 9 < bytes.size() - pos)
+		{
+			return ParseOr<int32>(toString(), defaultValue);
+		}
+
+		int32 value = 0;
+		for (; pos < bytes.size(); ++pos)
+		{
+			if (bytes[pos] < '0' || '9' < bytes[pos])
+			{
+				return ParseOr<int32>(toString(), defaultValue);
+			}
+			value = value * 10 + (bytes[pos] - '0');
+		}
+		return (bytes[0] == '-') ? -value : value;
+	}
+};
+
+// 家計簿の CSV をメモリマップして、行をセルの範囲として読む
+// 区切り・引用符・改行は 16 バイトずつ SSE2 で探し、セルの中身は String にしない
+// 引用符の中では "" を " とし、引用符の外の改行の直前の \r は取り除く
+// ファイルを開いている間だけセルが有効なので、残すセルは toString() で String にする
+class LedgerCSVReader
+{
+public:
+
+	/// @brief ファイルをメモリマップして開きます。先頭の BOM は読み飛ばします。
+	explicit LedgerCSVReader(FilePathView path)
+		: m_file{ path }
+	{
+		if (!m_file)
+		{
+			return;
+		}
+
+		const auto mapped = m_file.mapAll();
+		reset(std::string_view{ reinterpret_cast<const char*>(mapped.data), mapped.size });
+		m_valid = true;
+	}
+
+	/// @brief メモリ上の CSV を読みます。bytes は読み終わるまで有効である必要があります。
+	explicit LedgerCSVReader(std::string_view bytes)
+	{
+		reset(bytes);
+		m_valid = true;
+	}
+
+	explicit operator bool() const
+	{
+		return m_valid;
+	}
+
+	/// @brief BOM を除いた大きさを返します。
+	size_t byteSize() const
+	{
+		return static_cast<size_t>(m_end - m_begin);
+	}
+
+	/// @brief 次の行を読みます。
+	/// @param cells 読んだ行のセル
+	/// @return 行が無い場合 false
+	bool next(Array<LedgerCSVCell>& cells)
+	{
+		cells.clear();
+		if (m_pos == m_end)
+		{
+			return false;
+		}
+
+		const char* cellBegin = m_pos;
+		bool quoted = false;
+		const char* p = m_pos;
+
+		const auto pushCell = [&](const char* cellEnd)
+			{
+				cells.push_back({ std::string_view{ cellBegin, static_cast<size_t>(cellEnd - cellBegin) }, quoted });
+			};
+
+		for (;;)
+		{
+			p = FindSpecial(p, m_end);
+			if (p == m_end)
+			{
+				pushCell(p);
+				m_pos = m_end;
+				return true;
+			}
+
+			switch (*p)
+			{
+			case ',':
+				pushCell(p);
+				cellBegin = ++p;
+				quoted = false;
+				break;
+			case '"':
+				quoted = true;
+				p = SkipQuoted(p + 1, m_end);
+				break;
+			case '\n':
+				pushCell(p);
+				m_pos = p + 1;
+				return true;
+			default: // '\r'
+				if (p + 1 == m_end || p[1] == '\n')
+				{
+					pushCell(p);
+					m_pos = (p + 1 == m_end) ? m_end : p + 2;
+					return true;
+				}
+				++p;
+				break;
+			}
+		}
+	}
+
+private:
+
+	void reset(std::string_view bytes)
+	{
+		if (bytes.starts_with("\xEF\xBB\xBF"))
+		{
+			bytes.remove_prefix(3);
+		}
+		m_begin = bytes.data();
+		m_pos = m_begin;
+		m_end = m_begin + bytes.size();
+	}
+
+	// 引用符の中を読み飛ばし、閉じる引用符の次を返す
+	static const char* SkipQuoted(const char* p, const char* end)
+	{
+		for (;;)
+		{
+			p = FindQuote(p, end);
+			if (p == end)
+			{
+				return end;
+			}
+			if (p + 1 < end && p[1] == '"')
+			{
+				p += 2;
+				continue;
+			}
+			return p + 1;
+		}
+	}
+
+	// , " \n \r のうち最初のものの位置を返す
+	static const char* FindSpecial(const char* p, const char* end)
+	{
+#ifdef LEDGER_CSV_SSE2
+		const __m128i comma = _mm_set1_epi8(',');
+		const __m128i quote = _mm_set1_epi8('"');
+		const __m128i lf = _mm_set1_epi8('\n');
+		const __m128i cr = _mm_set1_epi8('\r');
+		for (; 16 <= end - p; p += 16)
+		{
+			const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			const __m128i hit = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, quote)),
+				_mm_or_si128(_mm_cmpeq_epi8(chunk, lf), _mm_cmpeq_epi8(chunk, cr)));
+			if (const uint32 mask = static_cast<uint32>(_mm_movemask_epi8(hit)))
+			{
+				return p + std::countr_zero(mask);
+			}
+		}
+#endif
+		for (; p != end; ++p)
+		{
+			if (*p == ',' || *p == '"' || *p == '\n' || *p == '\r')
+			{
+				return p;
+			}
+		}
+		return end;
+	}
+
+	// " の位置を返す
+	static const char* FindQuote(const char* p, const char* end)
+	{
+#ifdef LEDGER_CSV_SSE2
+		const __m128i quote = _mm_set1_epi8('"');
+		for (; 16 <= end - p; p += 16)
+		{
+			const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			if (const uint32 mask = static_cast<uint32>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote))))
+			{
+				return p + std::countr_zero(mask);
+			}
+		}
+#endif
+		for (; p != end; ++p)
+		{
+			if (*p == '"')
+			{
+				return p;
+			}
+		}
+		return end;
+	}
+
+	MemoryMappedFileView m_file;
+	const char* m_begin = nullptr;
+	const char* m_pos = nullptr;
+	const char* m_end = nullptr;
+	bool m_valid = false;
+};
@@ -0,0 +1,612 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <atomic>
+#include <cstring>
+#include "Common.hpp"
+#include "LedgerFile.hpp"
+#include "LedgerCSV.hpp"
+
+// 家計簿を読み込む時に列形式のファイル（yyyy年MM月.rcol）を使う場合 true
+// CSV を読んだ時に列形式のファイルを作り、以降は CSV が変わるまでそちらを読む
+inline std::atomic<bool> LedgerColumnStoreEnabled = false;
+
+/// @brief 家計簿の CSV に対応する列形式のファイルのパスを返します。
+inline FilePath LedgerColumnPath(FilePathView csvPath)
+{
+	if (csvPath.ends_with(U".csv"))
+	{
+		return FilePath(csvPath.substr(0, csvPath.size() - 4)) + U".rcol";
+	}
+	return FilePath(csvPath) + U".rcol";
+}
+
+// 1 か月分の家計簿を列ごとに並べたバイナリファイル
+// 値段は int32、購入日は yyyymmdd、登録日時は yyyyMMddHHmmss の整数で持ち、
+// 店名とレシートIDは辞書の番号、品名は文字列の領域への位置で持つ
+// 文字列は UTF-32 のまま置くので、メモリマップしたファイルをそのまま StringView で参照できる
+// 整数にできない値（数字でない値段、形式の違う日付など）は元の文字列を別に持ち、CSV に戻した時に値ごとに元の文字列になるようにする
+// 戻るのは値だけで、引用符の付け方・改行コード・BOM・列の足りない行・余分な列は元の CSV のとおりにはならない
+// 作成元の CSV の LedgerFileSignature を持ち、CSV が変わったら使わない
+// 開いている間はファイルをマップしたままなので、読み終わったらすぐに閉じる
+class LedgerColumnFile
+{
+public:
+
+	LedgerColumnFile() = default;
+
+	/// @brief ファイルをメモリマップして開きます。形式が違う・壊れている場合は開けません。
+	explicit LedgerColumnFile(FilePathView path)
+		: m_file{ path }
+	{
+		if (!m_file)
+		{
+			return;
+		}
+
+		const auto mapped = m_file.mapAll();
+		m_data = reinterpret_cast<const char*>(mapped.data);
+		m_size = mapped.size;
+		m_valid = validate();
+	}
+
+	explicit operator bool() const
+	{
+		return m_valid;
+	}
+
+	size_t size() const
+	{
+		return m_rowCount;
+	}
+
+	/// @brief 作成元の CSV の LedgerFileSignature を返します。
+	StringView signature() const
+	{
+		return chars(Section::Signature);
+	}
+
+	int32 price(size_t rowIndex) const
+	{
+		return column<int32>(Section::Prices)[rowIndex];
+	}
+
+	/// @brief 購入日を yyyymmdd で返します。整数にできなかった場合は 0 を返します。
+	uint32 packedBuyDate(size_t rowIndex) const
+	{
+		return column<uint32>(Section::BuyDates)[rowIndex];
+	}
+
+	/// @brief 登録日時を yyyyMMddHHmmss で返します。整数にできなかった場合は 0 を返します。
+	uint64 packedRegisterDate(size_t rowIndex) const
+	{
+		return column<uint64>(Section::RegisterDates)[rowIndex];
+	}
+
+	StringView itemName(size_t rowIndex) const
+	{
+		return heapString(Section::ItemOffsets, Section::ItemChars, rowIndex);
+	}
+
+	uint32 shopIndex(size_t rowIndex) const
+	{
+		return column<uint32>(Section::ShopIndices)[rowIndex];
+	}
+
+	size_t shopCount() const
+	{
+		return sectionSize(Section::ShopOffsets) / sizeof(uint32) - 1;
+	}
+
+	StringView shopName(uint32 shopIndex) const
+	{
+		return heapString(Section::ShopOffsets, Section::ShopChars, shopIndex);
+	}
+
+	uint32 receiptIDIndex(size_t rowIndex) const
+	{
+		return column<uint32>(Section::ReceiptIDIndices)[rowIndex];
+	}
+
+	size_t receiptIDCount() const
+	{
+		return sectionSize(Section::ReceiptIDOffsets) / sizeof(uint32) - 1;
+	}
+
+	StringView receiptID(uint32 receiptIDIndex) const
+	{
+		return heapString(Section::ReceiptIDOffsets, Section::ReceiptIDChars, receiptIDIndex);
+	}
+
+	/// @brief CSV に書かれていた通りの文字列を返します。
+	String field(size_t rowIndex, Label label) const
+	{
+		if (const auto exception = findException(rowIndex, label))
+		{
+			return String{ *exception };
+		}
+
+		switch (label)
+		{
+		case Label::ItemName:
+			return String{ itemName(rowIndex) };
+		case Label::ItemPrice:
+			return Format(price(rowIndex));
+		case Label::ShopName:
+			return String{ shopName(shopIndex(rowIndex)) };
+		case Label::BuyDate:
+			return UnpackBuyDate(packedBuyDate(rowIndex));
+		case Label::RegisterDate:
+			return UnpackRegisterDate(packedRegisterDate(rowIndex));
+		case Label::ReceiptID:
+			return String{ receiptID(receiptIDIndex(rowIndex)) };
+		default:
+			return{};
+		}
+	}
+
+	/// @brief CSV の列の並びで行を返します。
+	Array<String> row(size_t rowIndex) const
+	{
+		Array<String> result(Label::Size);
+		for (size_t label = 0; label < Label::Size; ++label)
+		{
+			result[label] = field(rowIndex, static_cast<Label>(label));
+		}
+		return result;
+	}
+
+	/// @brief 元の CSV と同じ行の並びと値の CSV を、AppendCSVRow の形式で返します。
+	/// 値ごとには元の CSV と同じですが、引用符の付け方・改行コード（LF になる）・BOM は元のとおりにはならず、
+	/// ImportLedgerCSV で除いた列の足りない行と余分な列も戻りません。アプリが書いた CSV ならバイト列も同じになります。
+	std::string toCSV() const
+	{
+		std::string result;
+		for (size_t rowIndex = 0; rowIndex < size(); ++rowIndex)
+		{
+			AppendCSVRow(result, row(rowIndex));
+		}
+		return result;
+	}
+
+	/// @brief CSV の行から列形式のファイルの内容を作ります。
+	/// @param rows CSV の行（列が足りない行は含めない）
+	/// @param signature 作成元の CSV の LedgerFileSignature
+	static std::string Build(const Array<Array<String>>& rows, StringView signature)
+	{
+		const auto rowCount = static_cast<uint32>(rows.size());
+
+		Array<int32> prices(Arg::reserve = rowCount);
+		Array<uint32> buyDates(Arg::reserve = rowCount);
+		Array<uint64> registerDates(Arg::reserve = rowCount);
+		Array<uint32> shopIndices(Arg::reserve = rowCount);
+		Array<uint32> receiptIDIndices(Arg::reserve = rowCount);
+		Array<Exception> exceptions;
+
+		StringHeap items;
+		StringHeap shops;
+		StringHeap receiptIDs;
+		StringHeap exceptionStrings;
+		HashTable<String, uint32> shopDictionary;
+		HashTable<String, uint32> receiptIDDictionary;
+
+		const auto addException = [&](uint32 rowIndex, Label label, const String& str)
+			{
+				exceptions.push_back({ rowIndex, static_cast<uint32>(label), exceptionStrings.add(str) });
+			};
+
+		const auto addDictionary = [](HashTable<String, uint32>& dictionary, StringHeap& heap, const String& str)
+			{
+				if (auto it = dictionary.find(str); it != dictionary.end())
+				{
+					return it->second;
+				}
+				const auto index = heap.add(str);
+				dictionary.emplace(str, index);
+				return index;
+			};
+
+		for (uint32 rowIndex = 0; rowIndex < rowCount; ++rowIndex)
+		{
+			const auto& row = rows[rowIndex];
+
+			items.add(row[Label::ItemName]);
+			shopIndices.push_back(addDictionary(shopDictionary, shops, row[Label::ShopName]));
+			receiptIDIndices.push_back(addDictionary(receiptIDDictionary, receiptIDs, row[Label::ReceiptID]));
+
+			// LedgerMonth と同じく、数字でない値段は 0 として扱う
+			prices.push_back(ParseOr<int32>(row[Label::ItemPrice], 0));
+			if (Format(prices.back()) != row[Label::ItemPrice])
+			{
+				addException(rowIndex, Label::ItemPrice, row[Label::ItemPrice]);
+			}
+
+			buyDates.push_back(PackBuyDate(row[Label::BuyDate]));
+			if (buyDates.back() == 0)
+			{
+				addException(rowIndex, Label::BuyDate, row[Label::BuyDate]);
+			}
+
+			registerDates.push_back(PackRegisterDate(row[Label::RegisterDate]));
+			if (registerDates.back() == 0)
+			{
+				addException(rowIndex, Label::RegisterDate, row[Label::RegisterDate]);
+			}
+		}
+
+		StringHeap signatureHeap;
+		signatureHeap.add(signature);
+
+		Header header{};
+		header.magic = Magic;
+		header.version = Version;
+		header.rowCount = rowCount;
+		header.sectionCount = SectionCount;
+
+		std::string out(sizeof(Header), '\0');
+		const auto addSection = [&](Section section, const void* data, size_t size)
+			{
+				// 8 バイト境界に揃え、マップしたまま整数の配列として読めるようにする
+				out.resize((out.size() + 7) & ~size_t{ 7 }, '\0');
+				header.sections[static_cast<size_t>(section)] = { out.size(), size };
+				out.append(static_cast<const char*>(data), size);
+			};
+
+		addSection(Section::Prices, prices.data(), prices.size() * sizeof(int32));
+		addSection(Section::BuyDates, buyDates.data(), buyDates.size() * sizeof(uint32));
+		addSection(Section::RegisterDates, registerDates.data(), registerDates.size() * sizeof(uint64));
+		addSection(Section::ShopIndices, shopIndices.data(), shopIndices.size() * sizeof(uint32));
+		addSection(Section::ReceiptIDIndices, receiptIDIndices.data(), receiptIDIndices.size() * sizeof(uint32));
+		addSection(Section::ItemOffsets, items.offsets.data(), items.offsets.size() * sizeof(uint32));
+		addSection(Section::ItemChars, items.chars.data(), items.chars.size() * sizeof(char32));
+		addSection(Section::ShopOffsets, shops.offsets.data(), shops.offsets.size() * sizeof(uint32));
+		addSection(Section::ShopChars, shops.chars.data(), shops.chars.size() * sizeof(char32));
+		addSection(Section::ReceiptIDOffsets, receiptIDs.offsets.data(), receiptIDs.offsets.size() * sizeof(uint32));
+		addSection(Section::ReceiptIDChars, receiptIDs.chars.data(), receiptIDs.chars.size() * sizeof(char32));
+		addSection(Section::Exceptions, exceptions.data(), exceptions.size() * sizeof(Exception));
+		addSection(Section::ExceptionOffsets, exceptionStrings.offsets.data(), exceptionStrings.offsets.size() * sizeof(uint32));
+		addSection(Section::ExceptionChars, exceptionStrings.chars.data(), exceptionStrings.chars.size() * sizeof(char32));
+		addSection(Section::SignatureOffsets, signatureHeap.offsets.data(), signatureHeap.offsets.size() * sizeof(uint32));
+		addSection(Section::Signature, signatureHeap.chars.data(), signatureHeap.chars.size() * sizeof(char32));
+
+		std::memcpy(out.data(), &header, sizeof(Header));
+		return out;
+	}
+
+	/// @brief yyyy年MM月dd日 を yyyymmdd にします。形式が違う場合は 0 を返します。
+	static uint32 PackBuyDate(StringView str)
+	{
+		if (str.size() != 11 || str[4] != U'年' || str[7] != U'月' || str[10] != U'日')
+		{
+			return 0;
+		}
+
+		const auto year = ParseDigits(str, 0, 4);
+		const auto month = ParseDigits(str, 5, 2);
+		const auto day = ParseDigits(str, 8, 2);
+		if (!year || !month || !day || *year == 0)
+		{
+			return 0;
+		}
+		return static_cast<uint32>(*year * 10000 + *month * 100 + *day);
+	}
+
+	static String UnpackBuyDate(uint32 packed)
+	{
+		String result(11, U'0');
+		WriteDigits(result, 0, 4, packed / 10000);
+		result[4] = U'年';
+		WriteDigits(result, 5, 2, packed / 100 % 100);
+		result[7] = U'月';
+		WriteDigits(result, 8, 2, packed % 100);
+		result[10] = U'日';
+		return result;
+	}
+
+	/// @brief yyyy-MM-dd HH:mm:ss を yyyyMMddHHmmss にします。形式が違う場合は 0 を返します。
+	static uint64 PackRegisterDate(StringView str)
+	{
+		if (str.size() != 19 || str[4] != U'-' || str[7] != U'-' || str[10] != U' ' || str[13] != U':' || str[16] != U':')
+		{
+			return 0;
+		}
+
+		uint64 packed = 0;
+		for (const auto [pos, count] : { std::pair{ 0, 4 }, { 5, 2 }, { 8, 2 }, { 11, 2 }, { 14, 2 }, { 17, 2 } })
+		{
+			const auto value = ParseDigits(str, pos, count);
+			if (!value)
+			{
+				return 0;
+			}
+			packed = packed * ((count == 4) ? 10000 : 100) + *value;
+		}
+		return (packed < 10000000000ull) ? 0 : packed;
+	}
+
+	static String UnpackRegisterDate(uint64 packed)
+	{
+		String result(19, U'0');
+		WriteDigits(result, 0, 4, packed / 10000000000ull);
+		result[4] = U'-';
+		WriteDigits(result, 5, 2, packed / 100000000 % 100);
+		result[7] = U'-';
+		WriteDigits(result, 8, 2, packed / 1000000 % 100);
+		result[10] = U' ';
+		WriteDigits(result, 11, 2, packed / 10000 % 100);
+		result[13] = U':';
+		WriteDigits(result, 14, 2, packed / 100 % 100);
+		result[16] = U':';
+		WriteDigits(result, 17, 2, packed % 100);
+		return result;
+	}
+
+private:
+
+	static constexpr uint32 Magic = 0x4C4F4352; // "RCOL"
+	static constexpr uint32 Version = 1;
+
+	enum class Section : uint32
+	{
+		Prices,
+		BuyDates,
+		RegisterDates,
+		ShopIndices,
+		ReceiptIDIndices,
+		ItemOffsets,
+		ItemChars,
+		ShopOffsets,
+		ShopChars,
+		ReceiptIDOffsets,
+		ReceiptIDChars,
+		Exceptions,
+		ExceptionOffsets,
+		ExceptionChars,
+		SignatureOffsets,
+		Signature,
+		Count,
+	};
+
+	static constexpr size_t SectionCount = static_cast<size_t>(Section::Count);
+
+	struct SectionRange
+	{
+		uint64 offset = 0;
+		uint64 size = 0;
+	};
+
+	struct Header
+	{
+		uint32 magic = 0;
+		uint32 version = 0;
+		uint32 rowCount = 0;
+		uint32 sectionCount = 0;
+		SectionRange sections[SectionCount];
+	};
+
+	// 整数にできなかった値の元の文字列
+	struct Exception
+	{
+		uint32 rowIndex = 0;
+		uint32 label = 0;
+		uint32 stringIndex = 0;
+	};
+
+	// 文字列を続けて並べた領域と、各文字列の先頭位置（末尾は全体の長さ）
+	struct StringHeap
+	{
+		Array<uint32> offsets = { 0 };
+		std::u32string chars;
+
+		uint32 add(StringView str)
+		{
+			chars.append(str.data(), str.size());
+			offsets.push_back(static_cast<uint32>(chars.size()));
+			return static_cast<uint32>(offsets.size() - 2);
+		}
+	};
+
+	static Optional<uint32> ParseDigits(StringView str, size_t pos, size_t count)
+	{
+		uint32 value = 0;
+		for (size_t i = pos; i < pos + count; ++i)
+		{
+			if (str[i] < U'0' || U'9' < str[i])
+			{
+				return none;
+			}
+			value = value * 10 + (str[i] - U'0');
+		}
+		return value;
+	}
+
+	static void WriteDigits(String& str, size_t pos, size_t count, uint64 value)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			str[pos + count - 1 - i] = static_cast<char32>(U'0' + value % 10);
+			value /= 10;
+		}
+	}
+
+	size_t sectionSize(Section section) const
+	{
+		return static_cast<size_t>(m_header.sections[static_cast<size_t>(section)].size);
+	}
+
+	template <class Type>
+	const Type* column(Section section) const
+	{
+		return reinterpret_cast<const Type*>(m_data + m_header.sections[static_cast<size_t>(section)].offset);
+	}
+
+	StringView chars(Section section) const
+	{
+		return StringView{ column<char32>(section), sectionSize(section) / sizeof(char32) };
+	}
+
+	StringView heapString(Section offsetSection, Section charSection, size_t index) const
+	{
+		const auto offsets = column<uint32>(offsetSection);
+		return chars(charSection).substr(offsets[index], offsets[index + 1] - offsets[index]);
+	}
+
+	Optional<StringView> findException(size_t rowIndex, Label label) const
+	{
+		if (m_exceptionCount == 0)
+		{
+			return none;
+		}
+
+		// 行番号の昇順に並んでいる
+		const auto exceptions = column<Exception>(Section::Exceptions);
+		const auto first = std::lower_bound(exceptions, exceptions + m_exceptionCount, rowIndex, [](const Exception& e, size_t row) { return e.rowIndex < row; });
+		for (auto it = first; it != exceptions + m_exceptionCount && it->rowIndex == rowIndex; ++it)
+		{
+			if (it->label == static_cast<uint32>(label))
+			{
+				return heapString(Section::ExceptionOffsets, Section::ExceptionChars, it->stringIndex);
+			}
+		}
+		return none;
+	}
+
+	// 範囲外を読まないよう、開いた時に各領域の大きさと文字列の位置を確かめる
+	bool validate()
+	{
+		if (m_size < sizeof(Header))
+		{
+			return false;
+		}
+
+		std::memcpy(&m_header, m_data, sizeof(Header));
+		if (m_header.magic != Magic || m_header.version != Version || m_header.sectionCount != SectionCount)
+		{
+			return false;
+		}
+
+		for (const auto& section : m_header.sections)
+		{
+			if (section.offset % 8 != 0 || m_size < section.offset || m_size - section.offset < section.size)
+			{
+				return false;
+			}
+		}
+
+		m_rowCount = m_header.rowCount;
+		const auto expect = [&](Section section, size_t elementSize, size_t count)
+			{
+				return sectionSize(section) == elementSize * count;
+			};
+		if (!expect(Section::Prices, sizeof(int32), m_rowCount)
+			|| !expect(Section::BuyDates, sizeof(uint32), m_rowCount)
+			|| !expect(Section::RegisterDates, sizeof(uint64), m_rowCount)
+			|| !expect(Section::ShopIndices, sizeof(uint32), m_rowCount)
+			|| !expect(Section::ReceiptIDIndices, sizeof(uint32), m_rowCount)
+			|| !expect(Section::ItemOffsets, sizeof(uint32), m_rowCount + 1)
+			|| sectionSize(Section::Exceptions) % sizeof(Exception) != 0)
+		{
+			return false;
+		}
+		m_exceptionCount = sectionSize(Section::Exceptions) / sizeof(Exception);
+
+		const auto validHeap = [&](Section offsetSection, Section charSection)
+			{
+				const auto count = sectionSize(offsetSection) / sizeof(uint32);
+				if (count == 0 || sectionSize(offsetSection) % sizeof(uint32) != 0 || sectionSize(charSection) % sizeof(char32) != 0)
+				{
+					return false;
+				}
+
+				const auto offsets = column<uint32>(offsetSection);
+				if (offsets[0] != 0 || offsets[count - 1] != sectionSize(charSection) / sizeof(char32))
+				{
+					return false;
+				}
+				for (size_t i = 1; i < count; ++i)
+				{
+					if (offsets[i] < offsets[i - 1])
+					{
+						return false;
+					}
+				}
+				return true;
+			};
+		if (!validHeap(Section::ItemOffsets, Section::ItemChars)
+			|| !validHeap(Section::ShopOffsets, Section::ShopChars)
+			|| !validHeap(Section::ReceiptIDOffsets, Section::ReceiptIDChars)
+			|| !validHeap(Section::ExceptionOffsets, Section::ExceptionChars)
+			|| !validHeap(Section::SignatureOffsets, Section::Signature))
+		{
+			return false;
+		}
+
+		const auto shopIndices = column<uint32>(Section::ShopIndices);
+		const auto receiptIDIndices = column<uint32>(Section::ReceiptIDIndices);
+		for (size_t i = 0; i < m_rowCount; ++i)
+		{
+			if (shopCount() <= shopIndices[i] || receiptIDCount() <= receiptIDIndices[i])
+			{
+				return false;
+			}
+		}
+
+		const auto exceptions = column<Exception>(Section::Exceptions);
+		const auto exceptionStringCount = sectionSize(Section::ExceptionOffsets) / sizeof(uint32) - 1;
+		for (size_t i = 0; i < m_exceptionCount; ++i)
+		{
+			if (m_rowCount <= exceptions[i].rowIndex || exceptionStringCount <= exceptions[i].stringIndex
+				|| (i != 0 && exceptions[i].rowIndex < exceptions[i - 1].rowIndex))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	MemoryMappedFileView m_file;
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+	bool m_valid = false;
+
+	Header m_header{};
+	size_t m_rowCount = 0;
+	size_t m_exceptionCount = 0;
+};
+
+/// @brief 家計簿の CSV を読み、列形式のファイルを作ります。
+/// 列が足りない行は除き、余分な列は捨てます。
+inline bool ImportLedgerCSV(FilePathView csvPath)
+{
+	const auto signature = LedgerFileSignature(csvPath);
+
+	Array<Array<String>> rows;
+	{
+		LedgerCSVReader reader{ csvPath };
+		Array<LedgerCSVCell> cells;
+		while (reader && reader.next(cells))
+		{
+			if (Label::Size <= cells.size())
+			{
+				rows.push_back(cells.map([](const LedgerCSVCell& cell) { return cell.toString(); }));
+			}
+		}
+	}
+
+	return ReplaceFileAtomic(LedgerColumnPath(csvPath), LedgerColumnFile::Build(rows, signature));
+}
+
+/// @brief 列形式のファイルから家計簿の CSV を書き出します。値は元の CSV と同じですが、書式は LedgerColumnFile::toCSV のとおりです。
+inline bool ExportLedgerCSV(FilePathView columnPath, FilePathView csvPath)
+{
+	std::string bytes;
+	{
+		const LedgerColumnFile columns{ columnPath };
+		if (!columns)
+		{
+			return false;
+		}
+		bytes = columns.toCSV();
+	}
+	return ReplaceFileAtomic(csvPath, bytes);
+}
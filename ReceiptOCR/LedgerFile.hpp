@@ -0,0 +1,618 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#if SIV3D_PLATFORM(WINDOWS)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+#include "LedgerTests.hpp"
+
+// 月ごとの家計簿 CSV への書き込み
+
+// 区切り文字・引用符・改行を含むフィールドだけ引用符で囲む (RFC 4180)
+inline void AppendCSVField(std::string& out, StringView field)
+{
+	const auto utf8 = Unicode::ToUTF8(field);
+	if (utf8.find_first_of(",\"\r\n") == std::string::npos)
+	{
+		out += utf8;
+		return;
+	}
+
+	out += '"';
+	for (const char c : utf8)
+	{
+		if (c == '"')
+		{
+			out += '"';
+		}
+		out += c;
+	}
+	out += '"';
+}
+
+inline void AppendCSVRow(std::string& out, const Array<String>& row)
+{
+	for (const auto& [i, field] : Indexed(row))
+	{
+		if (i != 0)
+		{
+			out += ',';
+		}
+		AppendCSVField(out, field);
+	}
+	out += '\n';
+}
+
+#ifdef TEST_LEDGER_FAULT
+// 障害注入テスト用、正の間は書き込みのたびに減らし、0 になった書き込みを失敗させる
+// LedgerFaultResume が false の場合は LedgerFault を投げ、プロセスが強制終了されたのと同じく、以降の書き込みもすべて失敗させる
+// true の場合はディスクが一杯になった時のように、その書き込みだけを失敗させて以降の書き込みは続ける
+// 負の場合は何もしない
+inline std::atomic<int64> LedgerFaultCountdown = -1;
+inline std::atomic<bool> LedgerFaultResume = false;
+
+struct LedgerFault {};
+
+/// @return この書き込みを失敗させる場合 false
+inline bool LedgerFaultPoint()
+{
+	int64 count = LedgerFaultCountdown.load(std::memory_order_relaxed);
+	while (0 < count && !LedgerFaultCountdown.compare_exchange_weak(count, count - 1))
+	{
+	}
+
+	if (count != 0)
+	{
+		return true;
+	}
+
+	if (LedgerFaultResume.load(std::memory_order_relaxed))
+	{
+		// 0 から戻したスレッドの書き込みだけを失敗させる
+		return !LedgerFaultCountdown.compare_exchange_strong(count, -1);
+	}
+
+	throw LedgerFault{};
+}
+#else
+// 障害注入テスト以外では何もしない
+constexpr bool LedgerFaultPoint()
+{
+	return true;
+}
+#endif
+
+struct LedgerFileCloser
+{
+	void operator()(std::FILE* fp) const
+	{
+		std::fclose(fp);
+	}
+};
+
+using LedgerFileHandle = std::unique_ptr<std::FILE, LedgerFileCloser>;
+
+/// @brief ファイルを開きます。
+/// @param mode fopen のモード（"rb", "ab+", "wb" など）
+inline LedgerFileHandle OpenLedgerFile(FilePathView path, const char* mode)
+{
+#if SIV3D_PLATFORM(WINDOWS)
+	const std::wstring wideMode(mode, mode + std::strlen(mode));
+	return LedgerFileHandle{ ::_wfopen(Unicode::ToWstring(path).c_str(), wideMode.c_str()) };
+#else
+	return LedgerFileHandle{ std::fopen(Unicode::ToUTF8(path).c_str(), mode) };
+#endif
+}
+
+inline std::filesystem::path ToFilesystemPath(FilePathView path)
+{
+#if SIV3D_PLATFORM(WINDOWS)
+	return std::filesystem::path(Unicode::ToWstring(path));
+#else
+	return std::filesystem::path(Unicode::ToUTF8(path));
+#endif
+}
+
+inline bool WriteLedgerBytes(std::FILE* fp, std::string_view bytes)
+{
+#ifdef TEST_LEDGER_FAULT
+	if (!LedgerFaultPoint())
+	{
+		return false;
+	}
+
+	// 障害注入テストでは半分だけ書いた所でも止められるようにする
+	if (0 <= LedgerFaultCountdown.load(std::memory_order_relaxed))
+	{
+		const size_t half = bytes.size() / 2;
+		if (std::fwrite(bytes.data(), 1, half, fp) != half || std::fflush(fp) != 0)
+		{
+			return false;
+		}
+		if (!LedgerFaultPoint())
+		{
+			return false;
+		}
+		bytes.remove_prefix(half);
+	}
+#endif
+
+	return std::fwrite(bytes.data(), 1, bytes.size(), fp) == bytes.size();
+}
+
+// ディスクへの書き込みが終わるまで待つ
+inline bool CommitLedgerFile(std::FILE* fp)
+{
+	if (!LedgerFaultPoint())
+	{
+		return false;
+	}
+
+	bool succeeded = (std::fflush(fp) == 0);
+#if SIV3D_PLATFORM(WINDOWS)
+	succeeded = (::_commit(::_fileno(fp)) == 0) && succeeded;
+#else
+	succeeded = (::fsync(::fileno(fp)) == 0) && succeeded;
+#endif
+	return succeeded;
+}
+
+/// @brief ファイルの現在位置を返します。2 GB を超えるファイルでも正しい位置を返します。
+/// @return 失敗した場合は負の値
+inline int64 TellLedgerFile(std::FILE* fp)
+{
+#if SIV3D_PLATFORM(WINDOWS)
+	return ::_ftelli64(fp);
+#else
+	return static_cast<int64>(::ftello(fp));
+#endif
+}
+
+/// @brief ファイルを size バイトに切り詰め、ディスクへの書き込みが終わるまで待ちます。
+inline bool TruncateLedgerFile(FilePathView path, uint64 size)
+{
+	std::error_code error;
+	std::filesystem::resize_file(ToFilesystemPath(path), size, error);
+	if (error)
+	{
+		return false;
+	}
+
+	const auto fp = OpenLedgerFile(path, "ab");
+	return fp && CommitLedgerFile(fp.get());
+}
+
+/// @brief ファイルの内容をすべて読み込みます。ファイルが無い場合は空を返します。
+inline std::string ReadLedgerBytes(FilePathView path)
+{
+	std::string bytes;
+
+	const auto fp = OpenLedgerFile(path, "rb");
+	if (!fp)
+	{
+		return bytes;
+	}
+
+	char buffer[1 << 16];
+	size_t readSize = 0;
+	while ((readSize = std::fread(buffer, 1, sizeof(buffer), fp.get())) != 0)
+	{
+		bytes.append(buffer, readSize);
+	}
+
+	return bytes;
+}
+
+/// @brief 一時ファイルに書き込んでから置き換えることで、ファイルの内容を bytes に置き換えます。
+/// 途中で止まっても、元の内容か新しい内容のどちらかが残ります。
+/// @param path 書き込むファイル
+/// @param bytes 書き込むデータ
+/// @return 書き込みに成功した場合 true
+inline bool ReplaceFileAtomic(FilePathView path, std::string_view bytes)
+{
+	const FilePath tempPath = FilePath(path) + U".tmp";
+	{
+		const auto fp = OpenLedgerFile(tempPath, "wb");
+		if (!fp)
+		{
+			return false;
+		}
+
+		if (!WriteLedgerBytes(fp.get(), bytes) || !CommitLedgerFile(fp.get()))
+		{
+			return false;
+		}
+	}
+
+	if (!LedgerFaultPoint())
+	{
+		return false;
+	}
+
+	// MSVC の std::filesystem::rename は置き換え先があっても上書きする (MoveFileExW)
+	std::error_code error;
+	std::filesystem::rename(ToFilesystemPath(tempPath), ToFilesystemPath(path), error);
+	return !error;
+}
+
+// 家計簿ファイルへの追記を先行書き込みする記録（ledger.journal）
+// 追記の前に (ファイル, 追記位置, 内容) を記録して fsync し、家計簿ファイル自体は fsync しない
+// 起動時に記録を順に再生して、ファイルを各追記位置で切り詰めて書き直す（何度再生しても同じ結果になる）
+// 記録が溜まったら家計簿ファイルをまとめて fsync して記録を空にする（チェックポイント）
+// 複数のスレッドから使える
+class LedgerJournal
+{
+public:
+
+	// この件数を超えたらチェックポイントする
+	static constexpr size_t CheckpointRecordCount = 256;
+
+	static LedgerJournal& Instance()
+	{
+		static LedgerJournal instance;
+		return instance;
+	}
+
+	void setPath(FilePathView journalPath)
+	{
+		std::lock_guard lock{ m_mutex };
+		m_journalPath = journalPath;
+		m_dirtyFiles.clear();
+		m_recordCount = 0;
+		m_cancelFailed = false;
+	}
+
+	const FilePath& path() const
+	{
+		return m_journalPath;
+	}
+
+	/// @brief path の末尾に bytes を追記します。記録を fsync してから追記するので、true が返ればその追記は失われません。
+	/// @return 書き込みに成功した場合 true
+	bool append(FilePathView path, std::string_view bytes)
+	{
+		std::lock_guard lock{ m_mutex };
+
+		// 失敗した記録を取り消せなかった場合は、その後ろに記録を足しても再生されないので、チェックポイントで記録を空にできるまで追記しない
+		if (m_cancelFailed && !checkpointLocked())
+		{
+			return false;
+		}
+
+		auto fp = OpenLedgerFile(path, "ab+");
+		if (!fp)
+		{
+			return false;
+		}
+
+		if (std::fseek(fp.get(), 0, SEEK_END) != 0)
+		{
+			return false;
+		}
+		const int64 end = TellLedgerFile(fp.get());
+		if (end < 0)
+		{
+			return false;
+		}
+		const auto offset = static_cast<uint64>(end);
+
+		// 前回の書き込みが改行の手前で途切れていたら、行が繋がらないように改行を補う
+		std::string data;
+		if (0 < offset && std::fseek(fp.get(), -1, SEEK_END) == 0 && std::fgetc(fp.get()) != '\n')
+		{
+			data += '\n';
+		}
+		data += bytes;
+
+		uint64 recordBegin = 0;
+		if (!writeRecord(path, offset, data, recordBegin))
+		{
+			return false;
+		}
+
+		// "a" モードなので書き込み位置は常に末尾になる
+		std::fseek(fp.get(), 0, SEEK_END);
+		const bool written = WriteLedgerBytes(fp.get(), data) && (std::fflush(fp.get()) == 0);
+		fp.reset();
+
+		if (!written)
+		{
+			// 失敗を返した追記が起動時の再生で書き戻されないように、家計簿ファイルを追記位置まで戻してから記録を取り消す
+			// 取り消す前に止まった場合は、再生で追記を終えた状態になる
+			// 家計簿ファイルを戻せなかった場合は記録を残すので、再生すると追記を終えた状態か、同じ位置への後の追記で置き換えた状態になる
+			if (!TruncateLedgerFile(path, offset))
+			{
+				Console << U"{}: 失敗した追記を取り消せませんでした"_fmt(path);
+				m_dirtyFiles.emplace(path);
+				++m_recordCount;
+				return false;
+			}
+			cancelRecord(recordBegin);
+			return false;
+		}
+
+		m_dirtyFiles.emplace(path);
+		++m_recordCount;
+
+		if (CheckpointRecordCount <= m_recordCount)
+		{
+			checkpointLocked();
+		}
+
+		return true;
+	}
+
+	/// @brief 追記した家計簿ファイルを fsync し、記録を空にします。
+	bool checkpoint()
+	{
+		std::lock_guard lock{ m_mutex };
+		return checkpointLocked();
+	}
+
+	/// @brief 記録を再生し、途中で止まった追記をやり直します。起動時に家計簿を読む前に呼びます。
+	/// @return 書き直したファイルの数
+	size_t recover()
+	{
+		std::lock_guard lock{ m_mutex };
+
+		const auto journal = ReadLedgerBytes(m_journalPath);
+
+		// ファイルごとに、記録を順に当てはめた内容を作る
+		HashTable<FilePath, std::string> contents;
+		size_t pos = 0;
+		while (const auto record = ReadRecord(journal, pos))
+		{
+			auto it = contents.find(record->path);
+			if (it == contents.end())
+			{
+				it = contents.emplace(record->path, ReadLedgerBytes(record->path)).first;
+			}
+			Replay(it->second, record.value());
+			m_dirtyFiles.emplace(record->path);
+		}
+
+		if (pos < journal.size())
+		{
+			// 記録の書き込み中に止まったので、この追記は呼び出し元に成功を返していない
+			Console << U"{}: 末尾の不完全な記録 ({} bytes) を無視しました"_fmt(m_journalPath, journal.size() - pos);
+		}
+
+		size_t replayedCount = 0;
+		bool succeeded = true;
+		for (const auto& [path, content] : contents)
+		{
+			if (content == ReadLedgerBytes(path))
+			{
+				continue;
+			}
+
+			if (ReplaceFileAtomic(path, content))
+			{
+				++replayedCount;
+			}
+			else
+			{
+				Console << U"{}: 記録を再生できませんでした"_fmt(path);
+				succeeded = false;
+			}
+		}
+
+		// 再生できなかったファイルがあれば、次の起動でやり直せるように記録を残す
+		if (succeeded)
+		{
+			checkpointLocked();
+		}
+		return replayedCount;
+	}
+
+#ifdef TEST_LEDGER_FAULT
+	/// @brief 記録のあるファイルごとに、最初の記録の追記位置を返します。
+	/// それより前はチェックポイントで fsync 済みなので、電源が切れても失われません。
+	HashTable<FilePath, uint64> checkpointedSizes()
+	{
+		std::lock_guard lock{ m_mutex };
+
+		const auto journal = ReadLedgerBytes(m_journalPath);
+
+		HashTable<FilePath, uint64> sizes;
+		size_t pos = 0;
+		while (const auto record = ReadRecord(journal, pos))
+		{
+			sizes.emplace(record->path, record->offset);
+		}
+		return sizes;
+	}
+#endif
+
+private:
+
+	struct Record
+	{
+		FilePath path;
+		uint64 offset = 0;
+		std::string_view bytes;
+	};
+
+	LedgerJournal() = default;
+
+	// 記録の形式: "LJ <追記位置> <パスの長さ> <内容の長さ> <ハッシュ>\n" <パス> <内容> "\n"
+	// 書き込めなかった場合は途中まで書いた記録を取り消す
+	// @param recordBegin 記録を書いた位置の格納先（後で記録を取り消すのに使う）
+	bool writeRecord(FilePathView path, uint64 offset, std::string_view bytes, uint64& recordBegin)
+	{
+		const auto pathUTF8 = Unicode::ToUTF8(path);
+
+		std::string record = "LJ " + std::to_string(offset) + ' ' + std::to_string(pathUTF8.size()) + ' ' + std::to_string(bytes.size()) + ' ' + std::to_string(Hash(pathUTF8, bytes)) + '\n';
+		record += pathUTF8;
+		record += bytes;
+		record += '\n';
+
+		auto fp = OpenLedgerFile(m_journalPath, "ab");
+		if (!fp || std::fseek(fp.get(), 0, SEEK_END) != 0)
+		{
+			return false;
+		}
+		const int64 end = TellLedgerFile(fp.get());
+		if (end < 0)
+		{
+			return false;
+		}
+		recordBegin = static_cast<uint64>(end);
+
+		if (WriteLedgerBytes(fp.get(), record) && CommitLedgerFile(fp.get()))
+		{
+			return true;
+		}
+
+		// 途中で切れた記録や fsync できなかった記録を残すと、その後ろの記録が再生されなくなる
+		fp.reset();
+		cancelRecord(recordBegin);
+		return false;
+	}
+
+	// recordBegin から後ろの記録を取り消す
+	void cancelRecord(uint64 recordBegin)
+	{
+		if (!TruncateLedgerFile(m_journalPath, recordBegin))
+		{
+			Console << U"{}: 失敗した記録を取り消せませんでした"_fmt(m_journalPath);
+			m_cancelFailed = true;
+		}
+	}
+
+	static Optional<Record> ReadRecord(std::string_view journal, size_t& pos)
+	{
+		const auto headerEnd = journal.find('\n', pos);
+		if (headerEnd == std::string_view::npos)
+		{
+			return none;
+		}
+
+		unsigned long long offset = 0, pathSize = 0, bytesSize = 0, hash = 0;
+		const std::string header{ journal.substr(pos, headerEnd - pos) };
+		if (std::sscanf(header.c_str(), "LJ %llu %llu %llu %llu", &offset, &pathSize, &bytesSize, &hash) != 4)
+		{
+			return none;
+		}
+
+		const size_t bodyBegin = headerEnd + 1;
+		if (journal.size() < bodyBegin + pathSize + bytesSize + 1)
+		{
+			return none;
+		}
+
+		const auto pathUTF8 = journal.substr(bodyBegin, pathSize);
+		const auto bytes = journal.substr(bodyBegin + pathSize, bytesSize);
+		if (Hash(pathUTF8, bytes) != hash || journal[bodyBegin + pathSize + bytesSize] != '\n')
+		{
+			return none;
+		}
+
+		pos = bodyBegin + pathSize + bytesSize + 1;
+		return Record{ Unicode::FromUTF8(pathUTF8), offset, bytes };
+	}
+
+	// 追記は直列に行い、記録の順に再生するので、追記位置より後ろは常に記録の内容で置き換える
+	// 電源断で大きさだけが残り、fsync していない内容が 0 や古いデータになった場合も書き直される
+	static void Replay(std::string& content, const Record& record)
+	{
+		content.resize(Min(static_cast<size_t>(record.offset), content.size()));
+		content += record.bytes;
+	}
+
+	// FNV-1a
+	static uint64 Hash(std::string_view path, std::string_view bytes)
+	{
+		uint64 hash = 14695981039346656037ull;
+		for (const auto part : { path, bytes })
+		{
+			for (const char c : part)
+			{
+				hash = (hash ^ static_cast<uint8>(c)) * 1099511628211ull;
+			}
+		}
+		return hash;
+	}
+
+	bool checkpointLocked()
+	{
+		bool succeeded = true;
+		for (const auto& dirtyPath : m_dirtyFiles)
+		{
+			if (const auto fp = OpenLedgerFile(dirtyPath, "ab"))
+			{
+				succeeded = CommitLedgerFile(fp.get()) && succeeded;
+			}
+		}
+
+		// 家計簿ファイルがすべてディスクに書かれるまでは記録を消さない
+		if (!succeeded)
+		{
+			return false;
+		}
+
+		const auto fp = OpenLedgerFile(m_journalPath, "wb");
+		if (!fp || !CommitLedgerFile(fp.get()))
+		{
+			return false;
+		}
+
+		m_dirtyFiles.clear();
+		m_recordCount = 0;
+		m_cancelFailed = false;
+		return true;
+	}
+
+	std::mutex m_mutex;
+	FilePath m_journalPath = U"ledger.journal";
+	HashSet<FilePath> m_dirtyFiles;
+	size_t m_recordCount = 0;
+
+	// 失敗した記録を取り消せず、記録が壊れたままになっている
+	bool m_cancelFailed = false;
+};
+
+// 削除済み印のファイル、削除した登録日時を 1 行ずつ追記する
+inline FilePath LedgerTombstonePath(FilePathView path)
+{
+	return FilePath(path) + U".tombstone";
+}
+
+/// @brief ファイルの更新日時と大きさを返します。ファイルが無い場合は "-" を返します。
+/// 派生したファイル（索引や列形式のファイル）がどの時点のファイルから作られたかの比較に使います。
+inline String LedgerFileSignature(FilePathView path)
+{
+	const auto writeTime = FileSystem::WriteTime(path);
+	return writeTime ? U"{}:{}"_fmt(writeTime->format(U"yyyyMMddHHmmssSSS"), FileSystem::FileSize(path)) : String{ U"-" };
+}
+
+/// @brief 削除済み印のファイルを登録日時の一覧として読み込みます。
+/// @param path 家計簿の CSV ファイル
+inline Array<String> LoadLedgerTombstones(FilePathView path)
+{
+	Array<String> registerDates;
+
+	TextReader reader{ LedgerTombstonePath(path) };
+	if (!reader)
+	{
+		return registerDates;
+	}
+
+	String line;
+	while (reader.readLine(line))
+	{
+		if (!line.isEmpty())
+		{
+			registerDates.push_back(line);
+		}
+	}
+
+	return registerDates;
+}
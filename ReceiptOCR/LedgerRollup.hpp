@@ -0,0 +1,172 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <limits>
+
+// 金額の合計・件数・最小・最大
+struct RollupStats
+{
+	int64 sum = 0;
+	int64 count = 0;
+	int32 min = std::numeric_limits<int32>::max();
+	int32 max = std::numeric_limits<int32>::lowest();
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	void add(int32 price)
+	{
+		sum += price;
+		++count;
+		min = Min(min, price);
+		max = Max(max, price);
+	}
+
+	void merge(const RollupStats& other)
+	{
+		sum += other.sum;
+		count += other.count;
+		min = Min(min, other.min);
+		max = Max(max, other.max);
+	}
+};
+
+// ある期間の集計（全体・店ごと・品名ごと）
+struct RollupBucket
+{
+	RollupStats total;
+	HashTable<String, RollupStats> byShop;
+	HashTable<String, RollupStats> byItem;
+
+	void add(const String& shopName, const String& itemName, int32 price)
+	{
+		total.add(price);
+		byShop[shopName].add(price);
+		byItem[itemName].add(price);
+	}
+
+	void merge(const RollupBucket& other)
+	{
+		total.merge(other.total);
+		for (const auto& [shopName, stats] : other.byShop)
+		{
+			byShop[shopName].merge(stats);
+		}
+		for (const auto& [itemName, stats] : other.byItem)
+		{
+			byItem[itemName].merge(stats);
+		}
+	}
+};
+
+// 1 か月分の集計を日ごとと月全体で持つ
+// 追加は日と月の両方に足し込む。最小・最大は差し引けないので、削除は日ごとに集計し直してから月全体を作り直す
+class MonthRollup
+{
+public:
+
+	// 0 は購入日を読み取れなかった行
+	static constexpr uint32 DayCount = 32;
+
+	const RollupBucket& month() const
+	{
+		return m_month;
+	}
+
+	const RollupBucket& day(uint32 day) const
+	{
+		return m_days[day];
+	}
+
+	void add(uint32 day, const String& shopName, const String& itemName, int32 price)
+	{
+		m_days[day].add(shopName, itemName, price);
+		m_month.add(shopName, itemName, price);
+	}
+
+	/// @brief 日の集計を空にします。集計し直した後に rebuildMonth() を呼びます。
+	void clearDay(uint32 day)
+	{
+		m_days[day] = RollupBucket{};
+	}
+
+	/// @brief 日の集計にだけ足し込みます。
+	void addToDay(uint32 day, const String& shopName, const String& itemName, int32 price)
+	{
+		m_days[day].add(shopName, itemName, price);
+	}
+
+	/// @brief 日ごとの集計から月全体の集計を作り直します。
+	void rebuildMonth()
+	{
+		m_month = RollupBucket{};
+		for (const auto& day : m_days)
+		{
+			m_month.merge(day);
+		}
+	}
+
+private:
+
+	std::array<RollupBucket, DayCount> m_days;
+	RollupBucket m_month;
+};
+
+// Ledger::aggregate の結果
+struct RollupResult : RollupBucket
+{
+	// 月の初日 -> その月のうち期間に入る分の集計
+	Array<std::pair<Date, RollupStats>> byMonth;
+
+	// 読み込みが終わっていない月があった場合 false
+	bool complete = true;
+};
+
+/// @brief 購入日（yyyy年MM月dd日）の日を返します。読み取れない場合は 0 を返します。
+inline uint32 BuyDateDay(StringView buyDate)
+{
+	const auto monthPos = buyDate.find(U'月');
+	const auto dayPos = buyDate.find(U'日');
+	if (monthPos == StringView::npos || dayPos == StringView::npos || dayPos <= monthPos + 1)
+	{
+		return 0;
+	}
+
+	const auto day = ParseOpt<uint32>(buyDate.substr(monthPos + 1, dayPos - monthPos - 1));
+	return (day && 1 <= *day && *day < MonthRollup::DayCount) ? *day : 0;
+}
+
+/// @brief date の months か月後の月の初日を返します。
+inline Date AddMonths(const Date& date, int32 months)
+{
+	const int32 index = date.year * 12 + (date.month - 1) + months;
+	return Date{ index / 12, index % 12 + 1, 1 };
+}
+
+/// @brief date の月の家計簿のパス（yyyy年MM月.csv）を返します。
+inline FilePath LedgerMonthPath(const Date& date, FilePathView directory = U"")
+{
+	return FilePath{ directory } + date.format(U"yyyy年MM月") + U".csv";
+}
+
+/// @brief 月の家計簿のファイル名（yyyy年MM月.csv）の場合 true を返します。
+inline bool IsLedgerMonthFileName(StringView fileName)
+{
+	const auto isDigits = [&](size_t pos, size_t count)
+		{
+			for (size_t i = pos; i < pos + count; ++i)
+			{
+				if (fileName[i] < U'0' || U'9' < fileName[i])
+				{
+					return false;
+				}
+			}
+			return true;
+		};
+
+	return fileName.size() == 12
+		&& isDigits(0, 4) && fileName[4] == U'年'
+		&& isDigits(5, 2) && fileName[7] == U'月'
+		&& fileName.substr(8) == U".csv";
+}
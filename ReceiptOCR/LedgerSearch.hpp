@@ -0,0 +1,595 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <cstring>
+#include <memory>
+#include "Common.hpp"
+#include "Utility.hpp"
+#include "LedgerFile.hpp"
+
+// 検索結果の 1 件（品名か店名ごとにまとめる）
+struct LedgerSearchHit
+{
+	String text;
+	bool isShopName = false;
+
+	// 0 : 完全一致, 1 : 前方一致, 2 : 部分一致
+	int32 matchKind = 2;
+
+	// 削除済みでない行数
+	size_t count = 0;
+
+	// 最後に買った日（購入日の文字列）とその時の店名・値段
+	String lastBuyDate;
+	String lastShopName;
+	int32 lastPrice = 0;
+};
+
+// 全期間の家計簿の品名・店名を、2 文字ずつ（bigram）の転置索引で部分一致検索する
+// 単語の区切りがない日本語でも使えるよう、文字単位で区切る
+// 語（品名・店名の異なり）ごとに bigram の転置リストを持ち、全期間で語 -> (月, 行) の転置リストを持つ
+// 月ごとにファイルの更新日時と大きさを覚えておき、変わった月だけ作り直す
+// メインスレッドからのみ使う
+class LedgerSearchIndex
+{
+public:
+
+	static LedgerSearchIndex& Instance()
+	{
+		static LedgerSearchIndex instance;
+		return instance;
+	}
+
+	/// @brief 家計簿とその削除済み印のファイルの更新日時と大きさを返します。
+	/// 索引がどの時点のファイルから作られたかの比較に使います。
+	static String Signature(FilePathView path)
+	{
+		return LedgerFileSignature(path) + U"/" + LedgerFileSignature(LedgerTombstonePath(path));
+	}
+
+	void setPath(FilePathView path)
+	{
+		m_path = path;
+	}
+
+	/// @brief 索引が変わるたびに増える番号を返します。
+	uint64 version() const
+	{
+		return m_version;
+	}
+
+	/// @brief 月の索引の作成元の Signature を返します。索引に無い月は空を返します。
+	String signature(FilePathView path) const
+	{
+		if (auto it = m_months.find(FilePath(path)); it != m_months.end())
+		{
+			return it->second->signature;
+		}
+		return{};
+	}
+
+	/// @brief 月ごとの索引の作成元の Signature を返します。
+	HashTable<FilePath, String> signatures() const
+	{
+		HashTable<FilePath, String> result;
+		for (const auto& [path, month] : m_months)
+		{
+			result.emplace(path, month->signature);
+		}
+		return result;
+	}
+
+	/// @brief 月の行を追加します。
+	void addRows(FilePathView path, const Array<Array<String>>& rows, const String& signature)
+	{
+		auto& month = monthOf(path);
+		for (const auto& row : rows)
+		{
+			addRow(month, row);
+		}
+		month.signature = signature;
+		changed();
+	}
+
+	/// @brief 月の登録日時が registerDate の行を削除済みにします。
+	void removeByRegisterDate(FilePathView path, const String& registerDate, const String& signature)
+	{
+		auto& month = monthOf(path);
+		month.removedRegisterDates.insert(registerDate);
+		month.signature = signature;
+		changed();
+	}
+
+	/// @brief 月の索引を作り直します。
+	/// @param rows 削除済みでない行
+	void replaceMonth(FilePathView path, const Array<Array<String>>& rows, const String& signature)
+	{
+		auto& month = monthOf(path);
+		erasePostings(month);
+		month = Month{};
+		month.rows.reserve(rows.size());
+		for (const auto& row : rows)
+		{
+			addRow(month, row);
+		}
+		month.signature = signature;
+		changed();
+	}
+
+	/// @brief ファイルが無くなった月を索引から除きます。
+	void removeMonth(FilePathView path)
+	{
+		if (auto it = m_months.find(FilePath(path)); it != m_months.end())
+		{
+			erasePostings(*it->second);
+			m_months.erase(it);
+			changed();
+		}
+	}
+
+	/// @brief query を品名か店名に含む行を、品名・店名ごとにまとめて返します。
+	/// 完全一致、前方一致、部分一致の順に、同じ順位の中では最後に買った日が新しい順に並べます。
+	/// 一致した語の転置リストだけをたどるので、月の数ではなく一致した行の数に比例する時間で終わります。
+	Array<LedgerSearchHit> search(StringView query, size_t maxCount) const
+	{
+		Array<LedgerSearchHit> hits;
+		if (query.empty())
+		{
+			return hits;
+		}
+
+		for (const auto termID : matchTerms(query))
+		{
+			const auto& term = m_terms[termID];
+			const int32 matchKind = (StringView{ term } == query) ? 0 : term.starts_with(query) ? 1 : 2;
+
+			LedgerSearchHit itemHit{ .text = term, .isShopName = false, .matchKind = matchKind };
+			LedgerSearchHit shopHit{ .text = term, .isShopName = true, .matchKind = matchKind };
+
+			const auto it = m_postings.find(termID);
+			if (it == m_postings.end())
+			{
+				continue;
+			}
+
+			for (const auto& posting : it->second)
+			{
+				const auto& row = posting.month->rows[posting.rowIndex];
+				if (posting.month->removedRegisterDates.contains(row.registerDate))
+				{
+					continue;
+				}
+
+				if (row.itemName == termID)
+				{
+					addHit(itemHit, row);
+				}
+				if (row.shopName == termID)
+				{
+					addHit(shopHit, row);
+				}
+			}
+
+			for (const auto& hit : { itemHit, shopHit })
+			{
+				if (hit.count != 0)
+				{
+					hits.push_back(hit);
+				}
+			}
+		}
+
+		hits.sort_by([](const LedgerSearchHit& a, const LedgerSearchHit& b)
+			{
+				if (a.matchKind != b.matchKind)
+				{
+					return a.matchKind < b.matchKind;
+				}
+				if (a.lastBuyDate != b.lastBuyDate)
+				{
+					return a.lastBuyDate > b.lastBuyDate;
+				}
+				return a.count > b.count;
+			});
+
+		if (maxCount < hits.size())
+		{
+			hits.resize(maxCount);
+		}
+		return hits;
+	}
+
+	/// @brief 索引をファイルから読み込みます。読めない場合は空にし、次の作り直しで全ての月を読みます。
+	void load()
+	{
+		m_terms.clear();
+		m_bigrams.clear();
+		m_months.clear();
+		m_postings.clear();
+		changed();
+
+		const auto bytes = ReadLedgerBytes(m_path);
+		if (bytes.empty())
+		{
+			return;
+		}
+
+		Reader reader{ bytes };
+		if (!readIndex(reader) || !reader.ok)
+		{
+			Console << U"{} を読み込めませんでした。索引を作り直します"_fmt(m_path);
+			m_terms.clear();
+			m_bigrams.clear();
+			m_months.clear();
+			m_postings.clear();
+		}
+	}
+
+	/// @brief 前回の保存から変わっていれば、索引をファイルに保存します。
+	bool save()
+	{
+		if (!m_dirty)
+		{
+			return true;
+		}
+
+		std::string out;
+		Write(out, Magic);
+		Write(out, static_cast<uint32>(m_terms.size()));
+		for (uint32 termID = 0; termID < m_terms.size(); ++termID)
+		{
+			Write(out, m_terms[termID]);
+		}
+
+		Write(out, static_cast<uint32>(m_bigrams.size()));
+		for (const auto& [bigram, termIDs] : m_bigrams)
+		{
+			Write(out, bigram);
+			Write(out, static_cast<uint32>(termIDs.size()));
+			for (const auto termID : termIDs)
+			{
+				Write(out, termID);
+			}
+		}
+
+		Write(out, static_cast<uint32>(m_months.size()));
+		for (const auto& [path, month] : m_months)
+		{
+			Write(out, path);
+			Write(out, month->signature);
+			Write(out, static_cast<uint32>(month->rows.size()));
+			for (const auto& row : month->rows)
+			{
+				Write(out, row.itemName);
+				Write(out, row.shopName);
+				Write(out, static_cast<uint32>(row.price));
+				Write(out, row.buyDate);
+				Write(out, row.registerDate);
+			}
+			Write(out, static_cast<uint32>(month->removedRegisterDates.size()));
+			for (const auto& registerDate : month->removedRegisterDates)
+			{
+				Write(out, registerDate);
+			}
+		}
+
+		if (!ReplaceFileAtomic(m_path, out))
+		{
+			return false;
+		}
+		m_dirty = false;
+		return true;
+	}
+
+private:
+
+	static constexpr uint32 Magic = 0x3149534C; // "LSI1"
+
+	struct Row
+	{
+		uint32 itemName = 0;
+		uint32 shopName = 0;
+		int32 price = 0;
+		String buyDate;
+		String registerDate;
+	};
+
+	struct Month
+	{
+		String signature;
+		Array<Row> rows;
+		HashSet<String> removedRegisterDates;
+	};
+
+	// 語を品名か店名に持つ行
+	struct Posting
+	{
+		const Month* month = nullptr;
+		uint32 rowIndex = 0;
+	};
+
+	struct Reader
+	{
+		const std::string& bytes;
+		size_t pos = 0;
+		bool ok = true;
+
+		template <class Type>
+		Type read()
+		{
+			Type value{};
+			if (bytes.size() < pos + sizeof(Type))
+			{
+				ok = false;
+				return value;
+			}
+			std::memcpy(&value, bytes.data() + pos, sizeof(Type));
+			pos += sizeof(Type);
+			return value;
+		}
+
+		String readString()
+		{
+			const auto length = read<uint32>();
+			if (!ok || bytes.size() < pos + length)
+			{
+				ok = false;
+				return{};
+			}
+			const auto str = Unicode::FromUTF8(std::string_view{ bytes.data() + pos, length });
+			pos += length;
+			return str;
+		}
+	};
+
+	LedgerSearchIndex() = default;
+
+	template <class Type>
+	static void Write(std::string& out, Type value)
+	{
+		char buffer[sizeof(Type)];
+		std::memcpy(buffer, &value, sizeof(Type));
+		out.append(buffer, sizeof(Type));
+	}
+
+	static void Write(std::string& out, const String& str)
+	{
+		const auto utf8 = Unicode::ToUTF8(str);
+		Write(out, static_cast<uint32>(utf8.size()));
+		out.append(utf8);
+	}
+
+	static uint64 Bigram(char32 a, char32 b)
+	{
+		return (static_cast<uint64>(a) << 32) | b;
+	}
+
+	void changed()
+	{
+		++m_version;
+		m_dirty = true;
+	}
+
+	// 月の索引を返す。無い場合は空の月を加える
+	Month& monthOf(FilePathView path)
+	{
+		auto& month = m_months[FilePath(path)];
+		if (!month)
+		{
+			month = std::make_unique<Month>();
+		}
+		return *month;
+	}
+
+	// 月の行を語の転置リストに加える
+	void addPostings(const Month& month, uint32 rowIndex)
+	{
+		const auto& row = month.rows[rowIndex];
+		m_postings[row.itemName].push_back({ &month, rowIndex });
+		if (row.shopName != row.itemName)
+		{
+			m_postings[row.shopName].push_back({ &month, rowIndex });
+		}
+	}
+
+	// 月の行を語の転置リストから除く。月の行に現れる語の転置リストだけを見る
+	void erasePostings(const Month& month)
+	{
+		HashSet<uint32> termIDs;
+		for (const auto& row : month.rows)
+		{
+			termIDs.insert(row.itemName);
+			termIDs.insert(row.shopName);
+		}
+
+		for (const auto termID : termIDs)
+		{
+			if (auto it = m_postings.find(termID); it != m_postings.end())
+			{
+				it->second.remove_if([&](const Posting& posting) { return posting.month == &month; });
+				if (it->second.empty())
+				{
+					m_postings.erase(it);
+				}
+			}
+		}
+	}
+
+	// 初めての語は bigram の転置リストにも加える
+	// 語の番号は増える一方なので、転置リストは末尾に足すだけで昇順が保たれる
+	uint32 internTerm(const String& term)
+	{
+		const auto size = m_terms.size();
+		const auto termID = m_terms.intern(term);
+		if (m_terms.size() == size)
+		{
+			return termID;
+		}
+
+		HashSet<uint64> bigrams;
+		for (size_t i = 0; i + 1 < term.size(); ++i)
+		{
+			bigrams.insert(Bigram(term[i], term[i + 1]));
+		}
+		for (const auto bigram : bigrams)
+		{
+			m_bigrams[bigram].push_back(termID);
+		}
+		return termID;
+	}
+
+	void addRow(Month& month, const Array<String>& row)
+	{
+		const auto rowIndex = static_cast<uint32>(month.rows.size());
+
+		Row indexed;
+		indexed.itemName = internTerm(row[Label::ItemName]);
+		indexed.shopName = internTerm(row[Label::ShopName]);
+		indexed.price = ParseOr<int32>(row[Label::ItemPrice], 0);
+		indexed.buyDate = row[Label::BuyDate];
+		indexed.registerDate = row[Label::RegisterDate];
+
+		month.rows.push_back(std::move(indexed));
+		addPostings(month, rowIndex);
+	}
+
+	void addHit(LedgerSearchHit& hit, const Row& row) const
+	{
+		++hit.count;
+		if (hit.lastBuyDate <= row.buyDate)
+		{
+			hit.lastBuyDate = row.buyDate;
+			hit.lastShopName = m_terms[row.shopName];
+			hit.lastPrice = row.price;
+		}
+	}
+
+	// query を含む語の番号
+	// 2 文字以上の場合は bigram の転置リストの共通部分を候補にして、本当に含むかを確かめる
+	Array<uint32> matchTerms(StringView query) const
+	{
+		Array<uint32> result;
+
+		if (query.size() < 2)
+		{
+			for (uint32 termID = 0; termID < m_terms.size(); ++termID)
+			{
+				if (m_terms[termID].includes(query))
+				{
+					result.push_back(termID);
+				}
+			}
+			return result;
+		}
+
+		Array<const Array<uint32>*> lists;
+		for (size_t i = 0; i + 1 < query.size(); ++i)
+		{
+			const auto it = m_bigrams.find(Bigram(query[i], query[i + 1]));
+			if (it == m_bigrams.end())
+			{
+				return result;
+			}
+			lists.push_back(&it->second);
+		}
+
+		// 短いリストから絞り込む
+		lists.sort_by([](const auto* a, const auto* b) { return a->size() < b->size(); });
+
+		result = *lists.front();
+		for (size_t i = 1; i < lists.size() && !result.empty(); ++i)
+		{
+			Array<uint32> intersection;
+			std::set_intersection(result.begin(), result.end(), lists[i]->begin(), lists[i]->end(), std::back_inserter(intersection));
+			result = std::move(intersection);
+		}
+
+		result.remove_if([&](uint32 termID) { return !m_terms[termID].includes(query); });
+		return result;
+	}
+
+	bool readIndex(Reader& reader)
+	{
+		if (reader.read<uint32>() != Magic)
+		{
+			return false;
+		}
+
+		const auto termCount = reader.read<uint32>();
+		for (uint32 i = 0; i < termCount && reader.ok; ++i)
+		{
+			m_terms.intern(reader.readString());
+		}
+		if (m_terms.size() != termCount)
+		{
+			return false;
+		}
+
+		const auto bigramCount = reader.read<uint32>();
+		for (uint32 i = 0; i < bigramCount && reader.ok; ++i)
+		{
+			auto& termIDs = m_bigrams[reader.read<uint64>()];
+			const auto count = reader.read<uint32>();
+			for (uint32 k = 0; k < count && reader.ok; ++k)
+			{
+				// 検索は m_terms[termID] を引き、set_intersection で絞り込むので、範囲内で昇順に並んでいる必要がある
+				const auto termID = reader.read<uint32>();
+				if (termCount <= termID || (!termIDs.empty() && termID <= termIDs.back()))
+				{
+					return false;
+				}
+				termIDs.push_back(termID);
+			}
+		}
+
+		const auto monthCount = reader.read<uint32>();
+		for (uint32 i = 0; i < monthCount && reader.ok; ++i)
+		{
+			auto& month = monthOf(reader.readString());
+			month.signature = reader.readString();
+
+			const auto rowCount = reader.read<uint32>();
+			for (uint32 rowIndex = 0; rowIndex < rowCount && reader.ok; ++rowIndex)
+			{
+				Row row;
+				row.itemName = reader.read<uint32>();
+				row.shopName = reader.read<uint32>();
+				row.price = static_cast<int32>(reader.read<uint32>());
+				row.buyDate = reader.readString();
+				row.registerDate = reader.readString();
+				if (termCount <= row.itemName || termCount <= row.shopName)
+				{
+					return false;
+				}
+
+				month.rows.push_back(std::move(row));
+				addPostings(month, static_cast<uint32>(month.rows.size() - 1));
+			}
+
+			const auto removedCount = reader.read<uint32>();
+			for (uint32 k = 0; k < removedCount && reader.ok; ++k)
+			{
+				month.removedRegisterDates.insert(reader.readString());
+			}
+		}
+
+		m_dirty = false;
+		return true;
+	}
+
+	FilePath m_path = U"ledger.search";
+
+	// 語（品名・店名）
+	StringPool m_terms;
+
+	// bigram -> その bigram を含む語の番号（昇順）
+	HashTable<uint64, Array<uint32>> m_bigrams;
+
+	// 転置リストが月を指すので、月の索引はアドレスが変わらないように持つ
+	HashTable<FilePath, std::unique_ptr<Month>> m_months;
+
+	// 語 -> その語を品名か店名に持つ全期間の行
+	HashTable<uint32, Array<Posting>> m_postings;
+
+	uint64 m_version = 0;
+	bool m_dirty = false;
+};
@@ -0,0 +1,615 @@
+﻿#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <thread>
+#include "LedgerTests.hpp"
+#include "Ledger.hpp"
+
+#ifdef TEST_LEDGER_FAULT
+// 家計簿の書き込みを無作為な位置で止めて再起動し、確定済みの登録が失われていないか確かめる
+// 奇数回目は 1 回だけ書き込みを失敗させて、以降の書き込みを続ける
+// 再起動の前に、電源が切れた場合と同じく fsync していない追記を消すか 0 で埋める
+// 止まった操作と失敗した操作は、全く反映されていないか全て反映されているかのどちらかでなければならない
+bool RunLedgerFaultTest(int32 trialCount)
+{
+	const FilePath directory = U"test/ledger_fault/";
+	const FilePath csvPath = directory + U"2024年01月.csv";
+	auto& ledger = Ledger::Instance();
+	auto& journal = LedgerJournal::Instance();
+
+	size_t failedCount = 0;
+	for (int32 trial = 0; trial < trialCount; ++trial)
+	{
+		FileSystem::Remove(directory);
+		FileSystem::CreateDirectories(directory);
+		journal.setPath(directory + U"ledger.journal");
+		ledger.clear();
+
+		// 登録日時 -> 行数
+		HashTable<String, size_t> committed;
+		HashSet<String> deleted;
+
+		// 止まったか失敗した操作の登録日時 -> 行数
+		HashTable<String, size_t> uncertain;
+
+		LedgerFaultResume = (trial % 2 == 1);
+		LedgerFaultCountdown = Random(0, 400);
+		try
+		{
+			for (int32 i = 0; i < 40; ++i)
+			{
+				if (i % 4 == 3 && !committed.empty())
+				{
+					const auto registerDate = std::next(committed.begin(), Random(committed.size() - 1))->first;
+					uncertain[registerDate] = committed[registerDate];
+
+					bool succeeded = false;
+					ledger.removeByRegisterDate(csvPath, registerDate, [&](bool result) { succeeded = result; });
+					ledger.waitIdle();
+					if (succeeded)
+					{
+						committed.erase(registerDate);
+						deleted.insert(registerDate);
+						uncertain.erase(registerDate);
+					}
+				}
+				else
+				{
+					const auto registerDate = U"2024/01/01 00:00:{:0>2}"_fmt(i);
+					const size_t rowCount = Random(1, 5);
+
+					Array<Array<String>> rows;
+					for (size_t k = 0; k < rowCount; ++k)
+					{
+						// 引用符・改行を含むフィールドも混ぜる
+						rows.push_back({ U"品名\"{}\",\n{}"_fmt(i, k), Format(i * 100 + k), U"テスト店", U"2024年01月01日", registerDate, U"ID202401010000" });
+					}
+
+					uncertain[registerDate] = rowCount;
+
+					bool succeeded = false;
+					ledger.append(csvPath, rows, [&](bool result) { succeeded = result; });
+					ledger.waitIdle();
+					if (succeeded)
+					{
+						committed.emplace(registerDate, rowCount);
+						uncertain.erase(registerDate);
+					}
+				}
+			}
+		}
+		catch (const LedgerFault&)
+		{
+		}
+
+		// 止まった時点で残っていた読み書きも、止まったものとして捨てる
+		ledger.clear();
+		LedgerFaultCountdown = -1;
+
+		// 電源が切れた場合と同じく、最後のチェックポイントより後の追記は消えるか、大きさだけが残って中身が 0 になる
+		for (const auto& [path, size] : journal.checkpointedSizes())
+		{
+			auto content = ReadLedgerBytes(path);
+			if (content.size() <= size)
+			{
+				continue;
+			}
+
+			if (RandomBool())
+			{
+				content.resize(static_cast<size_t>(size));
+			}
+			else
+			{
+				std::fill(content.begin() + static_cast<ptrdiff_t>(size), content.end(), '\0');
+			}
+			ReplaceFileAtomic(path, content);
+		}
+
+		// 再起動
+		journal.recover();
+		ledger.month(csvPath);
+		ledger.waitIdle();
+
+		HashTable<String, size_t> counts;
+		const auto& month = *ledger.month(csvPath);
+		for (size_t i = 0; i < month.size(); ++i)
+		{
+			if (!month.removed(i))
+			{
+				++counts[month.row(i)[Label::RegisterDate]];
+			}
+		}
+
+		bool succeeded = true;
+		for (const auto& [registerDate, rowCount] : committed)
+		{
+			if (!uncertain.contains(registerDate) && counts[registerDate] != rowCount)
+			{
+				Console << U"trial {}: {} の {} 行が {} 行になりました"_fmt(trial, registerDate, rowCount, counts[registerDate]);
+				succeeded = false;
+			}
+		}
+		for (const auto& registerDate : deleted)
+		{
+			if (counts[registerDate] != 0)
+			{
+				Console << U"trial {}: 削除した {} が残っています"_fmt(trial, registerDate);
+				succeeded = false;
+			}
+		}
+		for (const auto& [registerDate, rowCount] : uncertain)
+		{
+			if (counts[registerDate] != 0 && counts[registerDate] != rowCount)
+			{
+				Console << U"trial {}: 途中で止まった {} が {} 行だけ反映されました"_fmt(trial, registerDate, counts[registerDate]);
+				succeeded = false;
+			}
+		}
+		for (const auto& [registerDate, count] : counts)
+		{
+			if (count != 0 && !committed.contains(registerDate) && !uncertain.contains(registerDate))
+			{
+				Console << U"trial {}: 登録していない {} が {} 行あります"_fmt(trial, registerDate, count);
+				succeeded = false;
+			}
+		}
+
+		if (!succeeded)
+		{
+			++failedCount;
+		}
+	}
+
+	Console << U"ledger fault test: {} / {} 回成功"_fmt(trialCount - failedCount, trialCount);
+	LedgerFaultResume = false;
+	FileSystem::Remove(directory);
+	journal.setPath(U"ledger.journal");
+	return failedCount == 0;
+}
+#endif
+
+#ifdef BENCH_LEDGER
+// 10 年分の家計簿を作り、月ごとの集計を使った期間の集計と、行を読み直す集計の時間を比べる
+void RunLedgerBenchmark()
+{
+	const FilePath directory = U"test/ledger_bench/";
+	const Date begin{ 2015, 1, 1 };
+	const int32 monthCount = 120;
+	auto& ledger = Ledger::Instance();
+
+	FileSystem::Remove(directory);
+	FileSystem::CreateDirectories(directory);
+	ledger.clear();
+	Reseed(12345);
+
+	// 1 日に 0 - 3 枚、1 枚に 1 - 12 点のレシート
+	// 100 枚に 1 枚は、同じレシートを 12 時間後にもう一度登録したことにする
+	size_t rowCount = 0;
+	size_t duplicateCount = 0;
+	for (int32 monthIndex = 0; monthIndex < monthCount; ++monthIndex)
+	{
+		const auto first = AddMonths(begin, monthIndex);
+
+		std::string data;
+		for (int32 day = 1; day <= first.daysInMonth(); ++day)
+		{
+			const Date date{ first.year, first.month, day };
+			const auto buyDate = date.format(U"yyyy年MM月dd日");
+			for (int32 receipt = 0, receiptCount = Random(0, 3); receipt < receiptCount; ++receipt)
+			{
+				const auto registerDate = U"{} {:0>2}:00:00"_fmt(date.format(U"yyyy-MM-dd"), 9 + receipt);
+				const auto receiptID = U"ID{}{:0>2}00"_fmt(date.format(U"yyyyMMdd"), 9 + receipt);
+				const auto shopName = U"店{}"_fmt(Random(1, 20));
+
+				Array<Array<String>> rows;
+				for (int32 item = 0, itemCount = Random(1, 12); item < itemCount; ++item)
+				{
+					rows.push_back({ U"品{}"_fmt(Random(1, 200)), Format(Random(10, 3000)), shopName, buyDate, registerDate, receiptID });
+				}
+
+				const bool duplicated = (Random(0, 99) == 0);
+				for (const auto& row : rows)
+				{
+					AppendCSVRow(data, row);
+				}
+				if (duplicated)
+				{
+					for (auto row : rows)
+					{
+						row[Label::RegisterDate] = U"{} {:0>2}:00:00"_fmt(date.format(U"yyyy-MM-dd"), 21 + receipt);
+						AppendCSVRow(data, row);
+					}
+					++duplicateCount;
+				}
+				rowCount += rows.size() * (duplicated ? 2 : 1);
+			}
+		}
+		ReplaceFileAtomic(LedgerMonthPath(first, directory), data);
+	}
+
+	const Date end{ AddMonths(begin, monthCount - 1).year, 12, 31 };
+	size_t mismatchCount = 0;
+
+	// 読み込みと集計の作成（読み書きのスレッドで 1 か月ずつ）
+	Stopwatch loadTimer{ StartImmediately::Yes };
+	ledger.aggregate(begin, end, directory);
+	ledger.waitIdle();
+	const double loadMs = loadTimer.msF();
+
+	// 起動時と同じく、すべての月を並べて読み込む場合。最初の月が使えるまでの時間も測る
+	ledger.clear();
+	Stopwatch preloadTimer{ StartImmediately::Yes };
+	ledger.preload(directory);
+	Optional<double> firstMonthMs;
+	while (ledger.preloading())
+	{
+		ledger.update();
+		if (!firstMonthMs && ledger.preloadProgress().first != 0)
+		{
+			firstMonthMs = preloadTimer.msF();
+		}
+		std::this_thread::yield();
+	}
+	ledger.waitIdle();
+	const double preloadMs = preloadTimer.msF();
+	if (!ledger.aggregate(begin, end, directory).complete)
+	{
+		++mismatchCount;
+	}
+
+	// 行を読み直して集計する場合
+	const auto scan = [&](const Date& from, const Date& to)
+		{
+			RollupStats total;
+			const int32 fromKey = from.year * 10000 + from.month * 100 + from.day;
+			const int32 toKey = to.year * 10000 + to.month * 100 + to.day;
+			for (Date first = AddMonths(from, 0); (first.year * 12 + first.month) <= (to.year * 12 + to.month); first = AddMonths(first, 1))
+			{
+				const auto ledgerMonth = ledger.month(LedgerMonthPath(first, directory));
+				for (size_t i = 0; i < ledgerMonth->size(); ++i)
+				{
+					if (ledgerMonth->removed(i))
+					{
+						continue;
+					}
+
+					const auto row = ledgerMonth->row(i);
+					const int32 key = first.year * 10000 + first.month * 100 + static_cast<int32>(BuyDateDay(row[Label::BuyDate]));
+					if (fromKey <= key && key <= toKey)
+					{
+						total.add(ParseOr<int32>(row[Label::ItemPrice], 0));
+					}
+				}
+			}
+			return total;
+		};
+
+	Array<std::pair<Date, Date>> ranges;
+	for (int32 i = 0; i < 1000; ++i)
+	{
+		int32 a = Random(0, monthCount - 1);
+		int32 b = Random(0, monthCount - 1);
+		if (b < a)
+		{
+			std::swap(a, b);
+		}
+
+		Date from = AddMonths(begin, a);
+		Date to = AddMonths(begin, b);
+		from.day = Random(1, from.daysInMonth());
+		to.day = Random((a == b) ? from.day : 1, to.daysInMonth());
+		ranges.emplace_back(from, to);
+	}
+
+	Array<RollupStats> rollupTotals;
+	Stopwatch rollupTimer{ StartImmediately::Yes };
+	for (const auto& [from, to] : ranges)
+	{
+		rollupTotals.push_back(ledger.aggregate(from, to, directory).total);
+	}
+	const double rollupMs = rollupTimer.msF();
+
+	Stopwatch scanTimer{ StartImmediately::Yes };
+	for (const auto& [rangeIndex, range] : Indexed(ranges))
+	{
+		const auto total = scan(range.first, range.second);
+		if (total.sum != rollupTotals[rangeIndex].sum || total.count != rollupTotals[rangeIndex].count)
+		{
+			++mismatchCount;
+		}
+	}
+	const double scanMs = scanTimer.msF();
+
+	// 品名の検索（索引は月の読み込みで作られている）
+	const auto& searchIndex = LedgerSearchIndex::Instance();
+	Stopwatch searchTimer{ StartImmediately::Yes };
+	for (int32 i = 0; i < 1000; ++i)
+	{
+		searchIndex.search(U"品{}"_fmt(Random(1, 200)), 20);
+	}
+	const double searchMs = searchTimer.msF();
+
+	size_t itemCount = 0;
+	for (int32 monthIndex = 0; monthIndex < monthCount; ++monthIndex)
+	{
+		const auto ledgerMonth = ledger.month(LedgerMonthPath(AddMonths(begin, monthIndex), directory));
+		for (size_t i = 0; i < ledgerMonth->size(); ++i)
+		{
+			if (!ledgerMonth->removed(i) && ledgerMonth->row(i)[Label::ItemName] == U"品7")
+			{
+				++itemCount;
+			}
+		}
+	}
+	if (const auto hits = searchIndex.search(U"品7", 20); hits.empty() || hits.front().matchKind != 0 || hits.front().count != itemCount)
+	{
+		++mismatchCount;
+	}
+
+	// 削除のたびの集計のし直しにかかる時間（ファイルには書かない）
+	LedgerMonth month = *ledger.month(LedgerMonthPath(begin, directory));
+	Array<String> registerDates;
+	for (size_t i = 0; i < month.size(); ++i)
+	{
+		registerDates.push_back(month.row(i)[Label::RegisterDate]);
+	}
+	registerDates.unique_consecutive();
+
+	Stopwatch removeTimer{ StartImmediately::Yes };
+	for (const auto& registerDate : registerDates)
+	{
+		month.removeByRegisterDate(registerDate);
+	}
+	const double removeMs = removeTimer.msF();
+	if (!month.rollup().month().total.empty())
+	{
+		++mismatchCount;
+	}
+
+	Console << U"ledger bench: {} か月 {} 行"_fmt(monthCount, rowCount);
+	Console << U"  読み込みと集計の作成: {:.1f} ms"_fmt(loadMs);
+	Console << U"  {} スレッドで並べて読み込み: {:.1f} ms（最初の月まで {:.1f} ms）"_fmt(Threading::GetConcurrency(), preloadMs, firstMonthMs.value_or(preloadMs));
+	Console << U"  期間の集計 {} 回: 月ごとの集計 {:.1f} ms, 行の読み直し {:.1f} ms"_fmt(ranges.size(), rollupMs, scanMs);
+	Console << U"  品名の検索 1000 回: {:.1f} ms"_fmt(searchMs);
+	Console << U"  削除 {} 回の集計のし直し: {:.3f} ms/回"_fmt(registerDates.size(), removeMs / Max<size_t>(registerDates.size(), 1));
+
+	// CSV と列形式のファイルからの読み込みの比較と、列形式のファイルから書き出した CSV が元と一致するか
+	{
+		const bool columnStore = LedgerColumnStoreEnabled;
+		const auto loadAll = [&]()
+			{
+				size_t loadedRowCount = 0;
+				for (int32 monthIndex = 0; monthIndex < monthCount; ++monthIndex)
+				{
+					loadedRowCount += LedgerMonth::Load(LedgerMonthPath(AddMonths(begin, monthIndex), directory)).size();
+				}
+				return loadedRowCount;
+			};
+
+		LedgerColumnStoreEnabled = false;
+		Stopwatch csvTimer{ StartImmediately::Yes };
+		const auto csvRowCount = loadAll();
+		const double csvMs = csvTimer.msF();
+
+		// 1 回目で列形式のファイルを作り、2 回目はそれを読む
+		LedgerColumnStoreEnabled = true;
+		Stopwatch buildTimer{ StartImmediately::Yes };
+		loadAll();
+		const double buildMs = buildTimer.msF();
+
+		Stopwatch columnTimer{ StartImmediately::Yes };
+		const auto columnRowCount = loadAll();
+		const double columnMs = columnTimer.msF();
+		LedgerColumnStoreEnabled = columnStore;
+
+		if (csvRowCount != rowCount || columnRowCount != rowCount)
+		{
+			++mismatchCount;
+		}
+
+		int64 csvBytes = 0;
+		int64 columnBytes = 0;
+		for (int32 monthIndex = 0; monthIndex < monthCount; ++monthIndex)
+		{
+			const auto path = LedgerMonthPath(AddMonths(begin, monthIndex), directory);
+			const LedgerColumnFile columns{ LedgerColumnPath(path) };
+			// ここで作った CSV は AppendCSVRow の形式なので、バイト列まで同じになる
+			if (!columns || columns.toCSV() != ReadLedgerBytes(path))
+			{
+				++mismatchCount;
+			}
+			csvBytes += FileSystem::FileSize(path);
+			columnBytes += FileSystem::FileSize(LedgerColumnPath(path));
+		}
+
+		// 整数にできない値は元の文字列のまま戻る
+		const Array<Array<String>> oddRows = {
+			{ U"品,\"1\"", U"1,200", U"店", U"2024/1/5", U"2024-01-05 9:00", U"" },
+			{ U"", U"0120", U"", U"2024年01月05日", U"2024-01-05 09:00:00", U"ID" },
+			{ U"品", U"-5", U"店", U"0000年01月05日", U"", U"ID" },
+		};
+		const auto oddPath = directory + U"odd.rcol";
+		ReplaceFileAtomic(oddPath, LedgerColumnFile::Build(oddRows, U"odd"));
+		{
+			const LedgerColumnFile columns{ oddPath };
+			if (!columns || columns.size() != oddRows.size() || columns.signature() != U"odd")
+			{
+				++mismatchCount;
+			}
+			for (size_t i = 0; columns && i < columns.size(); ++i)
+			{
+				if (columns.row(i) != oddRows[i])
+				{
+					++mismatchCount;
+				}
+			}
+		}
+
+		Console << U"  月の読み込み {} か月: CSV {:.1f} ms, 列形式の作成 {:.1f} ms, 列形式 {:.1f} ms（{} KB / {} KB）"_fmt(
+			monthCount, csvMs, buildMs, columnMs, columnBytes / 1024, csvBytes / 1024);
+	}
+
+	// 保存時の重複の判定と、全ての月の重複の削除
+	{
+		const auto path = LedgerMonthPath(begin, directory);
+		const auto& registered = *ledger.month(path);
+		const auto registerDate = registered.row(0)[Label::RegisterDate];
+		Array<Array<String>> rows;
+		for (const auto rowIndex : registered.rowsByRegisterDate(registerDate))
+		{
+			rows.push_back(registered.row(rowIndex));
+		}
+		std::reverse(rows.begin(), rows.end());
+
+		Stopwatch probeTimer{ StartImmediately::Yes };
+		size_t foundCount = 0;
+		for (int32 i = 0; i < 10000; ++i)
+		{
+			foundCount += ledger.findDuplicate(path, rows).has_value();
+		}
+		Console << U"  保存時の重複の判定 10000 回: {:.1f} ms"_fmt(probeTimer.msF());
+		if (foundCount != 10000)
+		{
+			++mismatchCount;
+		}
+
+		size_t removedCount = 0;
+		Stopwatch dedupTimer{ StartImmediately::Yes };
+		ledger.removeDuplicates(directory, [&](size_t count) { removedCount = count; });
+		ledger.waitIdle();
+		Console << U"  重複の削除: {} 件, {:.1f} ms"_fmt(removedCount, dedupTimer.msF());
+		if (removedCount != duplicateCount)
+		{
+			++mismatchCount;
+		}
+	}
+
+	Console << U"  不一致: {}"_fmt(mismatchCount);
+
+	ledger.clear();
+	FileSystem::Remove(directory);
+}
+#endif
+
+#ifdef TEST_CSV_PARSER
+// LedgerCSVReader が CSV と同じ行を返すか、手元の家計簿と境界の入力で確かめ、読む速さを測る
+bool RunCSVParserTest()
+{
+	const FilePath directory = U"test/csv_parser/";
+	FileSystem::CreateDirectories(directory);
+	size_t mismatchCount = 0;
+
+	const auto readAll = [](LedgerCSVReader& reader)
+		{
+			Array<Array<String>> rows;
+			Array<LedgerCSVCell> cells;
+			while (reader.next(cells))
+			{
+				rows.push_back(cells.map([](const LedgerCSVCell& cell) { return cell.toString(); }));
+			}
+			return rows;
+		};
+
+	const auto compare = [&](FilePathView path, StringView name)
+		{
+			const CSV csv(path);
+			LedgerCSVReader reader{ path };
+			const auto rows = readAll(reader);
+			bool same = (rows.size() == csv.rows());
+			for (size_t i = 0; same && i < rows.size(); ++i)
+			{
+				same = (rows[i] == csv.getRow(i));
+			}
+			if (!same)
+			{
+				Console << U"  不一致: {}"_fmt(name);
+				++mismatchCount;
+			}
+		};
+
+	// 引用符・空のセル・改行の種類・BOM・最後の改行の有無・複数バイトの文字が 16 バイトの区切りをまたぐ場合
+	const Array<String> cases = {
+		U"",
+		U"a,b,c",
+		U"a,b,c\n",
+		U"a,b,c\r\nd,e,f\r\n",
+		U"\uFEFFa,b\n",
+		U",,\n,\n",
+		U"\"a,b\",\"c\"\"d\"\"\",\"\"\n",
+		U"\"改行\nを含む\",x\r\ny\n",
+		U"\"閉じていない,引用符\n",
+		U"0123456789abcdef\"0123456789abcdef,\"0123456789abcdef\n",
+		U"牛乳,198,スーパー,2024年01月05日,2024-01-05 09:00:00,ID2024010509\n",
+		String(40, U'x') + U"," + String(15, U'y') + U"\"\"" + String(17, U'z') + U"\n",
+		String(14, U'x') + U"品名,\"" + String(30, U'あ') + U"\"\n",
+	};
+	for (const auto& [caseIndex, text] : Indexed(cases))
+	{
+		const auto path = directory + U"case{}.csv"_fmt(caseIndex);
+		ReplaceFileAtomic(path, Unicode::ToUTF8(text));
+		compare(path, U"case{}"_fmt(caseIndex));
+	}
+
+	size_t ledgerFileCount = 0;
+	for (const auto& path : FileSystem::DirectoryContents(U"", Recursive::No))
+	{
+		if (IsLedgerMonthFileName(FileSystem::FileName(path)))
+		{
+			compare(path, FileSystem::FileName(path));
+			++ledgerFileCount;
+		}
+	}
+
+	// 家計簿の行を並べた 64 MB ほどのデータで測る
+	std::string data;
+	for (int32 i = 0; data.size() < (64 << 20); ++i)
+	{
+		AppendCSVRow(data, { U"品{}"_fmt(i % 200), Format(i % 3000), U"店{}"_fmt(i % 20), U"2024年01月{:0>2}日"_fmt(i % 28 + 1),
+			U"2024-01-{:0>2} 09:00:00"_fmt(i % 28 + 1), U"ID{}"_fmt(i / 5) });
+	}
+	const auto dataPath = directory + U"bench.csv";
+	ReplaceFileAtomic(dataPath, data);
+	const double gigaBytes = data.size() / 1e9;
+
+	size_t cellCount = 0;
+	Stopwatch scanTimer{ StartImmediately::Yes };
+	{
+		LedgerCSVReader reader{ dataPath };
+		Array<LedgerCSVCell> cells;
+		while (reader.next(cells))
+		{
+			cellCount += cells.size();
+		}
+	}
+	const double scanSec = scanTimer.sF();
+
+	Stopwatch convertTimer{ StartImmediately::Yes };
+	{
+		LedgerCSVReader reader{ dataPath };
+		readAll(reader);
+	}
+	const double convertSec = convertTimer.sF();
+
+	// 家計簿の読み込み（列形式のファイルは使わず、CSV を解析する）
+	const bool columnStore = LedgerColumnStoreEnabled;
+	LedgerColumnStoreEnabled = false;
+	Stopwatch loadTimer{ StartImmediately::Yes };
+	const auto month = LedgerMonth::Load(dataPath);
+	const double loadSec = loadTimer.sF();
+	LedgerColumnStoreEnabled = columnStore;
+
+	Stopwatch csvTimer{ StartImmediately::Yes };
+	const CSV csv(dataPath);
+	const double csvSec = csvTimer.sF();
+	if (csv.rows() * Label::Size != cellCount || month.size() != csv.rows())
+	{
+		++mismatchCount;
+	}
+
+	Console << U"csv parser test: 境界の入力 {} 件, 家計簿 {} 件, 不一致 {}"_fmt(cases.size(), ledgerFileCount, mismatchCount);
+	Console << U"  {:.1f} MB: 区切りのみ {:.2f} GB/s, String への変換込み {:.2f} GB/s, LedgerMonth::Load {:.2f} GB/s, CSV {:.2f} GB/s"_fmt(
+		data.size() / 1e6, gigaBytes / scanSec, gigaBytes / convertSec, gigaBytes / loadSec, gigaBytes / csvSec);
+
+	FileSystem::Remove(directory);
+	return mismatchCount == 0;
+}
+#endif
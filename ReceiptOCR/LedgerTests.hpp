@@ -0,0 +1,26 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+
+// 家計簿の読み書きの試験と計測
+// それぞれのマクロを定義してビルドした時だけ、Main() の最初で実行して終了する
+// TEST_LEDGER_FAULT は LedgerFile.hpp の障害注入も有効にするので、家計簿のヘッダより先に読まれるここで定義する
+//#define TEST_LEDGER_FAULT
+//#define BENCH_LEDGER
+//#define TEST_CSV_PARSER
+
+#ifdef TEST_LEDGER_FAULT
+/// @brief 家計簿の書き込みを無作為な位置で止めて再起動し、確定済みの登録が失われていないか確かめます。
+/// @return すべての試行で失われていなかった場合 true
+bool RunLedgerFaultTest(int32 trialCount);
+#endif
+
+#ifdef BENCH_LEDGER
+/// @brief 10 年分の家計簿を作り、集計・読み込み・重複の削除の時間を測ります。
+void RunLedgerBenchmark();
+#endif
+
+#ifdef TEST_CSV_PARSER
+/// @brief LedgerCSVReader が CSV と同じ行を返すか確かめ、読む速さを測ります。
+/// @return すべての入力で一致した場合 true
+bool RunCSVParserTest();
+#endif
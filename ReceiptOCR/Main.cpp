@@ -2,6 +2,13 @@
 #include "Utility.hpp"
 #include "Vision.hpp"
 #include "PurchasedItemsEditor.hpp"
+#include "Profiler.hpp"
+#include "Trace.hpp"
+#include "AppAssets.hpp"
+#include "Session.hpp"
+#include "Ingest.hpp"
+#include "LedgerTests.hpp"
+#include <sstream>
 
 constexpr Color MarkColor[] =
 {
@@ -14,8 +21,18 @@ constexpr Color MarkColor[] =
 	Color{ 204, 204, 204 },
 };
 
+// ブロックの枠が markerOutlines のどこにあるか
+struct MarkerVertexRange
+{
+	size_t bufferIndex = 0; // markerOutlines のインデックス
+	size_t firstVertex = 0; // 先頭の頂点インデックス
+	size_t vertexCount = 0; // AppendClosedOutline で追加した頂点数
+};
+
 struct ReceiptData
 {
+	FilePath sourcePath;    // 切り出し元の画像
+	String sourceSignature; // 切り出した時の画像の LedgerFileSignature
 	Vec2 topLeft;
 	Polygon boundingPolygon;
 	Image image;
@@ -27,6 +44,13 @@ struct ReceiptData
 	Vec2 yAxis;
 	int32 verticalSpacing = 0.0;
 
+	// マーカー表示用のキャッシュ（ReceiptEditor::updateMarkerCache で作る）
+	Array<Array<Polygon>> markerPolygons; // textGroup と同じ並びのブロックの多角形
+	SpatialGrid<Point> markerIndex;       // 多角形の外接矩形 -> [group, text]のインデックス
+	Array<Buffer2D> markerOutlines;       // 全ブロックの枠をまとめた頂点バッファ
+	Array<Array<MarkerVertexRange>> markerVertices; // [group, text] -> 枠の頂点の範囲
+	double markerScale = 0.0;
+
 	double angle() const
 	{
 		return Math::Atan2(xAxis.y, xAxis.x);
@@ -34,6 +58,8 @@ struct ReceiptData
 
 	void init()
 	{
+		ScopedTrace trace(U"ReceiptData::init", U"pipeline");
+
 		// 全ブロックの縦方向と横方向の平均をそれぞれ取ったものを軸の方向とする
 		{
 			xAxis = yAxis = Vec2::Zero();
@@ -102,9 +128,6 @@ struct ReceiptData
 			}
 		}
 
-		Console << allText;
-		Console << U"";
-
 		//Logger << U"input allText:";
 		//Logger << allText;
 		//Logger << U"";
@@ -140,6 +163,8 @@ private:
 
 	void checkShopName()
 	{
+		ScopedTrace trace(U"checkShopName", U"inference");
+
 		const auto reg = UR"([a-zA-Z\p{Katakana}\p{Han}ーｰ\-～~^店]+店)"_re;
 		const auto match = reg.search(allText);
 
@@ -158,6 +183,8 @@ private:
 
 	void checkDate()
 	{
+		ScopedTrace trace(U"checkDate", U"inference");
+
 		const auto reg = UR"((\d\d\d\d)[年/](\d\d?)[月/](\d\d?)日?\(?[月火水木金土日]?\)?(\d\d)?[時:]?(\d\d)?)"_re;
 		const auto match = reg.search(allText);
 
@@ -186,6 +213,8 @@ private:
 
 	void checkPrice()
 	{
+		ScopedTrace trace(U"checkPrice", U"inference");
+
 		const auto reg = UR"([*¥][0-9]+)"_re;
 		const auto matchList = reg.findAll(allText);
 
@@ -214,6 +243,8 @@ private:
 
 	void checkNumber()
 	{
+		ScopedTrace trace(U"checkNumber", U"inference");
+
 		const auto reg = UR"(-?[1-9][0-9]*)"_re;
 		const auto matchList = reg.findAll(allText);
 
@@ -236,6 +267,8 @@ private:
 
 	void checkIgnore()
 	{
+		ScopedTrace trace(U"checkIgnore", U"inference");
+
 		// ["計","外税","軽減","税率","対象"]の文字以下の座標は無視する
 		const auto reg = UR"(計|外税|軽減|税率|対象)"_re;
 		const auto match = reg.search(allText);
@@ -255,6 +288,8 @@ private:
 
 	void checkItemName()
 	{
+		ScopedTrace trace(U"checkItemName", U"inference");
+
 		const auto reg = UR"([^*¥◆■]+)"_re;
 
 		for (const auto& [groupIndex, group] : Indexed(textGroup))
@@ -304,6 +339,31 @@ struct Group
 	OrderedTable<size_t, Array<size_t>> smallGroup;
 };
 
+// 1 枚の画像を読み取ってレシートごとに分けた結果（ReceiptEditor::Prepare で作る）
+// テクスチャと編集データはまだ作っていない
+struct PreparedImage
+{
+	FilePath path;
+	Array<ReceiptData> receipts;
+	FrameProfiler::PipelineSample imageTimes;
+	Array<FrameProfiler::PipelineSample> receiptTimes; // receipts と同じ並び
+};
+
+// マークの塗り替え（変更のあったブロックのみ保持する）
+struct MarkChange
+{
+	Point index;
+	MarkType before;
+	MarkType after;
+};
+
+struct MarkCommand
+{
+	Array<MarkChange> changes;
+};
+
+using ReceiptCommand = std::variant<MarkCommand, EditCommand>;
+
 enum class AlignPos
 {
 	Left,
@@ -317,6 +377,14 @@ enum class WidthType
 	Absolute,
 };
 
+// CloudVision.exe の出力を最後まで読み込む
+// 読み込みを解析から切り離し、OCR の待ち時間だけを計測する
+inline std::istringstream ReadVisionOutput(std::istream& is)
+{
+	ScopedPipelineTimer timer(PipelineStage::OCR);
+	return std::istringstream(std::string(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()));
+}
+
 class ReceiptEditor
 {
 public:
@@ -327,53 +395,123 @@ public:
 
 	void calc(const FilePath& path, std::istream& is)
 	{
-		const auto result = ReadResult(is);
-		UnionFind unionFind;
-		unionFind = UnionFind(result.size());
-		for (size_t i = 0; i < result.size(); ++i)
+		Stopwatch decodeTimer{ StartImmediately::Yes };
+		const Image image(path);
+		const double decodeMs = decodeTimer.msF();
+
+		auto prepared = Prepare(path, image, is);
+		prepared.imageTimes.stageMs[static_cast<size_t>(PipelineStage::Decode)] = decodeMs;
+
+		FrameProfiler::Instance().clearReceipts();
+		receiptData.clear();
+		editedData.clear();
+		histories.clear();
+		sourcePath = FileSystem::FullPath(path);
+		sessionAllDirty = true;
+
+		append(std::move(prepared));
+	}
+
+	/// @brief OCR の結果をレシートごとに分け、行のグループ化と推論まで行います。
+	/// エディタの状態に触れないので、別のスレッドからも呼べます。テクスチャと編集データは append() で作ります。
+	/// @param path OCR に渡した画像
+	/// @param image path の画像
+	/// @param is CloudVision.exe の出力
+	static PreparedImage Prepare(const FilePath& path, const Image& image, std::istream& is)
+	{
+		PreparedImage prepared;
+		prepared.path = path;
+
+		Array<TextAnnotation> result;
 		{
-			for (size_t k = i + 1; k < result.size(); ++k)
+			ScopedPipelineTimer timer(PipelineStage::Parse, prepared.imageTimes);
+			ScopedTrace trace(U"ReadResult", U"pipeline");
+			result = ReadResult(is);
+		}
+
+		HashTable<size_t, Array<Vec2>> groupPolygons;
+		HashTable<size_t, Group> groupElements;
+		{
+			ScopedPipelineTimer timer(PipelineStage::Split, prepared.imageTimes);
+			ScopedTrace trace(U"split", U"pipeline");
+
+			UnionFind unionFind;
+			unionFind = UnionFind(result.size());
+			for (size_t i = 0; i < result.size(); ++i)
 			{
-				if (result[i].BoundingBox.intersects(result[k].BoundingBox))
+				for (size_t k = i + 1; k < result.size(); ++k)
 				{
-					unionFind.merge(i, k);
+					if (result[i].BoundingBox.intersects(result[k].BoundingBox))
+					{
+						unionFind.merge(i, k);
+					}
 				}
 			}
+
+			for (size_t i = 0; i < result.size(); ++i)
+			{
+				const auto groupIndex = unionFind.find(i);
+				auto& groupPoly = groupPolygons[groupIndex];
+				groupPoly.append(result[i].BoundingPoly);
+				auto& group = groupElements[groupIndex];
+				group.largeGroup.push_back(i);
+			}
 		}
 
-		HashTable<size_t, Array<Vec2>> groupPolygons;
-		HashTable<size_t, Group> groupElements;
-		for (size_t i = 0; i < result.size(); ++i)
+		for (auto& [index, val] : groupElements)
 		{
-			const auto groupIndex = unionFind.find(i);
-			auto& groupPoly = groupPolygons[groupIndex];
-			groupPoly.append(result[i].BoundingPoly);
-			auto& group = groupElements[groupIndex];
-			group.largeGroup.push_back(i);
+			auto& times = prepared.receiptTimes.emplace_back();
+			prepared.receipts.push_back(AnalyzeReceipt(path, image, result, groupPolygons[index], val, times));
 		}
 
-		const Image image(path);
+		return prepared;
+	}
 
-		receiptData.clear();
+	/// @brief Prepare() で分けたレシートを末尾に加え、テクスチャと編集データを作ります。
+	void append(PreparedImage&& prepared)
+	{
+		const bool wasEmpty = receiptData.empty();
+		auto& profiler = FrameProfiler::Instance();
+		profiler.setPipelineSample(prepared.imageTimes);
 
-		int i = 0;
-		for (auto& [index, val] : groupElements)
+		for (auto&& [i, data] : Indexed(prepared.receipts))
 		{
-			receiptData.emplace_back();
-			calculateData(i, image, result, groupPolygons[index], groupElements[index]);
-			convertEditData(i);
-			++i;
+			const int index = static_cast<int>(receiptData.size());
+			auto& times = prepared.receiptTimes[i];
+
+			Stopwatch textureTimer{ StartImmediately::Yes };
+			{
+				ScopedTrace trace(U"texture", U"pipeline");
+				data.texture = Texture(data.image);
+			}
+			auto& clippingMs = times.stageMs[static_cast<size_t>(PipelineStage::Clipping)];
+			clippingMs = clippingMs.value_or(0.0) + textureTimer.msF();
+			profiler.setPipelineSample(times, index);
+
+			receiptData.push_back(std::move(data));
+			convertEditData(index);
+
+			// 保存する時に二重登録を確かめられるよう、購入月の家計簿を先に読み込んでおく
+			Ledger::Instance().month(editedData[index].csvPath());
 		}
 
-		resetFocus();
+		if (wasEmpty)
+		{
+			resetFocus();
+		}
 	}
 
 	void recalculate(const FilePath& path, std::istream& is, int index)
 	{
-		auto result = ReadResult(is);
-		for (size_t i = 0; i < result.size(); ++i)
+		Array<TextAnnotation> result;
 		{
-			result[i].Description = result[i].Description.replaced(U"\r", U"");
+			ScopedPipelineTimer timer(PipelineStage::Parse);
+			ScopedTrace trace(U"ReadResult", U"pipeline");
+			result = ReadResult(is);
+			for (size_t i = 0; i < result.size(); ++i)
+			{
+				result[i].Description = result[i].Description.replaced(U"\r", U"");
+			}
 		}
 
 		Array<Vec2> polygons;
@@ -384,26 +522,193 @@ public:
 			groupData.largeGroup.push_back(i);
 		}
 
+		Stopwatch decodeTimer{ StartImmediately::Yes };
 		const Image image(path);
+		FrameProfiler::Instance().setPipelineTime(PipelineStage::Decode, decodeTimer.msF());
+
+		FrameProfiler::PipelineSample times;
+		receiptData[index] = AnalyzeReceipt(path, image, result, polygons, groupData, times);
+
+		Stopwatch textureTimer{ StartImmediately::Yes };
+		receiptData[index].texture = Texture(receiptData[index].image);
+		auto& clippingMs = times.stageMs[static_cast<size_t>(PipelineStage::Clipping)];
+		clippingMs = clippingMs.value_or(0.0) + textureTimer.msF();
+		FrameProfiler::Instance().setPipelineSample(times, index);
 
-		calculateData(index, image, result, polygons, groupData);
 		convertEditData(index);
+		histories.erase(index);
 		resetFocus();
 	}
 
+	/// @brief 前回呼んだ時から変わった、セッションファイルの記録を返します。
+	/// 番号 0 はエディタ全体の記録で、番号 i + 1 がレシート i の記録です。画像は切り出し元のパスと範囲だけを書きます。
+	/// マークや編集で変わったレシートだけを書き直すので、レシートが多くても毎回すべてを書き直すことはありません。
+	SessionChanges takeSessionChanges()
+	{
+		SessionChanges changes;
+		changes.recordCount = (receiptData.size() + 1);
+
+		SessionWriter header;
+		header.write(sourcePath);
+		header.write(static_cast<int32>(focusIndex));
+		changes.records.emplace_back(0, std::move(header.bytes));
+
+		if (sessionAllDirty)
+		{
+			for (size_t receiptIndex = 0; receiptIndex < receiptData.size(); ++receiptIndex)
+			{
+				changes.records.emplace_back(static_cast<uint32>(receiptIndex + 1), sessionRecord(receiptIndex));
+			}
+		}
+		else
+		{
+			for (const auto receiptIndex : sessionDirty)
+			{
+				if (0 <= receiptIndex && receiptIndex < static_cast<int>(receiptData.size()))
+				{
+					changes.records.emplace_back(static_cast<uint32>(receiptIndex + 1), sessionRecord(receiptIndex));
+				}
+			}
+		}
+
+		sessionDirty.clear();
+		sessionAllDirty = false;
+		return changes;
+	}
+
+	/// @brief takeSessionChanges() の記録から編集中の状態を復元します。OCR と行のグループ分け・推論はやり直しません。
+	/// 編集履歴は復元しません。
+	/// 切り出し元の画像が変わっているか読み込めないレシートは、そのレシートだけを除きます。
+	/// @return 記録が壊れているか、復元できるレシートが無い場合は何もせずに false
+	bool restoreSession(const Array<std::string>& records)
+	{
+		ScopedTrace trace(U"restoreSession", U"pipeline");
+
+		if (records.size() <= 1)
+		{
+			return false;
+		}
+
+		SessionReader header{ records[0] };
+		const auto path = header.readString();
+		const auto focus = header.read<int32>();
+		if (!header.ok)
+		{
+			return false;
+		}
+
+		Array<ReceiptData> restoredData;
+		HashTable<int, EditedData> restoredEdits;
+		HashTable<FilePath, Image> images; // 同じ画像は 1 回だけデコードする
+
+		for (size_t recordIndex = 1; recordIndex < records.size(); ++recordIndex)
+		{
+			SessionReader reader{ records[recordIndex] };
+			ReceiptData data;
+			const auto clippingRect = ReadReceipt(reader, data);
+			if (!reader.ok)
+			{
+				return false;
+			}
+
+			if (LedgerFileSignature(data.sourcePath) != data.sourceSignature)
+			{
+				Console << U"{} が変わっているため、このレシートは復元しません"_fmt(data.sourcePath);
+				continue;
+			}
+
+			auto it = images.find(data.sourcePath);
+			if (it == images.end())
+			{
+				Stopwatch decodeTimer{ StartImmediately::Yes };
+				it = images.emplace(data.sourcePath, Image{ data.sourcePath }).first;
+				FrameProfiler::Instance().setPipelineTime(PipelineStage::Decode, decodeTimer.msF());
+			}
+			if (it->second.isEmpty())
+			{
+				Console << U"{} を読み込めないため、このレシートは復元しません"_fmt(data.sourcePath);
+				continue;
+			}
+
+			if (reader.read<bool>())
+			{
+				EditedData editData;
+				if (!editData.readSession(reader))
+				{
+					return false;
+				}
+				restoredEdits[static_cast<int>(restoredData.size())] = std::move(editData);
+			}
+
+			data.image = it->second.clipped(clippingRect);
+			MaskOutside(data.image, data.boundingPolygon);
+			data.texture = Texture(data.image);
+			restoredData.push_back(std::move(data));
+		}
+
+		if (restoredData.empty())
+		{
+			return false;
+		}
+
+		FrameProfiler::Instance().clearReceipts();
+		receiptData = std::move(restoredData);
+		editedData = std::move(restoredEdits);
+		histories.clear();
+		sourcePath = path;
+		sessionAllDirty = true;
+		focusIndex = Clamp(focus, 0, static_cast<int32>(receiptData.size()) - 1);
+		resetFocus();
+		return true;
+	}
+
+	/// @brief 最後に OCR を行った画像のパスを返します。
+	const FilePath& documentPath() const
+	{
+		return sourcePath;
+	}
+
 	void update()
 	{
+		ScopedFrameTimer timer(FrameStage::Update);
+
 		if (receiptData.empty())
 		{
 			return;
 		}
 
+		if (!MouseL.pressed())
+		{
+			markStrokeOpen = false;
+		}
+
 		if (editedData[focusIndex].textEditing())
 		{
 			editedData[focusIndex].editTextUpdate();
 			return;
 		}
 
+		if (searchPanel.active())
+		{
+			return;
+		}
+
+		if (KeyControl.pressed() && KeyZ.down())
+		{
+			if (KeyShift.pressed())
+			{
+				redo();
+			}
+			else
+			{
+				undo();
+			}
+		}
+		else if (KeyControl.pressed() && KeyY.down())
+		{
+			redo();
+		}
+
 		if (penType)
 		{
 			auto t = camera.createTransformer();
@@ -470,6 +775,8 @@ public:
 		if (KeyShift.pressed() && KeyEnter.down() && editedData.contains(focusIndex))
 		{
 			editedData.erase(focusIndex);
+			histories.erase(focusIndex);
+			sessionDirty.insert(focusIndex);
 		}
 		// 編集データの作成
 		else if (KeyEnter.down() && !editedData.contains(focusIndex))
@@ -478,6 +785,58 @@ public:
 		}
 	}
 
+	void undo()
+	{
+		auto& history = histories[focusIndex];
+		const auto command = history.undo();
+		if (!command)
+		{
+			return;
+		}
+		sessionDirty.insert(focusIndex);
+
+		if (const auto markCommand = std::get_if<MarkCommand>(&command.value()))
+		{
+			auto& data = receiptData[focusIndex];
+			for (auto it = markCommand->changes.rbegin(); it != markCommand->changes.rend(); ++it)
+			{
+				data.textMarkType[it->index] = it->before;
+				updateMarkerColor(data, it->index);
+			}
+			rebuildEditData(focusIndex);
+		}
+		else if (const auto editCommand = std::get_if<EditCommand>(&command.value()); editCommand && editedData.contains(focusIndex))
+		{
+			editedData.at(focusIndex).undo(*editCommand);
+		}
+	}
+
+	void redo()
+	{
+		auto& history = histories[focusIndex];
+		const auto command = history.redo();
+		if (!command)
+		{
+			return;
+		}
+		sessionDirty.insert(focusIndex);
+
+		if (const auto markCommand = std::get_if<MarkCommand>(&command.value()))
+		{
+			auto& data = receiptData[focusIndex];
+			for (const auto& change : markCommand->changes)
+			{
+				data.textMarkType[change.index] = change.after;
+				updateMarkerColor(data, change.index);
+			}
+			rebuildEditData(focusIndex);
+		}
+		else if (const auto editCommand = std::get_if<EditCommand>(&command.value()); editCommand && editedData.contains(focusIndex))
+		{
+			editedData.at(focusIndex).redo(*editCommand);
+		}
+	}
+
 	void zoomIn()
 	{
 		camera.setTargetScale(camera.getTargetScale() * 1.3);
@@ -495,7 +854,7 @@ public:
 			return;
 		}
 
-		if (!editedData[focusIndex].textEditing())
+		if (!editedData[focusIndex].textEditing() && !searchPanel.active())
 		{
 			camera.update();
 		}
@@ -504,7 +863,7 @@ public:
 		const double margin1 = 20;
 		const Vec2 scopePos = markerRect.tr() + Vec2(margin1, 0);
 
-		titleFont(focusIndex + 1, U" / ", receiptData.size(), U" 件目").draw(Arg::bottomLeft = scopePos - Vec2(0, 10));
+		FontAsset(U"TitleFont")(focusIndex + 1, U" / ", receiptData.size(), U" 件目").draw(Arg::bottomLeft = scopePos - Vec2(0, 10));
 
 		for (auto [receiptIndex, data] : IndexedRef(receiptData))
 		{
@@ -529,13 +888,19 @@ public:
 				auto& editData = editedData.at(receiptIndex);
 
 				// 中央のレシート読み取り結果
-				const auto editRect = editData.draw(textRect.pos, mediumFont, data.texture, data.topLeft.asPoint(), camera.getTargetScale(), receiptIndex == focusIndex);
+				const auto editRect = editData.draw(textRect.pos, FontAsset(U"MediumFont"), data.texture, data.topLeft.asPoint(), camera.getTargetScale(), receiptIndex == focusIndex);
 				RectF(editRect.pos, editRect.w, Scene::Height() - windowMarginTB * 2).drawFrame();
 
 				// 右の表
 				if (!editRect.isEmpty())
 				{
-					editData.drawGrid(editRect, viewIntervalX, windowMarginLR, windowMarginTB, largeFont, buttonSize);
+					editData.drawGrid(editRect, viewIntervalX, windowMarginLR, windowMarginTB, FontAsset(U"LargeFont"), buttonSize, searchPanel, rollupPanel);
+				}
+
+				for (auto& command : editData.takeCommands())
+				{
+					histories[receiptIndex].push(std::move(command));
+					sessionDirty.insert(static_cast<int>(receiptIndex));
 				}
 			}
 		}
@@ -545,6 +910,8 @@ public:
 
 	void drawMarkerView(const Vec2& scopePos, ReceiptData& data)
 	{
+		ScopedFrameTimer timer(FrameStage::MarkerView);
+
 		auto scope = getScreenScope(scopePos);
 
 		const auto receiptAreaMouseOver = scope.mouseOver();
@@ -567,124 +934,68 @@ public:
 
 		if (showBoundingPoly)
 		{
-			Array<String> itemNames;
-			Array<String> itemPrices;
-			for (const auto& [groupIndex, group] : Indexed(data.textGroup))
-			{
-				String goodsStr;
-				String priceStr;
-				double minX = DBL_MAX;
-				double minY = DBL_MAX;
-				double maxX = -DBL_MAX;
-				double maxY = -DBL_MAX;
-
-				for (const auto& [textIndex, text] : Indexed(group))
-				{
-					const auto type = data.textMarkType.at(Point(groupIndex, textIndex));
-
-					switch (type)
-					{
-					case MarkType::Goods:
-					{
-						goodsStr += text.Description;
-						const auto minMaxX = text.minMaxX();
-						const auto minMaxY = text.minMaxY();
-					}
-					break;
-					case MarkType::Price: [[fallthrough]];
-					case MarkType::Number:
-					{
-						priceStr += text.Description;
-						const auto minMaxX = text.minMaxX();
-						const auto minMaxY = text.minMaxY();
-					}
-					break;
-					default:
-						break;
-					}
-				}
+			updateMarkerCache(data);
 
-				RectF rect(minX, minY, maxX - minX, maxY - minY);
-
-				const auto originalPos = (Vec2(minX, minY) + Vec2(maxX, maxY)) * 0.5;
-				const auto localPos = originalPos - data.topLeft;
-				const auto textDrawPos = localPos * drawScale;
-				if (!goodsStr.empty())
-				{
-					itemNames.push_back(goodsStr);
-				}
-				if (!priceStr.empty())
-				{
-					itemPrices.push_back(priceStr);
-				}
+			// 全ブロックの枠はまとめて一度に描画する
+			for (const auto& outline : data.markerOutlines)
+			{
+				outline.draw();
+			}
 
-				for (const auto& [textIndex, text] : Indexed(group))
+			// マウスや選択範囲の判定は近くにあるブロックだけを対象にする
+			if (penType && receiptAreaMouseOver)
+			{
+				if (!dragStartPos && !selectRange)
 				{
-					const auto textPoly = LineString(text.BoundingPoly).scaledAt(data.topLeft, drawScale).movedBy(-data.topLeft - data.texture.size());
-					const auto type = data.textMarkType.at(Point(groupIndex, textIndex));
-
-					if (type == MarkType::Ignore || type == MarkType::Unassigned)
-					{
-						textPoly.drawClosed(2.0, MarkColor[static_cast<int32>(type)].withAlpha(64));
-					}
-					else
+					for (const auto& index : data.markerIndex.query(Cursor::PosF()))
 					{
-						textPoly.drawClosed(2.0, MarkColor[static_cast<int32>(type)]);
-					}
-
-					const Polygon textPolygon(textPoly);
-					if (penType && receiptAreaMouseOver)
-					{
-						if (!dragStartPos && !selectRange)
+						const auto& textPolygon = data.markerPolygons[index.x][index.y];
+						if (textPolygon.mouseOver())
 						{
-							if (textPolygon.mouseOver())
-							{
-								textPolygon.draw(Alpha(64));
-							}
-							if (textPolygon.leftPressed())
-							{
-								if (data.textMarkType[Point(groupIndex, textIndex)] != penType.value())
-								{
-									data.textMarkType[Point(groupIndex, textIndex)] = penType.value();
-									data.updatedMarkIndices.emplace(Point(groupIndex, textIndex));
-								}
-							}
+							textPolygon.draw(Alpha(64));
 						}
-						else if (selectRange)
+						if (textPolygon.leftPressed())
 						{
-							if (selectRange.value().contains(textPolygon))
-							{
-								if (data.textMarkType[Point(groupIndex, textIndex)] != penType.value())
-								{
-									data.textMarkType[Point(groupIndex, textIndex)] = penType.value();
-									data.updatedMarkIndices.emplace(Point(groupIndex, textIndex));
-								}
-							}
+							paintMark(data, index, penType.value());
 						}
-						else if (dragStartPos)
+					}
+				}
+				else if (selectRange)
+				{
+					for (const auto& index : data.markerIndex.query(selectRange.value()))
+					{
+						if (selectRange.value().contains(data.markerPolygons[index.x][index.y]))
 						{
-							const auto startPos = dragStartPos.value();
-							const auto endPos = Cursor::PosF();
-							const RectF currentRange(startPos, endPos - startPos);
-
-							if (currentRange.contains(textPolygon))
-							{
-								textPolygon.draw(Alpha(64));
-							}
+							paintMark(data, index, penType.value());
 						}
 					}
 				}
-
-				if (penType && dragStartPos)
+				else if (dragStartPos)
 				{
 					const auto startPos = dragStartPos.value();
 					const auto endPos = Cursor::PosF();
 					const RectF currentRange(startPos, endPos - startPos);
 
-					currentRange.drawFrame(2.0, MarkColor[static_cast<int32>(penType.value())]);
+					for (const auto& index : data.markerIndex.query(currentRange))
+					{
+						const auto& textPolygon = data.markerPolygons[index.x][index.y];
+						if (currentRange.contains(textPolygon))
+						{
+							textPolygon.draw(Alpha(64));
+						}
+					}
 				}
 			}
 
+			if (penType && dragStartPos)
+			{
+				const auto startPos = dragStartPos.value();
+				const auto endPos = Cursor::PosF();
+				const RectF currentRange(startPos, endPos - startPos);
+
+				currentRange.drawFrame(2.0, MarkColor[static_cast<int32>(penType.value())]);
+			}
+
 			selectRange = none;
 		}
 
@@ -740,12 +1051,12 @@ public:
 			if (changed.value())
 			{
 				const auto rotateAngle = -receiptData[focusIndex].angle();
-				const auto saveFilePath = FileSystem::CurrentDirectory() + U"temp.png";
+				const auto saveFilePath = RetryImagePath(focusIndex);
 				receiptData[focusIndex].image.rotated(rotateAngle).savePNG(saveFilePath);
 
 				Window::SetTitle(U"計算中…");
 				ChildProcess process(VisionExePath, saveFilePath, Pipe::StdIn);
-				auto& is = process.istream();
+				auto is = ReadVisionOutput(process.istream());
 
 				recalculate(saveFilePath, is, focusIndex);
 
@@ -780,6 +1091,7 @@ public:
 	void updateUI()
 	{
 		const auto frame = Scene::Rect();
+		const auto& updateIcon = TextureAsset(U"UpdateIcon");
 
 		const RectF buttonFrameLeft(0, 0, updateIcon.width() * iconDrawScale, Scene::Height());
 		buttonFrameLeft.draw(Color{ 33, 33, 33 });
@@ -807,8 +1119,9 @@ public:
 				}
 			}
 
-			for (const auto [i, texture] : Indexed(markIcons))
+			for (const auto [i, iconName] : Indexed(markIcons))
 			{
+				const auto& texture = TextureAsset(iconName);
 				if (penType && markTypes[i] == penType.value())
 				{
 					texture.scaled(iconDrawScale * scale_).drawAt(shopButton.center() + Vec2(0, shopButton.h) * i);
@@ -827,12 +1140,12 @@ public:
 				if (updateButton.leftClicked())
 				{
 					const auto rotateAngle = -receiptData[focusIndex].angle();
-					const auto saveFilePath = FileSystem::CurrentDirectory() + U"temp.png";
+					const auto saveFilePath = RetryImagePath(focusIndex);
 					receiptData[focusIndex].image.rotated(rotateAngle).savePNG(saveFilePath);
 
 					Window::SetTitle(U"計算中…");
 					ChildProcess process(VisionExePath, saveFilePath, Pipe::StdIn);
-					auto& is = process.istream();
+					auto is = ReadVisionOutput(process.istream());
 
 					recalculate(saveFilePath, is, focusIndex);
 
@@ -840,7 +1153,7 @@ public:
 				}
 			}
 
-			for (const auto [i, texture] : Indexed(markIcons))
+			for (const auto i : step(markIcons.size()))
 			{
 				const auto buttonRect = shopButton.movedBy(Vec2(0, shopButton.h) * i);
 				if (buttonRect.mouseOver())
@@ -865,12 +1178,12 @@ public:
 		{
 			const RectF fixButton(Arg::topRight = frame.tr(), updateIcon.size() * iconDrawScale);
 
-			for (const auto [i, texture] : Indexed(writeIcons))
+			for (const auto [i, iconName] : Indexed(writeIcons))
 			{
-				texture.scaled(iconDrawScale * scale_).drawAt(fixButton.center() + Vec2(0, fixButton.h) * i);
+				TextureAsset(iconName).scaled(iconDrawScale * scale_).drawAt(fixButton.center() + Vec2(0, fixButton.h) * i);
 			}
 
-			for (const auto [i, texture] : Indexed(writeIcons))
+			for (const auto i : step(writeIcons.size()))
 			{
 				const auto buttonRect = fixButton.movedBy(Vec2(0, fixButton.h) * i);
 				if (buttonRect.mouseOver())
@@ -903,11 +1216,35 @@ public:
 		}
 	}
 
+	Optional<size_t> focusReceipt() const
+	{
+		if (receiptData.empty())
+		{
+			return none;
+		}
+		return static_cast<size_t>(focusIndex);
+	}
+
+	/// @brief 注目中のレシートで、テキストの編集中か検索欄に入力中の場合 true を返します。
+	/// 入力中は Main() のショートカットキーも受け付けません。
+	bool typing() const
+	{
+		const auto it = editedData.find(focusIndex);
+		return searchPanel.active() || ((it != editedData.end()) && it->second.textEditing());
+	}
+
 private:
 
-	void calculateData(int index, const Image& image, const Array<TextAnnotation>& result, Array<Vec2>& polygons, Group& groupData)
+	// 1 枚のレシートの行のグループ化・切り抜き・推論を行う（テクスチャは作らない）
+	// 別のスレッドからも呼ぶので、処理時間は FrameProfiler ではなく times に記録する
+	static ReceiptData AnalyzeReceipt(const FilePath& path, const Image& image, const Array<TextAnnotation>& result, const Array<Vec2>& polygons, Group& groupData, FrameProfiler::PipelineSample& times)
 	{
+		ScopedTrace trace(U"AnalyzeReceipt", U"pipeline");
+
 		{
+			ScopedPipelineTimer timer(PipelineStage::Grouping, times);
+			ScopedTrace groupingTrace(U"grouping", U"pipeline");
+
 			const auto& group = groupData.largeGroup;
 
 			UnionFind unionFind2;
@@ -944,8 +1281,13 @@ private:
 			}
 		}
 
+		ReceiptData data;
 		{
-			ReceiptData data;
+			ScopedPipelineTimer timer(PipelineStage::Clipping, times);
+
+			data.sourcePath = FileSystem::FullPath(path);
+			data.sourceSignature = LedgerFileSignature(path);
+			Optional<ScopedTrace> stageTrace{ InPlace, U"clipping", U"pipeline" };
 			const auto convexHull = Geometry2D::ConvexHull(polygons);
 
 			const auto clippingRect = convexHull.boundingRect().asRect();
@@ -954,21 +1296,12 @@ private:
 
 			//*
 			// 領域外を白で塗りつぶす
-			for (int y = 0; y < data.image.height(); ++y)
-			{
-				for (int x = 0; x < data.image.width(); ++x)
-				{
-					const auto globalPos = clippingRect.pos + Vec2(x, y);
-					if (!convexHull.contains(globalPos))
-					{
-						//data.image[y][x] = Color{ 59, 59, 59 };
-						data.image[y][x] = Color{0,0,0,0};
-					}
-				}
-			}
+			stageTrace.reset();
+			stageTrace.emplace(U"masking", U"pipeline");
+			MaskOutside(data.image, data.boundingPolygon);
 			//*/
 
-			data.texture = Texture(data.image);
+			stageTrace.reset();
 
 			data.topLeft = clippingRect.pos;
 
@@ -983,11 +1316,14 @@ private:
 					currentTextGroup.push_back(result[elemIndex]);
 				}
 			}
+		}
 
-			receiptData[index] = data;
+		{
+			ScopedPipelineTimer timer(PipelineStage::Inference, times);
+			data.init();
 		}
 
-		receiptData[index].init();
+		return data;
 	}
 
 	RectF getScreenScope(const Vec2 pos) const
@@ -1002,8 +1338,317 @@ private:
 		camera.setTargetCenter(Vec2::Zero());
 	}
 
+	void paintMark(ReceiptData& data, const Point& index, MarkType type)
+	{
+		auto& currentType = data.textMarkType[index];
+		if (currentType == type)
+		{
+			return;
+		}
+
+		// マウスを押している間の塗り替えは一つの操作としてまとめる
+		auto& history = histories[focusIndex];
+		MarkCommand* command = nullptr;
+		if (markStrokeOpen)
+		{
+			if (auto top = history.top())
+			{
+				command = std::get_if<MarkCommand>(top);
+			}
+		}
+
+		if (!command)
+		{
+			history.push(MarkCommand{});
+			command = std::get_if<MarkCommand>(history.top());
+			markStrokeOpen = true;
+		}
+
+		command->changes.push_back({ index, currentType, type });
+		currentType = type;
+		data.updatedMarkIndices.emplace(index);
+		updateMarkerColor(data, index);
+		sessionDirty.insert(focusIndex);
+	}
+
+	// ブロックの表示用の多角形と、マウス判定用の空間インデックスを作る
+	void updateMarkerCache(ReceiptData& data) const
+	{
+		if (!data.markerPolygons.empty() && data.markerScale == drawScale)
+		{
+			return;
+		}
+
+		data.markerPolygons.clear();
+		data.markerIndex = SpatialGrid<Point>(MarkerIndexCellSize);
+		data.markerOutlines.clear();
+		data.markerVertices.clear();
+		data.markerScale = drawScale;
+
+		for (const auto& [groupIndex, group] : Indexed(data.textGroup))
+		{
+			auto& polygons = data.markerPolygons.emplace_back();
+			auto& vertices = data.markerVertices.emplace_back();
+			for (const auto& [textIndex, text] : Indexed(group))
+			{
+				const auto textPoly = LineString(text.BoundingPoly).scaledAt(data.topLeft, drawScale).movedBy(-data.topLeft - data.texture.size());
+				polygons.emplace_back(textPoly);
+				data.markerIndex.insert(polygons.back().boundingRect(), Point(groupIndex, textIndex));
+
+				// 頂点インデックスは 16 bit なので、収まらなくなったら次のバッファに移る
+				const size_t vertexCount = textPoly.size() * 2;
+				if (data.markerOutlines.empty() || MaxMarkerVertices < data.markerOutlines.back().vertices.size() + vertexCount)
+				{
+					data.markerOutlines.emplace_back();
+				}
+
+				auto& outline = data.markerOutlines.back();
+				MarkerVertexRange range;
+				range.bufferIndex = (data.markerOutlines.size() - 1);
+				range.firstVertex = outline.vertices.size();
+				AppendClosedOutline(outline, textPoly, 2.0);
+				range.vertexCount = (outline.vertices.size() - range.firstVertex);
+				vertices.push_back(range);
+			}
+		}
+
+		for (const auto& [groupIndex, group] : Indexed(data.textGroup))
+		{
+			for (const auto& [textIndex, text] : Indexed(group))
+			{
+				updateMarkerColor(data, Point(groupIndex, textIndex));
+			}
+		}
+	}
+
+	// マークの変更をブロックの枠の頂点色に反映する
+	static void updateMarkerColor(ReceiptData& data, const Point& index)
+	{
+		if (data.markerVertices.empty())
+		{
+			return;
+		}
+
+		const auto type = data.textMarkType.at(index);
+		const ColorF color = (type == MarkType::Ignore || type == MarkType::Unassigned)
+			? MarkColor[static_cast<int32>(type)].withAlpha(64)
+			: MarkColor[static_cast<int32>(type)];
+		const Float4 vertexColor = color.toFloat4();
+
+		const auto& range = data.markerVertices[index.x][index.y];
+		auto& vertices = data.markerOutlines[range.bufferIndex].vertices;
+		for (size_t i = range.firstVertex; i < range.firstVertex + range.vertexCount; ++i)
+		{
+			vertices[i].color = vertexColor;
+		}
+	}
+
+	// 読み取り直す時に、回転したレシートの画像を保存するパス
+	// セッションが切り出し元として参照するので、他のレシートの読み取り直しで上書きされないよう、レシートごとに別のファイルにする
+	static FilePath RetryImagePath(int receiptIndex)
+	{
+		FileSystem::CreateDirectories(U"ingest/");
+		return FileSystem::FullPath(U"ingest/retry_{}.png"_fmt(receiptIndex));
+	}
+
+	// 凸多角形 polygon の外側を透明にする
+	// 行ごとに辺との交点から内側の範囲を求めるので、画素ごとに内外判定をするより速い
+	static void MaskOutside(Image& image, const Polygon& polygon)
+	{
+		const auto& outer = polygon.outer();
+		for (int32 y = 0; y < image.height(); ++y)
+		{
+			double minX = Math::Inf;
+			double maxX = -Math::Inf;
+			for (size_t i = 0; i < outer.size(); ++i)
+			{
+				const auto& a = outer[i];
+				const auto& b = outer[(i + 1) % outer.size()];
+				if (y < Min(a.y, b.y) || Max(a.y, b.y) < y)
+				{
+					continue;
+				}
+
+				if (a.y == b.y)
+				{
+					minX = Min({ minX, a.x, b.x });
+					maxX = Max({ maxX, a.x, b.x });
+					continue;
+				}
+
+				const double x = a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y);
+				minX = Min(minX, x);
+				maxX = Max(maxX, x);
+			}
+
+			// [begin, end) が内側
+			const int32 width = image.width();
+			const int32 begin = (minX <= maxX) ? Clamp(static_cast<int32>(Math::Ceil(minX)), 0, width) : width;
+			const int32 end = (minX <= maxX) ? Clamp(static_cast<int32>(Math::Floor(maxX)) + 1, begin, width) : width;
+			Color* row = image[y];
+			std::fill(row, row + begin, Color{ 0, 0, 0, 0 });
+			std::fill(row + end, row + width, Color{ 0, 0, 0, 0 });
+		}
+	}
+
+	// レシート receiptIndex のセッションファイルの記録
+	std::string sessionRecord(size_t receiptIndex) const
+	{
+		SessionWriter writer;
+		WriteReceipt(writer, receiptData[receiptIndex]);
+
+		const auto it = editedData.find(static_cast<int>(receiptIndex));
+		writer.write(it != editedData.end());
+		if (it != editedData.end())
+		{
+			it->second.writeSession(writer);
+		}
+
+		return std::move(writer.bytes);
+	}
+
+	// レシートの切り出し範囲・テキスト・マークを書く（画像とマーカー表示用のキャッシュは書かない）
+	static void WriteReceipt(SessionWriter& writer, const ReceiptData& data)
+	{
+		writer.write(data.sourcePath);
+		writer.write(data.sourceSignature);
+		writer.write(Rect{ data.topLeft.asPoint(), data.image.size() });
+		writer.write(data.boundingPolygon.outer());
+		writer.write(data.xAxis);
+		writer.write(data.yAxis);
+		writer.write(data.verticalSpacing);
+
+		writer.write(static_cast<uint32>(data.textGroup.size()));
+		for (const auto& group : data.textGroup)
+		{
+			writer.write(static_cast<uint32>(group.size()));
+			for (const auto& text : group)
+			{
+				writer.write(text.BoundingPoly);
+				writer.write(text.BoundingBox);
+				writer.write(text.Description);
+			}
+		}
+
+		writer.write(static_cast<uint32>(data.textMarkType.size()));
+		for (const auto& [index, type] : data.textMarkType)
+		{
+			writer.write(index);
+			writer.write(static_cast<uint8>(type));
+		}
+
+		writer.write(static_cast<uint32>(data.updatedMarkIndices.size()));
+		for (const auto& index : data.updatedMarkIndices)
+		{
+			writer.write(index);
+		}
+	}
+
+	// WriteReceipt() で書いた内容を読み、切り出し範囲を返す
+	static Rect ReadReceipt(SessionReader& reader, ReceiptData& data)
+	{
+		data.sourcePath = reader.readString();
+		data.sourceSignature = reader.readString();
+		const auto clippingRect = reader.readRect();
+		data.topLeft = clippingRect.pos;
+		data.boundingPolygon = Polygon{ reader.readVec2s() };
+		data.xAxis = reader.readVec2();
+		data.yAxis = reader.readVec2();
+		data.verticalSpacing = reader.read<int32>();
+
+		data.textGroup.resize(reader.readCount());
+		for (auto& group : data.textGroup)
+		{
+			group.resize(reader.readCount());
+			for (auto& text : group)
+			{
+				text.BoundingPoly = reader.readVec2s();
+				text.BoundingBox = reader.readRectF();
+				text.Description = reader.readString();
+			}
+		}
+
+		for (size_t count = reader.readCount(); 0 < count; --count)
+		{
+			const auto index = reader.readPoint();
+			data.textMarkType[index] = static_cast<MarkType>(reader.read<uint8>());
+		}
+
+		for (size_t count = reader.readCount(); 0 < count; --count)
+		{
+			data.updatedMarkIndices.insert(reader.readPoint());
+		}
+
+		return clippingRect;
+	}
+
+	// 閉じた折れ線を太さ thickness の帯として buffer に追加する（角はマイター結合）
+	static void AppendClosedOutline(Buffer2D& buffer, const LineString& points, double thickness)
+	{
+		const size_t n = points.size();
+		const auto baseIndex = static_cast<Vertex2D::IndexType>(buffer.vertices.size());
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const Vec2& prev = points[(i + n - 1) % n];
+			const Vec2& current = points[i];
+			const Vec2& next = points[(i + 1) % n];
+
+			const Vec2 d1 = (current - prev).normalized();
+			const Vec2 d2 = (next - current).normalized();
+			const Vec2 n1{ -d1.y, d1.x };
+			const Vec2 n2{ -d2.y, d2.x };
+			const Vec2 miter = (n1 + n2).normalized();
+			const double length = (thickness * 0.5) / Max(miter.dot(n1), 0.25);
+
+			for (const auto& pos : { current + miter * length, current - miter * length })
+			{
+				Vertex2D vertex;
+				vertex.pos = Float2{ static_cast<float>(pos.x), static_cast<float>(pos.y) };
+				vertex.tex = Float2{ 0.0f, 0.0f };
+				vertex.color = Float4{ 1.0f, 1.0f, 1.0f, 1.0f };
+				buffer.vertices.push_back(vertex);
+			}
+		}
+
+		for (size_t i = 0; i < n; ++i)
+		{
+			const auto outer0 = static_cast<Vertex2D::IndexType>(baseIndex + i * 2);
+			const auto inner0 = static_cast<Vertex2D::IndexType>(outer0 + 1);
+			const auto outer1 = static_cast<Vertex2D::IndexType>(baseIndex + ((i + 1) % n) * 2);
+			const auto inner1 = static_cast<Vertex2D::IndexType>(outer1 + 1);
+
+			buffer.indices.push_back(TriangleIndex{ outer0, outer1, inner0 });
+			buffer.indices.push_back(TriangleIndex{ inner0, outer1, inner1 });
+		}
+	}
+
+	// マークから編集データを作り直し、直前のマーク変更以降の編集操作を適用し直す
+	void rebuildEditData(int receiptIndex)
+	{
+		convertEditData(receiptIndex);
+
+		const auto& commands = histories[receiptIndex].undoStack();
+		auto it = commands.end();
+		while (it != commands.begin() && !std::holds_alternative<MarkCommand>(*std::prev(it)))
+		{
+			--it;
+		}
+
+		auto& editData = editedData.at(receiptIndex);
+		for (; it != commands.end(); ++it)
+		{
+			editData.redo(std::get<EditCommand>(*it));
+		}
+		editData.takeCommands();
+	}
+
 	void convertEditData(int receiptIndex)
 	{
+		ScopedPipelineTimer timer(PipelineStage::Conversion, receiptIndex);
+		ScopedTrace trace(U"convertEditData", U"pipeline");
+		sessionDirty.insert(receiptIndex);
+
 		EditedData newData;
 		auto& data = receiptData[receiptIndex];
 
@@ -1104,7 +1749,7 @@ private:
 					nameData.nameTexRegion = RectF(itemMinX, itemMinY, itemMaxX - itemMinX, itemMaxY - itemMinY).asRect();
 				}
 
-				newData.itemNameEdit.data.push_back(nameData);
+				newData.itemNameEdit.push_back(nameData);
 				currentAddType = AddCellType::Name;
 			}
 
@@ -1121,9 +1766,9 @@ private:
 					// discountの追加先は二通りあり、直前に読み取った要素の種類で判断する
 					// 直前に読み取った要素がdiscountの場合：一つの商品に複数の割引が付いている
 					// 直前に読み取った要素がそれ以外の場合：次の商品に割引が付いている
-					if (prevAddType == AddCellType::Discount && !newData.itemDiscountEdit.data.empty())
+					if (prevAddType == AddCellType::Discount && !newData.itemDiscountEdit.empty())
 					{
-						auto& multipletDiscount = newData.itemDiscountEdit.data.back();
+						auto& multipletDiscount = newData.itemDiscountEdit.back();
 						multipletDiscount.discount.push_back(price);
 						if (priceMinX < priceMaxX && priceMinY < priceMaxY)
 						{
@@ -1146,7 +1791,7 @@ private:
 						{
 							discountData.discountTexRegion.push_back(Rect::Empty());
 						}
-						newData.itemDiscountEdit.data.push_back(discountData);
+						newData.itemDiscountEdit.push_back(discountData);
 					}
 
 					currentAddType = AddCellType::Discount;
@@ -1161,7 +1806,7 @@ private:
 						priceData.priceTexRegion = RectF(priceMinX, priceMinY, priceMaxX - priceMinX, priceMaxY - priceMinY).asRect();
 					}
 
-					newData.itemPriceEdit.data.push_back(priceData);
+					newData.itemPriceEdit.push_back(priceData);
 					currentAddType = AddCellType::Price;
 				}
 			}
@@ -1170,23 +1815,25 @@ private:
 		}
 
 		newData.reloadCSV();
-		editedData[receiptIndex] = newData;
+		editedData[receiptIndex] = std::move(newData);
 
 		data.updatedMarkIndices.clear();
 	}
 
 	Array<ReceiptData> receiptData;
+	FilePath sourcePath; // calc() で OCR を行った画像
 	HashTable<int, EditedData> editedData; // receiptIndex -> edited data
+	HashTable<int, EditHistory<ReceiptCommand>> histories; // receiptIndex -> 編集履歴
+	LedgerSearchPanel searchPanel; // 検索は家計簿全体が対象なので、レシートごとではなく 1 つだけ持つ
+	RollupPanel rollupPanel;       // マークを付け直すたびに集計し直さないよう、EditedData ではなくここで持つ
+	HashSet<int> sessionDirty;     // 次の takeSessionChanges() で記録を書き直すレシート
+	bool sessionAllDirty = true;   // レシートの並びが変わったので、すべて書き直す
+	bool markStrokeOpen = false;
 	int focusIndex = 0;
 	double drawScale = 2.0;
 	double iconDrawScale = 0.5;
-
-	Font font = Font(10);
-	Font mediumFont = Font(16);
-	Font mediumFontBold = Font(18, Typeface::Bold);
-	Font tableFont = Font(14);
-	Font tableFontBold = Font(14, Typeface::Bold);
-	Font largeFont = Font(17, Typeface::Bold);
+	static constexpr double MarkerIndexCellSize = 128.0;
+	static constexpr size_t MaxMarkerVertices = 65535;
 
 	double defaultCameraScale = 0.5;
 	Camera2D camera = Camera2D{ Scene::Size() / 2, defaultCameraScale, CameraControl::RightClick };
@@ -1194,10 +1841,10 @@ private:
 	Optional<Vec2> dragStartPos;
 	Optional<RectF> selectRange;
 
-	Texture updateIcon = Texture(U"🔃"_emoji);
-	Array<Texture> markIcons = { Texture(U"🏬"_emoji),Texture(U"🕰️"_emoji),Texture(U"🍔"_emoji),Texture(U"💴"_emoji),Texture(U"🧹"_emoji) };
+	// フォントとアイコンは RegisterAppAssets() で登録した名前で参照する
+	Array<AssetName> markIcons = { U"MarkIcon.ShopName", U"MarkIcon.Date", U"MarkIcon.Goods", U"MarkIcon.Price", U"MarkIcon.Unassigned" };
 	Array<MarkType> markTypes = { MarkType::ShopName, MarkType::Date, MarkType::Goods, MarkType::Price, MarkType::Unassigned };
-	Array<Texture> writeIcons = { Texture(U"💾"_emoji),Texture(U"🗑️"_emoji) };
+	Array<AssetName> writeIcons = { U"WriteIcon.Save", U"WriteIcon.Delete" };
 	Optional<MarkType> penType;
 
 	bool showBoundingPoly = true;
@@ -1205,20 +1852,18 @@ private:
 	Vec2 buttonSize = Vec2(30, 30);
 	Array<TileButton> markButtons =
 	{
-		TileButton{0xf54f_icon, 15, Palette1, MarkColor[static_cast<size_t>(MarkType::ShopName)]},
-		TileButton{0xf017_icon, 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Date)]},
-		TileButton{0xf805_icon, 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Goods)]},
-		TileButton{0xf157_icon, 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Price)]},
-		TileButton{0xf12d_icon, 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Unassigned)]},
+		TileButton{U"ButtonIcon.ShopName", 15, Palette1, MarkColor[static_cast<size_t>(MarkType::ShopName)]},
+		TileButton{U"ButtonIcon.Date", 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Date)]},
+		TileButton{U"ButtonIcon.Goods", 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Goods)]},
+		TileButton{U"ButtonIcon.Price", 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Price)]},
+		TileButton{U"ButtonIcon.Unassigned", 15, Palette1, MarkColor[static_cast<size_t>(MarkType::Unassigned)]},
 	};
 
-	TileButton retryButton = { 0xf021_icon, 15, Palette1, Palette::Skyblue };
+	TileButton retryButton = { U"ButtonIcon.Retry", 15, Palette1, Palette::Skyblue };
 
-	TileButton showBoundingPolyButton = { 0xf247_icon, 15, Palette1, Palette::Skyblue, true };
-	TileButton largerButton = { 0xf00e_icon, 15, Palette1, Palette::Skyblue };
-	TileButton smallerButton = { 0xf010_icon, 15, Palette1, Palette::Skyblue };
-
-	Font titleFont = Font(18);
+	TileButton showBoundingPolyButton = { U"ButtonIcon.BoundingPoly", 15, Palette1, Palette::Skyblue, true };
+	TileButton largerButton = { U"ButtonIcon.Larger", 15, Palette1, Palette::Skyblue };
+	TileButton smallerButton = { U"ButtonIcon.Smaller", 15, Palette1, Palette::Skyblue };
 };
 
 #define TEST
@@ -1270,26 +1915,85 @@ void LoadConfig(FilePathView configPath, ReceiptEditor& editor)
 	editor.windowMarginLR = windowMarginX;
 	editor.windowMarginTB = windowMarginY;
 	editor.viewIntervalX = viewIntervalX;
+
+	LedgerColumnStoreEnabled = ParseOr<bool>(ini[U"Ledger.columnStore"], false);
 }
 
+// セッションファイルに書き込む間隔 [ms]
+constexpr int32 SessionSaveInterval = 500;
+
 void Main()
 {
+	// 起動から各段階までの時間（最初のフレームで表示する）
+	Stopwatch startupTimer{ StartImmediately::Yes };
+	Array<std::pair<String, double>> startupLaps;
+	const auto lap = [&](const String& name)
+		{
+			startupLaps.emplace_back(name, startupTimer.msF());
+		};
+
 	const auto configPath = U"config/config.ini";
 	const auto fullConfigPath = FileSystem::FullPath(configPath);
 	const auto configDirectory = FileSystem::ParentPath(fullConfigPath);
 
 	DirectoryWatcher watcher{ configDirectory };
 
-	TextureAsset::Register(U"AddIcon", 0xf0704_icon, 12);
+	RegisterAppAssets();
+	lap(U"アセットの登録");
 
 	Window::SetTitle(U"レシートOCR");
 	Window::SetStyle(WindowStyle::Sizable);
 
+#ifdef TEST_LEDGER_FAULT
+	RunLedgerFaultTest(500);
+	return;
+#endif
+
+#ifdef BENCH_LEDGER
+	RunLedgerBenchmark();
+	return;
+#endif
+
+#ifdef TEST_CSV_PARSER
+	RunCSVParserTest();
+	return;
+#endif
+
+	// 前回途中で止まった家計簿の書き込みをやり直す
+	LedgerJournal::Instance().recover();
+
+	// すべての月の家計簿を裏で並べて読み込み、前回の終了後に変わった月だけ検索索引を作り直す
+	// 画面は読み込みを待たずに表示し、読み終わった月から集計に使う
+	LedgerSearchIndex::Instance().load();
+	Ledger::Instance().preload();
+	lap(U"家計簿");
+
 	ReceiptEditor editor;
-	Texture tempTexture;
-	int32 rotateNum = 0;
+	lap(U"エディタ");
 	String texturePath;
 
+	// ドロップされた画像は、読み込み・OCR・解析を裏で進め、終わったものから順にエディタの末尾に加える
+	IngestQueue<PreparedImage> ingest{ [](const FilePath& path, const Image& image, const std::string& output)
+		{
+			std::istringstream is{ output };
+			return ReceiptEditor::Prepare(path, image, is);
+		} };
+
+	// 前回のセッションがあれば、OCR をやり直さずに編集中の状態を復元する
+	const auto sessionPath = U"session.bin";
+	SessionFile session{ sessionPath };
+	bool resumed = false;
+	if (const auto records = SessionFile::Load(sessionPath))
+	{
+		resumed = editor.restoreSession(*records);
+		if (resumed)
+		{
+			texturePath = editor.documentPath();
+			lap(U"セッションの復元");
+		}
+	}
+	Stopwatch sessionTimer{ StartImmediately::Yes };
+
 #ifdef TEST
 	const auto dumpPath = "test/dump.txt";
 	texturePath = U"test/test01.jpg";
@@ -1301,15 +2005,74 @@ void Main()
 	DumpResult(dumpPath, is);
 	return;
 #else
-	std::ifstream is(dumpPath);
-	editor.calc(texturePath, is);
+	if (!resumed)
+	{
+		std::ifstream is(dumpPath);
+		editor.calc(texturePath, is);
+	}
 #endif
 #endif
 
 	LoadConfig(configPath, editor);
+	lap(U"設定");
+
+	auto& profiler = FrameProfiler::Instance();
 
 	while (System::Update())
 	{
+		if (startupTimer.isRunning())
+		{
+			lap(U"最初のフレーム");
+			startupTimer.pause();
+			Console << U"起動: " << startupLaps.map([](const auto& entry) { return U"{} {:.1f} ms"_fmt(entry.first, entry.second); }).join(U", ", U"", U"");
+		}
+
+		profiler.beginFrame();
+		Ledger::Instance().update();
+
+		// 検索欄やテキストに入力中は、ショートカットキーを受け付けない
+		const bool shortcutsEnabled = !editor.typing();
+
+		if (shortcutsEnabled && KeyF3.down())
+		{
+			profiler.toggle();
+		}
+		if (shortcutsEnabled && KeyF5.down())
+		{
+			// 記録を止めた時点でファイルに書き出す
+			auto& recorder = TraceRecorder::Instance();
+			if (TraceRecorder::Enabled())
+			{
+				recorder.stop();
+				const auto tracePath = U"trace_{}.json"_fmt(DateTime::Now().format(U"yyyyMMdd_HHmmss"));
+				if (recorder.saveJSON(tracePath))
+				{
+					Print << U"{} に保存しました"_fmt(tracePath);
+				}
+			}
+			else
+			{
+				recorder.start();
+				Print << U"トレースの記録を開始しました";
+			}
+		}
+		if (shortcutsEnabled && KeyF6.down())
+		{
+			// 同じレシートを重ねて登録した分を、すべての月から削除する
+			Ledger::Instance().removeDuplicates(U"", [](size_t count)
+				{
+					Print << U"重複して登録されたレシートを {} 件削除しました"_fmt(count);
+				});
+		}
+		if (shortcutsEnabled && KeyF4.down())
+		{
+			const auto profilePath = U"profile_{}.csv"_fmt(DateTime::Now().format(U"yyyyMMdd_HHmmss"));
+			if (profiler.saveCSV(profilePath))
+			{
+				Print << U"{} に保存しました"_fmt(profilePath);
+			}
+		}
+
 		for (auto&& [path, action] : watcher.retrieveChanges())
 		{
 			if (path == fullConfigPath && action == FileAction::Modified)
@@ -1327,50 +2090,52 @@ void Main()
 
 		if (DragDrop::HasNewFilePaths())
 		{
-			texturePath = DragDrop::GetDroppedFilePaths()[0].path;
-			tempTexture = Texture(texturePath);
-		}
-
-		if (!tempTexture.isEmpty())
-		{
-			if (KeyRight.down())
+			size_t addedCount = 0;
+			for (const auto& dropped : DragDrop::GetDroppedFilePaths())
 			{
-				++rotateNum;
+				addedCount += ingest.add(dropped.path);
 			}
-
-			const double rotateAngle = 90_deg * rotateNum;
-			tempTexture.rotated(rotateAngle).draw();
-
-			const auto saveFilePath = FileSystem::CurrentDirectory() + U"temp.jpg";
-			if (KeyEnter.down())
+			if (addedCount == 0)
 			{
-				switch (rotateNum % 4)
-				{
-				case 0: Image(texturePath).saveJPEG(saveFilePath, 100); break;
-				case 1: Image(texturePath).rotate90().saveJPEG(saveFilePath, 100); break;
-				case 2: Image(texturePath).rotate180().saveJPEG(saveFilePath, 100); break;
-				case 3: Image(texturePath).rotate270().saveJPEG(saveFilePath, 100); break;
-				default: break;
-				}
-
-				tempTexture = Texture();
-				texturePath = saveFilePath;
-				rotateNum = 0;
+				Print << U"読み取れる画像がありませんでした";
 			}
 		}
-		else
+
+		// テクスチャと編集データの作成はメインスレッドで行うので、1 フレームに 1 枚ずつ加える
+		if (auto prepared = ingest.take())
 		{
-			editor.update();
-			editor.draw();
+			texturePath = prepared->path;
+			editor.append(std::move(prepared.value()));
 		}
 
-		if (KeyG.down() && !texturePath.empty())
+		editor.update();
+		editor.draw();
+
+		// 最後に加えた画像を読み取り直す。エディタの他のレシートは消さず、読み取り結果を末尾に加える
+		if (shortcutsEnabled && KeyG.down() && !texturePath.empty())
 		{
-			tempTexture = Texture();
-			rotateNum = 0;
+			ingest.add(texturePath);
+		}
 
-			ChildProcess process(VisionExePath, texturePath, Pipe::StdIn);
-			editor.calc(texturePath, process.istream());
+		DrawIngestEntries(ingest.entries(), FontAsset(U"TableFont"), Vec2(10, Scene::Height() - 10));
+
+		if (profiler.visible())
+		{
+			profiler.draw(FontAsset(U"ProfilerFont"), Vec2(10, 10), editor.focusReceipt());
+		}
+
+		// 変わったレシートの記録だけを作り、裏でセッションファイルに追記する
+		if (SessionSaveInterval <= sessionTimer.ms())
+		{
+			session.write(editor.takeSessionChanges());
+			sessionTimer.restart();
 		}
+		session.update();
 	}
+
+	session.write(editor.takeSessionChanges());
+	session.waitIdle();
+	Ledger::Instance().waitIdle();
+	LedgerJournal::Instance().checkpoint();
+	LedgerSearchIndex::Instance().save();
 }
@@ -0,0 +1,320 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+
+// 毎フレーム計測する処理
+enum class FrameStage
+{
+	Update,     // ReceiptEditor::update
+	MarkerView, // ReceiptEditor::drawMarkerView
+	EditView,   // EditedData::draw
+	Grid,       // EditedData::drawGrid
+	CsvIO,      // CSV の読み書き（他の処理の内数）
+	Count,
+};
+
+// レシートの読み取りから編集データ作成までの処理
+enum class PipelineStage
+{
+	OCR,        // CloudVision.exe の出力待ち
+	Parse,      // ReadResult
+	Decode,     // 画像の読み込み
+	Split,      // レシートごとの分割
+	Grouping,   // 行のグループ化
+	Clipping,   // 切り抜きと領域外の塗りつぶし、テクスチャ作成
+	Inference,  // ReceiptData::init
+	Conversion, // convertEditData
+	Count,
+};
+
+constexpr size_t FrameStageCount = static_cast<size_t>(FrameStage::Count);
+constexpr size_t PipelineStageCount = static_cast<size_t>(PipelineStage::Count);
+
+constexpr StringView FrameStageNames[FrameStageCount] = { U"update", U"markerView", U"editView", U"grid", U"csvIO" };
+constexpr StringView PipelineStageNames[PipelineStageCount] = { U"OCR", U"parse", U"decode", U"split", U"grouping", U"clipping", U"inference", U"conversion" };
+
+// フレームごとの処理時間をリングバッファに記録し、オーバーレイに表示する
+class FrameProfiler
+{
+public:
+
+	struct FrameSample
+	{
+		double totalMs = 0.0;
+		std::array<double, FrameStageCount> stageMs{};
+	};
+
+	// 画像単位の処理は receiptIndex を持たない
+	struct PipelineSample
+	{
+		std::array<Optional<double>, PipelineStageCount> stageMs;
+	};
+
+	static constexpr size_t Capacity = 300;
+
+	static FrameProfiler& Instance()
+	{
+		static FrameProfiler instance;
+		return instance;
+	}
+
+	/// @brief 前のフレームの計測結果を確定し、新しいフレームの計測を始めます。
+	void beginFrame()
+	{
+		if (m_frameTimer.isStarted())
+		{
+			m_current.totalMs = m_frameTimer.msF();
+			m_samples[m_head] = m_current;
+			m_head = (m_head + 1) % Capacity;
+			m_count = Min(m_count + 1, Capacity);
+		}
+
+		m_current = FrameSample{};
+		m_frameTimer.restart();
+	}
+
+	void addFrameTime(FrameStage stage, double ms)
+	{
+		m_current.stageMs[static_cast<size_t>(stage)] += ms;
+	}
+
+	void setPipelineTime(PipelineStage stage, double ms, const Optional<size_t>& receiptIndex = none)
+	{
+		if (receiptIndex)
+		{
+			if (m_receipts.size() <= receiptIndex.value())
+			{
+				m_receipts.resize(receiptIndex.value() + 1);
+			}
+			m_receipts[receiptIndex.value()].stageMs[static_cast<size_t>(stage)] = ms;
+		}
+		else
+		{
+			m_image.stageMs[static_cast<size_t>(stage)] = ms;
+		}
+	}
+
+	/// @brief sample で計測済みの処理時間をまとめて設定します。
+	void setPipelineSample(const PipelineSample& sample, const Optional<size_t>& receiptIndex = none)
+	{
+		for (size_t i = 0; i < PipelineStageCount; ++i)
+		{
+			if (sample.stageMs[i])
+			{
+				setPipelineTime(static_cast<PipelineStage>(i), sample.stageMs[i].value(), receiptIndex);
+			}
+		}
+	}
+
+	void clearReceipts()
+	{
+		m_receipts.clear();
+	}
+
+	bool visible() const
+	{
+		return m_visible;
+	}
+
+	void toggle()
+	{
+		m_visible = !m_visible;
+	}
+
+	/// @brief 記録済みのフレームの処理時間の percentile [ms] を返します。
+	/// @param stage 処理、none の場合はフレーム全体
+	/// @param p 0.0 - 1.0
+	double percentile(const Optional<FrameStage>& stage, double p) const
+	{
+		if (m_count == 0)
+		{
+			return 0.0;
+		}
+
+		Array<double> values(Arg::reserve = m_count);
+		for (size_t i = 0; i < m_count; ++i)
+		{
+			const auto& sample = m_samples[i];
+			values.push_back(stage ? sample.stageMs[static_cast<size_t>(stage.value())] : sample.totalMs);
+		}
+
+		const size_t n = static_cast<size_t>(p * (values.size() - 1));
+		std::nth_element(values.begin(), values.begin() + n, values.end());
+		return values[n];
+	}
+
+	void draw(const Font& font, const Vec2& pos, const Optional<size_t>& focusReceipt) const
+	{
+		const double lineHeight = font.height() + 2;
+		const double width = 420;
+
+		const size_t lineCount = 3 + FrameStageCount + PipelineStageCount + 2;
+		const RectF panel(pos, width, lineHeight * lineCount + 60);
+		panel.draw(ColorF{ 0.0, 0.75 });
+
+		Vec2 linePos = pos + Vec2(10, 6);
+		font(U"frame {} / {} 件   [F3] 表示切替  [F4] ファイルに保存"_fmt(m_count, Capacity)).draw(linePos, Palette::White);
+		linePos.y += lineHeight;
+
+		font(U"{:<12}{:>9}{:>9}{:>9}{:>9}"_fmt(U"[ms]", U"p50", U"p95", U"p99", U"max")).draw(linePos, Palette::Gray);
+		linePos.y += lineHeight;
+
+		const auto drawRow = [&](StringView name, const Optional<FrameStage>& stage)
+			{
+				font(U"{:<12}{:>9.2f}{:>9.2f}{:>9.2f}{:>9.2f}"_fmt(name, percentile(stage, 0.5), percentile(stage, 0.95), percentile(stage, 0.99), percentile(stage, 1.0))).draw(linePos, Palette::White);
+				linePos.y += lineHeight;
+			};
+
+		drawRow(U"frame", none);
+		for (size_t i = 0; i < FrameStageCount; ++i)
+		{
+			drawRow(FrameStageNames[i], static_cast<FrameStage>(i));
+		}
+
+		// 直近のフレーム時間のグラフ（16.7ms を高さの半分とする）
+		{
+			const RectF graphRect(linePos, width - 20, 50);
+			graphRect.drawFrame(1.0, Palette::Gray);
+			const double barWidth = graphRect.w / Capacity;
+			for (size_t i = 0; i < m_count; ++i)
+			{
+				const auto& sample = m_samples[(m_head + Capacity - m_count + i) % Capacity];
+				const double h = Min(sample.totalMs / (1000.0 / 60.0) * 0.5, 1.0) * graphRect.h;
+				RectF(Arg::bottomLeft = graphRect.bl() + Vec2(barWidth * i, 0), barWidth, h).draw((1000.0 / 60.0) < sample.totalMs ? Palette::Orangered : Palette::Limegreen);
+			}
+			linePos.y += graphRect.h + 10;
+		}
+
+		font(focusReceipt ? U"読み取り処理 [ms]（{} 件目）"_fmt(focusReceipt.value() + 1) : U"読み取り処理 [ms]").draw(linePos, Palette::Gray);
+		linePos.y += lineHeight;
+
+		for (size_t i = 0; i < PipelineStageCount; ++i)
+		{
+			Optional<double> ms = m_image.stageMs[i];
+			if (focusReceipt && focusReceipt.value() < m_receipts.size() && m_receipts[focusReceipt.value()].stageMs[i])
+			{
+				ms = m_receipts[focusReceipt.value()].stageMs[i];
+			}
+
+			font(U"{:<12}{:>9}"_fmt(PipelineStageNames[i], ms ? U"{:.2f}"_fmt(ms.value()) : U"-")).draw(linePos, Palette::White);
+			linePos.y += lineHeight;
+		}
+	}
+
+	/// @brief 記録済みの処理時間を CSV に保存します。
+	bool saveCSV(FilePathView path) const
+	{
+		CSV csv;
+
+		csv.write(U"frame");
+		csv.write(U"total");
+		for (const auto& name : FrameStageNames)
+		{
+			csv.write(name);
+		}
+		csv.newLine();
+
+		for (size_t i = 0; i < m_count; ++i)
+		{
+			const auto& sample = m_samples[(m_head + Capacity - m_count + i) % Capacity];
+			csv.write(i);
+			csv.write(sample.totalMs);
+			for (const auto& ms : sample.stageMs)
+			{
+				csv.write(ms);
+			}
+			csv.newLine();
+		}
+
+		csv.newLine();
+		csv.write(U"receipt");
+		for (const auto& name : PipelineStageNames)
+		{
+			csv.write(name);
+		}
+		csv.newLine();
+
+		const auto writePipeline = [&](const String& label, const PipelineSample& sample)
+			{
+				csv.write(label);
+				for (const auto& ms : sample.stageMs)
+				{
+					csv.write(ms ? Format(ms.value()) : U"");
+				}
+				csv.newLine();
+			};
+
+		writePipeline(U"image", m_image);
+		for (const auto& [receiptIndex, sample] : Indexed(m_receipts))
+		{
+			writePipeline(Format(receiptIndex), sample);
+		}
+
+		return csv.save(path);
+	}
+
+private:
+
+	FrameProfiler() = default;
+
+	std::array<FrameSample, Capacity> m_samples{};
+	size_t m_head = 0;
+	size_t m_count = 0;
+	FrameSample m_current;
+	Stopwatch m_frameTimer;
+
+	PipelineSample m_image;
+	Array<PipelineSample> m_receipts;
+
+	bool m_visible = false;
+};
+
+// スコープを抜けるまでの時間を FrameProfiler に記録する
+class ScopedFrameTimer
+{
+public:
+
+	explicit ScopedFrameTimer(FrameStage stage)
+		: m_stage{ stage } {}
+
+	~ScopedFrameTimer()
+	{
+		FrameProfiler::Instance().addFrameTime(m_stage, m_stopwatch.msF());
+	}
+
+private:
+
+	FrameStage m_stage;
+	Stopwatch m_stopwatch{ StartImmediately::Yes };
+};
+
+class ScopedPipelineTimer
+{
+public:
+
+	explicit ScopedPipelineTimer(PipelineStage stage, const Optional<size_t>& receiptIndex = none)
+		: m_stage{ stage }
+		, m_receiptIndex{ receiptIndex } {}
+
+	/// @brief FrameProfiler ではなく sample に記録します。FrameProfiler はメインスレッドからのみ使えるので、別スレッドではこちらを使います。
+	ScopedPipelineTimer(PipelineStage stage, FrameProfiler::PipelineSample& sample)
+		: m_stage{ stage }
+		, m_sample{ &sample } {}
+
+	~ScopedPipelineTimer()
+	{
+		if (m_sample)
+		{
+			m_sample->stageMs[static_cast<size_t>(m_stage)] = m_stopwatch.msF();
+			return;
+		}
+
+		FrameProfiler::Instance().setPipelineTime(m_stage, m_stopwatch.msF(), m_receiptIndex);
+	}
+
+private:
+
+	PipelineStage m_stage;
+	Optional<size_t> m_receiptIndex;
+	FrameProfiler::PipelineSample* m_sample = nullptr;
+	Stopwatch m_stopwatch{ StartImmediately::Yes };
+};
@@ -2,6 +2,10 @@
 #include <Siv3D.hpp> // Siv3D v0.6.15
 #include "Common.hpp"
 #include "Utility.hpp"
+#include "Profiler.hpp"
+#include "Trace.hpp"
+#include "Ledger.hpp"
+#include "Session.hpp"
 
 struct TextEditor
 {
@@ -14,12 +18,25 @@ struct TextEditor
 struct EditDataBase
 {
 	bool isData = true;    // isData = false : 空欄を追加する用のダミーデータ
-	bool isVisible = true; // isVivisble = false : 表示を消して保存時もスキップされる（復元可能な削除フラグ）
+
+	// false : 表示を消して保存時もスキップされる（復元可能な削除フラグ）
+	// EditColumn の表示中の要素数と食い違わないよう、変えるのは EditColumn::setVisible だけにする
+	bool isVisible() const
+	{
+		return m_isVisible;
+	}
 
 	size_t count() const
 	{
-		return isVisible ? 1 : 0;
+		return m_isVisible ? 1 : 0;
 	}
+
+private:
+
+	template <class EditDataType>
+	friend class EditColumn;
+
+	bool m_isVisible = true;
 };
 
 struct ItemNameEditData : public EditDataBase
@@ -55,36 +72,60 @@ struct ItemDiscountEditData : public EditDataBase
 	}
 };
 
+// 取り消し可能な編集操作（変更のあった値だけを保持する）
+struct EditCommand
+{
+	enum class Type
+	{
+		EditText,
+		RemoveRow,
+	};
+
+	Type type = Type::EditText;
+	MarkType target = MarkType::Unassigned; // ShopName, Date, Goods, Price のいずれか
+	size_t index = 0;    // Goods, Price : 物理インデックス, Date : 0 = 年, 1 = 月, 2 = 日, 3 = 時, 4 = 分
+	size_t subIndex = 0; // Price : 0 = 価格, 1 以降 = 割引のインデックス + 1
+	String before;
+	String after;
+};
+
 template<class EditDataType>
-struct EditColumn
+class EditColumn
 {
+public:
+
+	size_t size() const
+	{
+		return m_data.size();
+	}
+
+	bool empty() const
+	{
+		return m_data.empty();
+	}
+
 	size_t visibleCount() const
 	{
-		size_t count = 0;
-		for (const auto& elem: data)
-		{
-			if (elem.isVisible)
-			{
-				++count;
-			}
-		}
-		return count;
+		return m_visibleCount;
+	}
+
+	void push_back(const EditDataType& elem)
+	{
+		m_data.push_back(elem);
+		m_visibleTree.push_back(elem.count());
+		m_visibleCount += elem.count();
+	}
+
+	EditDataType& back()
+	{
+		return m_data.back();
 	}
 
 	EditDataType* at(size_t index)
 	{
-		size_t dataIndex = 0;
-		for (auto& elem : data)
+		if (auto physicalIndex = toPhysicalIndex(index))
 		{
-			if (elem.isVisible)
-			{
-				if (dataIndex == index)
-				{
-					return &elem;
-				}
-
-				++dataIndex;
-			}
+			return &m_data[physicalIndex.value()];
 		}
 
 		return nullptr;
@@ -92,43 +133,338 @@ struct EditColumn
 
 	const EditDataType* at(size_t index) const
 	{
-		size_t dataIndex = 0;
-		for (auto& elem : data)
+		if (auto physicalIndex = toPhysicalIndex(index))
 		{
-			if (elem.isVisible)
-			{
-				if (dataIndex == index)
-				{
-					return &elem;
-				}
-
-				++dataIndex;
-			}
+			return &m_data[physicalIndex.value()];
 		}
 
 		return nullptr;
 	}
 
+	EditDataType* physical(size_t physicalIndex)
+	{
+		return physicalIndex < m_data.size() ? &m_data[physicalIndex] : nullptr;
+	}
+
+	const EditDataType* physical(size_t physicalIndex) const
+	{
+		return physicalIndex < m_data.size() ? &m_data[physicalIndex] : nullptr;
+	}
+
 	Optional<size_t> toPhysicalIndex(size_t visibleIndex) const
 	{
-		size_t dataIndex = 0;
-		for (auto [physicalIndex, elem] : Indexed(data))
+		if (m_visibleCount <= visibleIndex)
+		{
+			return none;
+		}
+
+		return m_visibleTree.upperBound(static_cast<int64>(visibleIndex));
+	}
+
+	// 物理インデックス physicalIndex より前にある表示中の要素数
+	size_t countVisibleBefore(size_t physicalIndex) const
+	{
+		return static_cast<size_t>(m_visibleTree.prefixSum(Min(physicalIndex, m_data.size())));
+	}
+
+	Optional<size_t> toVisibleIndex(size_t physicalIndex) const
+	{
+		if (m_data.size() <= physicalIndex || !m_data[physicalIndex].isVisible())
+		{
+			return none;
+		}
+
+		return countVisibleBefore(physicalIndex);
+	}
+
+	// 表示中の要素の削除フラグを立てる
+	bool remove(size_t visibleIndex)
+	{
+		if (auto physicalIndex = toPhysicalIndex(visibleIndex))
+		{
+			return setVisible(physicalIndex.value(), false);
+		}
+
+		return false;
+	}
+
+	// 削除した要素を復元する
+	bool restore(size_t physicalIndex)
+	{
+		return setVisible(physicalIndex, true);
+	}
+
+	bool setVisible(size_t physicalIndex, bool isVisible)
+	{
+		if (m_data.size() <= physicalIndex || m_data[physicalIndex].isVisible() == isVisible)
+		{
+			return false;
+		}
+
+		m_data[physicalIndex].m_isVisible = isVisible;
+		m_visibleTree.add(physicalIndex, isVisible ? 1 : -1);
+		m_visibleCount = isVisible ? m_visibleCount + 1 : m_visibleCount - 1;
+		return true;
+	}
+
+private:
+
+	Array<EditDataType> m_data;
+	FenwickTree m_visibleTree; // isVisible の累積和（表示上のインデックス <-> 物理インデックスの変換用）
+	size_t m_visibleCount = 0;
+};
+
+struct EditTextCell
+{
+	String text;        // 編集開始時に TextBox に渡す文字列
+	String wrappedText; // 幅で折り返した表示用の文字列
+	RectF region;       // 折り返した文字列の描画領域
+	double width = 0;   // TextBox の幅
+	Color color;
+	MarkType markType = MarkType::Unassigned;
+	size_t editIndex = 0;
+	size_t editIndex2 = 0;
+	Rect texRegion = Rect::Empty(); // 読み取り元の画像の領域
+};
+
+struct EditLayoutKey
+{
+	uint64 fontID = 0;
+	Point textureTopLeft;
+	Size sceneSize;
+
+	bool operator==(const EditLayoutKey&) const = default;
+};
+
+// EditedData::draw() で使う位置と大きさの計算結果
+// 位置は draw() の pos0 を原点として持ち、描画時に pos0 だけずらす
+struct EditLayout
+{
+	EditLayoutKey key;
+	double drawScale = 1.0;
+
+	EditTextCell shopNameCell;
+	Array<EditTextCell> dateCells;
+	Array<std::pair<String, Vec2>> dateLabels; // 年月日時分の表示文字列と位置
+
+	Array<Optional<EditTextCell>> nameCells;
+	Array<Optional<EditTextCell>> priceCells;
+	Array<Array<EditTextCell>> discountCells;
+
+	Array<RectF> nameRects;
+	Array<RectF> priceRects; // 末尾は合計額
+	Array<double> sumHeight; // 各行の上端の itemsPos からの距離（末尾は合計額の行）
+	Vec2 itemsPos;           // 商品の一行目の左上
+	double calcMaxNameWidth = 0;
+	double calcMaxPriceWidth = 0;
+
+	int32 sumOfPrice = 0;
+	Line sumLine;
+
+	RectF region;
+};
+
+// 購入日の月を中心に、家計簿の集計を表示する
+// 集計は表示する月の Ledger::version が変わった時だけやり直す
+class RollupPanel
+{
+public:
+
+	static constexpr double Width = 300;
+
+	// 月ごとの合計を表示する月数
+	static constexpr int32 MonthCount = 12;
+
+	void draw(const RectF& rect, const Font& font, const Date& date)
+	{
+		if (date != m_date || m_versions != versions(date))
 		{
-			if (elem.isVisible)
+			update(date);
+		}
+
+		rect.draw(ColorF{ 0.0, 0.05 });
+		rect.drawFrame();
+
+		const double lineHeight = font.height() + 4;
+		Vec2 pos = rect.pos + Vec2(10, 10);
+
+		const auto drawLine = [&](const String& text, const ColorF& color)
 			{
-				if (dataIndex == visibleIndex)
-				{
-					return physicalIndex;
-				}
+				font(text).draw(pos, color);
+				pos.y += lineHeight;
+			};
 
-				++dataIndex;
-			}
+		const auto statsText = [](const RollupStats& stats)
+			{
+				return stats.empty() ? String{ U"-" } : U"{}円 / {}点"_fmt(ThousandsSeparate(stats.sum), stats.count);
+			};
+
+		drawLine(U"集計{}"_fmt(m_complete ? U"" : U"（読み込み中）"), Palette::Black);
+		if (const auto [loadedCount, totalCount] = Ledger::Instance().preloadProgress(); loadedCount < totalCount)
+		{
+			drawLine(U"  家計簿 {} / {} か月を読み込み済み"_fmt(loadedCount, totalCount), Palette::Dimgray);
+		}
+		drawLine(U"{}  {}"_fmt(date.format(U"MM月dd日"), statsText(m_day)), Palette::Black);
+		drawLine(U"{}  {}"_fmt(date.format(U"yyyy年MM月"), statsText(m_month.total)), Palette::Black);
+		if (!m_month.total.empty())
+		{
+			drawLine(U"  最小 {}円  最大 {}円"_fmt(ThousandsSeparate(m_month.total.min), ThousandsSeparate(m_month.total.max)), Palette::Dimgray);
+		}
+		pos.y += lineHeight / 2;
+
+		drawLine(U"店ごと", Palette::Dimgray);
+		for (const auto& [shopName, stats] : m_topShops)
+		{
+			drawLine(U"  {}  {}"_fmt(shopName, statsText(stats)), Palette::Black);
+		}
+		pos.y += lineHeight / 2;
+
+		drawLine(U"品名ごと", Palette::Dimgray);
+		for (const auto& [itemName, stats] : m_topItems)
+		{
+			drawLine(U"  {}  {}"_fmt(itemName, statsText(stats)), Palette::Black);
+		}
+		pos.y += lineHeight / 2;
+
+		// 直近の月ごとの合計（最大の月を幅いっぱいとする）
+		drawLine(U"直近 {} か月  {}"_fmt(MonthCount, statsText(m_months.total)), Palette::Dimgray);
+		int64 maxSum = 1;
+		for (const auto& [first, stats] : m_months.byMonth)
+		{
+			maxSum = Max(maxSum, stats.sum);
+		}
+		const double labelWidth = font(U"0000/00 ").region().w;
+		const double barWidth = rect.w - 20 - labelWidth;
+		for (const auto& [first, stats] : m_months.byMonth)
+		{
+			font(first.format(U"yyyy/MM")).draw(pos, Palette::Black);
+			RectF(pos + Vec2(labelWidth, 2), barWidth * Max<int64>(stats.sum, 0) / maxSum, lineHeight - 6).draw(Palette::Skyblue);
+			pos.y += lineHeight;
+		}
+	}
+
+private:
+
+	// 表示に使う月の version
+	static Array<uint64> versions(const Date& date)
+	{
+		Array<uint64> result;
+		for (int32 i = 0; i < MonthCount; ++i)
+		{
+			result.push_back(Ledger::Instance().version(LedgerMonthPath(AddMonths(date, i - MonthCount + 1))));
+		}
+		return result;
+	}
+
+	static Array<std::pair<String, RollupStats>> Top(const HashTable<String, RollupStats>& table, size_t count)
+	{
+		Array<std::pair<String, RollupStats>> result(table.begin(), table.end());
+		result.sort_by([](const auto& a, const auto& b) { return a.second.sum > b.second.sum; });
+		result.resize(Min(result.size(), count));
+		return result;
+	}
+
+	void update(const Date& date)
+	{
+		ScopedTrace trace(U"RollupPanel::update", U"csv");
+
+		auto& ledger = Ledger::Instance();
+		const auto first = AddMonths(date, 0);
+		const Date last{ date.year, date.month, date.daysInMonth() };
+
+		m_day = ledger.aggregate(date, date).total;
+		m_month = ledger.aggregate(first, last);
+		m_months = ledger.aggregate(AddMonths(date, -MonthCount + 1), last);
+		m_complete = m_month.complete && m_months.complete;
+
+		m_topShops = Top(m_month.byShop, 5);
+		m_topItems = Top(m_month.byItem, 5);
+
+		// 集計で読み込みを始めた月の version も含める
+		m_date = date;
+		m_versions = versions(date);
+	}
+
+	Date m_date{ 0, 1, 1 };
+	Array<uint64> m_versions;
+	bool m_complete = false;
+
+	RollupStats m_day;
+	RollupResult m_month;
+	RollupResult m_months;
+	Array<std::pair<String, RollupStats>> m_topShops;
+	Array<std::pair<String, RollupStats>> m_topItems;
+};
+
+// 全期間の家計簿から品名・店名を検索する
+// 入力か索引が変わった時だけ検索し直す
+class LedgerSearchPanel
+{
+public:
+
+	static constexpr double Height = 280;
+
+	bool active() const
+	{
+		return m_state.active;
+	}
+
+	void draw(const RectF& rect, const Font& font)
+	{
+		rect.draw(ColorF{ 0.0, 0.05 });
+		rect.drawFrame();
+
+		const Vec2 boxPos = rect.pos + Vec2(10, 10);
+		SimpleGUI::TextBox(m_state, boxPos, rect.w - 20);
+
+		const auto& index = LedgerSearchIndex::Instance();
+		if (m_state.text != m_query || m_version != index.version())
+		{
+			ScopedTrace trace(U"LedgerSearchIndex::search", U"csv");
+
+			const Stopwatch stopwatch{ StartImmediately::Yes };
+			m_query = m_state.text;
+			m_version = index.version();
+			m_hits = index.search(m_query, MaxHitCount);
+			m_searchMs = stopwatch.msF();
+		}
+
+		const double lineHeight = font.height() + 4;
+		Vec2 pos = boxPos + Vec2(0, 46);
+
+		if (m_query.isEmpty())
+		{
+			font(U"品名・店名で検索").draw(pos, Palette::Dimgray);
+			return;
 		}
 
-		return none;
+		font(U"{} 件（{:.2f} ms）"_fmt(m_hits.size(), m_searchMs)).draw(pos, Palette::Dimgray);
+		pos.y += lineHeight;
+
+		for (const auto& hit : m_hits)
+		{
+			if (rect.bottomY() < pos.y + lineHeight * 2)
+			{
+				break;
+			}
+
+			font(hit.isShopName ? U"[店] " : U"", hit.text, U"  {} 回"_fmt(hit.count)).draw(pos, Palette::Black);
+			pos.y += lineHeight;
+
+			font(hit.isShopName ? U"  最後 {}"_fmt(hit.lastBuyDate) : U"  最後 {} {} {}円"_fmt(hit.lastBuyDate, hit.lastShopName, hit.lastPrice)).draw(pos, Palette::Dimgray);
+			pos.y += lineHeight;
+		}
 	}
 
-	Array<EditDataType> data;
+private:
+
+	static constexpr size_t MaxHitCount = 20;
+
+	TextEditState m_state;
+	String m_query;
+	uint64 m_version = 0;
+	Array<LedgerSearchHit> m_hits;
+	double m_searchMs = 0.0;
 };
 
 class EditedData
@@ -145,7 +481,7 @@ public:
 
 	void editTextUpdate()
 	{
-		if (!textEdit.state.active)
+		if (textEdit.editType && !textEdit.state.active)
 		{
 			conirmTextEdit();
 			textEdit.editType = none;
@@ -167,43 +503,170 @@ public:
 		return Max({ itemNameEdit.visibleCount(),itemPriceEdit.visibleCount(),itemDiscountEdit.visibleCount() });
 	}
 
+	/// @brief 編集結果をセッションファイルの記録に書きます。
+	void writeSession(SessionWriter& writer) const
+	{
+		writer.write(shopName);
+		writer.write(static_cast<int32>(date.year));
+		writer.write(static_cast<int32>(date.month));
+		writer.write(static_cast<int32>(date.day));
+		writer.write(hours);
+		writer.write(minutes);
+
+		writer.write(static_cast<uint32>(itemNameEdit.size()));
+		for (size_t i = 0; i < itemNameEdit.size(); ++i)
+		{
+			const auto& data = *itemNameEdit.physical(i);
+			writer.write(data.isData);
+			writer.write(data.isVisible());
+			writer.write(data.name);
+			writer.write(data.nameTexRegion);
+		}
+
+		writer.write(static_cast<uint32>(itemPriceEdit.size()));
+		for (size_t i = 0; i < itemPriceEdit.size(); ++i)
+		{
+			const auto& data = *itemPriceEdit.physical(i);
+			writer.write(data.isData);
+			writer.write(data.isVisible());
+			writer.write(data.price);
+			writer.write(data.priceTexRegion);
+		}
+
+		writer.write(static_cast<uint32>(itemDiscountEdit.size()));
+		for (size_t i = 0; i < itemDiscountEdit.size(); ++i)
+		{
+			const auto& data = *itemDiscountEdit.physical(i);
+			writer.write(data.isData);
+			writer.write(data.isVisible());
+			writer.write(static_cast<uint32>(data.discount.size()));
+			for (const auto discount : data.discount)
+			{
+				writer.write(discount);
+			}
+			writer.write(static_cast<uint32>(data.discountTexRegion.size()));
+			for (const auto& region : data.discountTexRegion)
+			{
+				writer.write(region);
+			}
+		}
+	}
+
+	/// @brief writeSession() で書いた編集結果を読み込みます。空の EditedData に対して呼びます。
+	/// @return 記録が壊れている場合 false
+	bool readSession(SessionReader& reader)
+	{
+		shopName = reader.readString();
+		const auto year = reader.read<int32>();
+		const auto month = reader.read<int32>();
+		const auto day = reader.read<int32>();
+		date = Date{ year, month, day };
+		hours = reader.read<int32>();
+		minutes = reader.read<int32>();
+
+		for (size_t count = reader.readCount(); 0 < count; --count)
+		{
+			ItemNameEditData data;
+			data.isData = reader.read<bool>();
+			const bool isVisible = reader.read<bool>();
+			data.name = reader.readString();
+			data.nameTexRegion = reader.readRect();
+			itemNameEdit.push_back(data);
+			itemNameEdit.setVisible(itemNameEdit.size() - 1, isVisible);
+		}
+
+		for (size_t count = reader.readCount(); 0 < count; --count)
+		{
+			ItemPriceEditData data;
+			data.isData = reader.read<bool>();
+			const bool isVisible = reader.read<bool>();
+			data.price = reader.read<int32>();
+			data.priceTexRegion = reader.readRect();
+			itemPriceEdit.push_back(data);
+			itemPriceEdit.setVisible(itemPriceEdit.size() - 1, isVisible);
+		}
+
+		for (size_t count = reader.readCount(); 0 < count; --count)
+		{
+			ItemDiscountEditData data;
+			data.isData = reader.read<bool>();
+			const bool isVisible = reader.read<bool>();
+			data.discount.resize(reader.readCount());
+			for (auto& discount : data.discount)
+			{
+				discount = reader.read<int32>();
+			}
+			data.discountTexRegion.resize(reader.readCount());
+			for (auto& region : data.discountTexRegion)
+			{
+				region = reader.readRect();
+			}
+			itemDiscountEdit.push_back(data);
+			itemDiscountEdit.setVisible(itemDiscountEdit.size() - 1, isVisible);
+		}
+
+		if (!reader.ok)
+		{
+			return false;
+		}
+
+		reloadCSV();
+		return true;
+	}
+
 	void makeTemporary()
 	{
 		temporaryData = makeDefaultTable();
+		updateTemporary(0);
+	}
 
-		const auto idStr = id();
-		const auto dateStr = buyDateFormat();
-		const auto now = DateTime::Now();
-		const auto nowStr = now.format(U"yyyy年MM月dd日HH時mm分ss秒");
+	// 編集中の表の [beginRow, endRow) 行目を差し替え、行数を現在の表示行数に合わせる
+	void updateTemporary(size_t beginRow, size_t endRow = SIZE_MAX)
+	{
+		// 編集データの変更は必ずここを通るので、レイアウトの再計算もここで要求する
+		layoutDirty = true;
+
+		if (temporaryData.rows() == 0)
+		{
+			makeTemporary();
+			return;
+		}
 
 		const auto rowCount = visibleRowCount();
-		for (auto rowIndex : step(rowCount))
+
+		// 先頭はヘッダー行
+		while (rowCount + 1 < temporaryData.rows())
 		{
-			auto nameEditPtr = itemNameEdit.at(rowIndex);
-			auto priceEditPtr = itemPriceEdit.at(rowIndex);
-			auto discountEditPtr = itemDiscountEdit.at(rowIndex);
+			temporaryData.pop_back_row();
+		}
 
-			int32 price = priceEditPtr ? priceEditPtr->price : 0;
-			if (discountEditPtr)
+		const auto dateStr = buyDateFormat();
+		const size_t filledRowCount = temporaryData.rows() - 1;
+		for (size_t rowIndex = beginRow; rowIndex < Min({ endRow, filledRowCount, rowCount }); ++rowIndex)
+		{
+			for (const auto& [column, text] : Indexed(temporaryRow(rowIndex, dateStr)))
 			{
-				for (const auto& v : discountEditPtr->discount)
-				{
-					price += v;
-				}
+				temporaryData.setText(rowIndex + 1, column, text);
 			}
+		}
 
-			const auto nameStr = nameEditPtr ? nameEditPtr->name : U"";
-			const auto priceStr = Format(price);
-
-			temporaryData.push_back_row({ nameStr, priceStr, shopName, dateStr }, { -1,1,0,0 });
+		// 表示行数が増えた分は末尾に追加する
+		for (size_t rowIndex = filledRowCount; rowIndex < rowCount; ++rowIndex)
+		{
+			temporaryData.push_back_row(temporaryRow(rowIndex, dateStr), { -1,1,0,0 });
 		}
 	}
 
 	void reloadCSV()
 	{
+		ScopedTrace trace(U"reloadCSV", U"csv");
+
 		// 同一日に購入したデータのリスト
+		// 月の読み込みが終わっていない場合は空になり、終わった時に version が変わって読み直される
 		auto filteredRows = searchData();
+		ledgerVersion = Ledger::Instance().version(csvPath());
 		tableDataList.clear();
+		gridDirty = true;
 
 		// 登録日時でグループ化して削除できるようにする
 		for (const auto& row : filteredRows)
@@ -217,16 +680,18 @@ public:
 			tableDataList[key].push_back_row({ row[0], row[1], row[2], row[3] }, { -1,1,0,0 });
 		}
 
-		makeTemporary();
+		// 購入日の列だけが変わる
+		updateTemporary(0);
 	}
 
-	SimpleTable makeDefaultTable()
+	// 表のスタイルとフォントはすべての表で共有する
+	static SimpleTable makeDefaultTable()
 	{
 		SimpleTable newData{ { 50,50,50,50 }, {
 			.variableWidth = true,
-			.font = Font(14, Typeface::Regular),
+			.font = FontAsset(U"TableFont"),
 			.fontSize = 14,
-			.columnHeaderFont = Font(14, Typeface::Bold),
+			.columnHeaderFont = FontAsset(U"TableFontBold"),
 			.columnHeaderFontSize = 14,
 			} };
 
@@ -237,297 +702,146 @@ public:
 
 	void conirmTextEdit()
 	{
-		switch (textEdit.editType.value())
+		EditCommand command;
+		command.target = (textEdit.editType.value() == MarkType::Number) ? MarkType::Price : textEdit.editType.value();
+		command.subIndex = textEdit.editIndex2;
+		command.after = textEdit.state.text;
+
+		switch (command.target)
 		{
 		case MarkType::ShopName:
-			shopName = textEdit.state.text;
 			break;
 		case MarkType::Date:
-			if (auto opt = ParseIntOpt<int32>(textEdit.state.text, 10))
-			{
-				switch (textEdit.editIndex)
-				{
-				case 0:
-					date.year = opt.value();
-					break;
-				case 1:
-					date.month = opt.value();
-					break;
-				case 2:
-					date.day = opt.value();
-					break;
-				case 3:
-					hours = opt.value();
-					break;
-				case 4:
-					minutes = opt.value();
-					break;
-				default:
-					break;
-				}
-				reloadCSV();
-			}
+			command.index = textEdit.editIndex;
 			break;
 		case MarkType::Goods:
-			if (auto nameEditPtr = itemNameEdit.at(textEdit.editIndex))
+			if (auto physicalIndex = itemNameEdit.toPhysicalIndex(textEdit.editIndex))
+			{
+				command.index = physicalIndex.value();
+			}
+			else
 			{
-				nameEditPtr->name = textEdit.state.text;
-				makeTemporary();
+				return;
 			}
 			break;
-		case MarkType::Price: [[fallthrough]];
-		case MarkType::Number:
-			if (auto opt = ParseIntOpt<int32>(textEdit.state.text, 10))
+		case MarkType::Price:
+			if (auto physicalIndex = (command.subIndex == 0 ? itemPriceEdit.toPhysicalIndex(textEdit.editIndex) : itemDiscountEdit.toPhysicalIndex(textEdit.editIndex)))
 			{
-				if (textEdit.editIndex2 == 0)
-				{
-					if (auto priceEditPtr = itemPriceEdit.at(textEdit.editIndex))
-					{
-						priceEditPtr->price = opt.value();
-					}
-				}
-				else
-				{
-					if (auto discountEditPtr = itemDiscountEdit.at(textEdit.editIndex))
-					{
-						discountEditPtr->discount[textEdit.editIndex2 - 1] = opt.value();
-					}
-				}
-				makeTemporary();
+				command.index = physicalIndex.value();
+			}
+			else
+			{
+				return;
 			}
 			break;
-		default: break;
+		default:
+			return;
+		}
+
+		if (auto before = getText(command.target, command.index, command.subIndex))
+		{
+			command.before = before.value();
+		}
+
+		if (command.before != command.after && setText(command.target, command.index, command.subIndex, command.after))
+		{
+			pendingCommands.push_back(command);
 		}
 	}
 
-	RectF drawEditableText(const String& str, const Font& font, const Vec2& pos, Color color, MarkType markType, size_t editIndex, size_t editIndex2, double width, bool isFocus)
+	// 確定した編集操作を取り出す（取り出した操作は ReceiptEditor の履歴に積まれる）
+	Array<EditCommand> takeCommands()
+	{
+		return std::exchange(pendingCommands, {});
+	}
+
+	void undo(const EditCommand& command)
+	{
+		applyCommand(command, true);
+	}
+
+	void redo(const EditCommand& command)
+	{
+		applyCommand(command, false);
+	}
+
+	void drawEditableText(const EditTextCell& cell, const Font& font, bool isFocus)
 	{
-		const auto text = font(WrapByWidth(font, str, width));
-		auto region = text.region(pos);
+		const auto text = font(cell.wrappedText);
 
 		if (isFocus)
 		{
-			if (textEdit.editType && textEdit.editType.value() == markType && textEdit.editIndex == editIndex && textEdit.editIndex2 == editIndex2)
+			if (textEdit.editType && textEdit.editType.value() == cell.markType && textEdit.editIndex == cell.editIndex && textEdit.editIndex2 == cell.editIndex2)
 			{
-				SimpleGUI::TextBox(textEdit.state, pos - Vec2(4, 4), width);
+				SimpleGUI::TextBox(textEdit.state, cell.region.pos - Vec2(4, 4), cell.width);
 			}
 			else
 			{
-				text.draw(pos).drawFrame(1.0, color);
+				text.draw(cell.region.pos).drawFrame(1.0, cell.color);
 
-				if (region.mouseOver())
+				if (cell.region.mouseOver())
 				{
-					region.drawFrame(1.0, Palette::White);
+					cell.region.drawFrame(1.0, Palette::White);
 				}
 
-				if (region.leftClicked())
+				if (cell.region.leftClicked())
 				{
 					if (textEdit.editType)
 					{
 						conirmTextEdit();
 					}
-					textEdit.state.text = str;
+					textEdit.state.text = cell.text;
 					textEdit.state.active = true;
-					textEdit.editType = markType;
-					textEdit.editIndex = editIndex;
-					textEdit.editIndex2 = editIndex2;
+					textEdit.editType = cell.markType;
+					textEdit.editIndex = cell.editIndex;
+					textEdit.editIndex2 = cell.editIndex2;
 				}
 			}
 		}
 		else
 		{
-			text.draw(pos).drawFrame(1.0, color);
+			text.draw(cell.region.pos).drawFrame(1.0, cell.color);
 		}
-
-		return region;
 	}
 
 	RectF draw(const Vec2& pos0, const Font& font, const Texture& texture, const Point& textureTopLeft, double drawScale, bool isFocus)
 	{
+		ScopedFrameTimer timer(FrameStage::EditView);
+
 		const auto rowCount = visibleRowCount();
 		if (rowCount == 0)
 		{
 			return RectF();
 		}
 
-		double sumOfTexHeight = 0.0;
-		int32 numOfTexHeight = 0;
-		for (auto rowIndex : step(rowCount))
+		// レイアウトはデータ・フォント・テクスチャ・ウィンドウサイズが変わった時だけ計算し直す
+		// スクロールなどで pos0 だけが変わった場合は、描画とカーソルを pos0 だけずらして使い回す
+		const EditLayoutKey key{ font.id().value(), textureTopLeft, Scene::Size() };
+		if (layoutDirty || layout.key != key)
 		{
-			if (auto nameEditPtr = itemNameEdit.at(rowIndex))
-			{
-				if (!nameEditPtr->isNameTexEmpty())
-				{
-					sumOfTexHeight += nameEditPtr->nameTexRegion.h;
-					++numOfTexHeight;
-				}
-			}
-			if (auto priceEditPtr = itemPriceEdit.at(rowIndex))
-			{
-				if (!priceEditPtr->isPriceTexEmpty())
-				{
-					sumOfTexHeight += priceEditPtr->priceTexRegion.h;
-					++numOfTexHeight;
-				}
-			}
+			updateLayout(key, font, textureTopLeft);
 		}
 
-		const double averageTexHeight = sumOfTexHeight / numOfTexHeight;
-		drawScale = 0.8 * font.height() / averageTexHeight;
-
-		const int32 maxNameWidth = 300;
-		const int32 maxPriceWidth = 80;
+		const Transformer2D transformer{ Mat3x2::Translate(pos0), TransformCursor::Yes };
 
 		const int xMargin = 10;
 		const int yMargin = 12;
 		const int yInnerMargin = 8;
 
-		const int xOuterMargin = 40;
-		const int yOuterMargin = 50;
-
-		Array<double> nameWidth;
-		Array<double> priceWidth;
-		Array<double> namePriceHeight;
-
-		Array<Array<double>> discountWidth;
-
-		size_t maxDiscountIndex = 0;
-		int32 sumOfPrice = 0;
-		for (auto rowIndex : step(rowCount))
-		{
-			double maxHeight = 0;
-
-			if (auto nameEditPtr = itemNameEdit.at(rowIndex); nameEditPtr && nameEditPtr->isData)
-			{
-				const auto nameStrRegion = font(WrapByWidth(font, nameEditPtr->name, maxNameWidth - xMargin)).region();
-				const auto nameTexRegion = texture(nameEditPtr->nameTexRegion.movedBy(-textureTopLeft)).scaled(drawScale).region();
-				nameWidth.push_back(Max(nameStrRegion.w, nameTexRegion.w) + xMargin);//一番左端だけ空けないのでマージンは1つ分
-				maxHeight = Max(maxHeight, nameStrRegion.h + nameTexRegion.h);
-			}
-			else // 末尾以降 or ダミー
-			{
-				nameWidth.push_back(0);
-			}
-
-			if (auto priceEditPtr = itemPriceEdit.at(rowIndex); priceEditPtr && priceEditPtr->isData)
-			{
-				const auto priceStrRegion = font(WrapByWidth(font, Format(priceEditPtr->price), maxPriceWidth - xMargin * 2)).region();
-				const auto priceTexRegion = texture(priceEditPtr->priceTexRegion.movedBy(-textureTopLeft)).scaled(drawScale).region();
-				priceWidth.push_back(Max(priceStrRegion.w, priceTexRegion.w) + xMargin * 2);
-				maxHeight = Max(maxHeight, priceStrRegion.h + priceTexRegion.h);
-
-				sumOfPrice += priceEditPtr->price;
-			}
-			else // 末尾以降 or ダミー
-			{
-				priceWidth.push_back(0);
-			}
-
-			if (auto discountEditPtr = itemDiscountEdit.at(rowIndex); discountEditPtr && discountEditPtr->isData)
-			{
-				Array<double> currentWidth;
-
-				for (const auto& [discountIndex, discount] : Indexed(discountEditPtr->discount))
-				{
-					const auto discountStrRegion = font(WrapByWidth(font, Format(discount), maxPriceWidth - xMargin * 2)).region();
-					const auto discountTexRegion = texture(discountEditPtr->discountTexRegion[discountIndex].movedBy(-textureTopLeft)).scaled(drawScale).region();
-					currentWidth.push_back(Max(discountStrRegion.w, discountTexRegion.w) + xMargin * 2);
-					maxHeight = Max(maxHeight, discountStrRegion.h + discountTexRegion.h);
-
-					sumOfPrice += discount;
-					maxDiscountIndex = Max(maxDiscountIndex, discountIndex);
-				}
-
-				discountWidth.push_back(currentWidth);
-			}
-			else
-			{
-				Array<double> currentWidth;
-				discountWidth.push_back(currentWidth);
-			}
-
-			namePriceHeight.push_back(maxHeight + yInnerMargin + yMargin * 2);
-		}
-
-		const bool showSum = true;
-		// 合計額
-		if (showSum)
-		{
-			const auto priceStrRegion = font(WrapByWidth(font, Format(sumOfPrice), maxPriceWidth - xMargin * 2)).region();
-			priceWidth.push_back(priceStrRegion.w + xMargin * 2);
-			namePriceHeight.push_back(priceStrRegion.h + yMargin * 2);
-		}
-
-		const double calcMaxNameWidth = *std::max_element(nameWidth.begin(), nameWidth.end());
-		const double calcMaxPriceWidth = *std::max_element(priceWidth.begin(), priceWidth.end());
-
-		// 各列の最大幅を計算
-		Array<double> calcMaxDiscountWidth(maxDiscountIndex + 1, 0.0);
-		for (const auto& [itemIndex, itemDiscounts] : Indexed(discountWidth))
-		{
-			for (const auto& [discountIndex, width] : Indexed(itemDiscounts))
-			{
-				calcMaxDiscountWidth[discountIndex] = Max(calcMaxDiscountWidth[discountIndex], width);
-			}
-		}
-
-		Array<double> sumHeight(1, 0);
-		std::partial_sum(namePriceHeight.begin(), namePriceHeight.end(), std::back_inserter(sumHeight));
-
-		const double sumOfWidth = calcMaxNameWidth + calcMaxPriceWidth + calcMaxDiscountWidth.sum();
-
-		int32 maxWidth = sumOfWidth;
-
-		Vec2 pos_ = pos0 + Vec2(xOuterMargin, yOuterMargin);
+		drawEditableText(layout.shopNameCell, font, isFocus);
+		for (const auto& cell : layout.dateCells)
 		{
-			auto rect = drawEditableText(shopName, font, pos_, Palette::Orange.withAlpha(255), MarkType::ShopName, 0, 0, maxWidth, isFocus);
-			pos_ = rect.bl() + Vec2(0, yMargin * 2);
+			drawEditableText(cell, font, isFocus);
 		}
+		for (const auto& [label, labelPos] : layout.dateLabels)
 		{
-			pos_ += Vec2(0, yMargin);
-			auto rect = drawEditableText(Format(date.year), font, pos_, Palette::Greenyellow.withAlpha(255), MarkType::Date, 0, 0, 60, isFocus);
-			auto rect1 = font(U"年").draw(rect.tr() + Vec2(10, 0), Palette::White);
-			rect1 = drawEditableText(Format(date.month), font, rect1.tr() + Vec2(10, 0), Palette::Greenyellow.withAlpha(255), MarkType::Date, 1, 0, 30, isFocus);
-			rect1 = font(U"月").draw(rect1.tr() + Vec2(10, 0), Palette::White);
-			rect1 = drawEditableText(Format(date.day), font, rect1.tr() + Vec2(10, 0), Palette::Greenyellow.withAlpha(255), MarkType::Date, 2, 0, 30, isFocus);
-			rect1 = font(U"日").draw(rect1.tr() + Vec2(10, 0), Palette::White);
-
-			rect1 = drawEditableText(Format(hours), font, rect1.tr() + Vec2(10, 0), Palette::Greenyellow.withAlpha(255), MarkType::Date, 3, 0, 30, isFocus);
-			rect1 = font(U"時").draw(rect1.tr() + Vec2(10, 0), Palette::White);
-			rect1 = drawEditableText(Format(minutes), font, rect1.tr() + Vec2(10, 0), Palette::Greenyellow.withAlpha(255), MarkType::Date, 4, 0, 30, isFocus);
-			rect1 = font(U"分").draw(rect1.tr() + Vec2(10, 0), Palette::White);
-			pos_ = rect.bl() + Vec2(0, yMargin * 2);
+			font(label).draw(labelPos, Palette::White);
 		}
 
-		Array<RectF> nameRects;
-		Array<RectF> priceRects;
-		Array<Array<RectF>> discountRects;
-
-		for (auto itemIndex : step(rowCount))
-		{
-			const auto nameRect = RectF(pos_.x, pos_.y + sumHeight[itemIndex], calcMaxNameWidth, namePriceHeight[itemIndex]).stretched(-yMargin, -xMargin, -yMargin, 0);
-			const auto priceRect = RectF(pos_.x + calcMaxNameWidth, pos_.y + sumHeight[itemIndex], calcMaxPriceWidth, namePriceHeight[itemIndex]).stretched(-xMargin, -yMargin);
-
-			Array<RectF> currentRects;
-			if (auto discountEditPtr = itemDiscountEdit.at(itemIndex); discountEditPtr && discountEditPtr->isData)
-			{
-				Array<double> currentWidth;
-
-				for (const auto& [discountIndex, discount] : Indexed(discountEditPtr->discount))
-				{
-					const auto discountRect = RectF(
-						pos_.x + calcMaxNameWidth + calcMaxPriceWidth,
-						pos_.y + sumHeight[itemIndex],
-						calcMaxDiscountWidth[discountIndex],
-						namePriceHeight[itemIndex]).stretched(-xMargin, -yMargin);
-					currentRects.push_back(discountRect);
-				}
-			}
-			discountRects.push_back(currentRects);
-
-			nameRects.push_back(nameRect);
-			priceRects.push_back(priceRect);
-		}
+		const auto& nameRects = layout.nameRects;
+		const auto& priceRects = layout.priceRects;
+		const double calcMaxNameWidth = layout.calcMaxNameWidth;
+		const double calcMaxPriceWidth = layout.calcMaxPriceWidth;
 
 		struct EditRowOp
 		{
@@ -543,12 +857,15 @@ public:
 
 		Optional<EditRowOp> operationOpt;
 
+		// 画面内に入る行だけを描画・判定する
+		const auto [rowBegin, rowEnd] = visibleRowRange(-yMargin * 2 - pos0.y, Scene::Height() + yMargin * 2 - pos0.y);
+
 		// 要素の削除
 		bool guiHandled = false;
 		if (!textEditing())
 		{
 			const double deleteButtonSize = 20;
-			for (auto rowIndex : step(rowCount))
+			for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
 			{
 				const RectF nameDeleteButton(Arg::topRight = nameRects[rowIndex].tr(), deleteButtonSize, nameRects[rowIndex].h);
 				if (nameDeleteButton.mouseOver())
@@ -580,52 +897,40 @@ public:
 			}
 		}
 
-		if (showSum)
-		{
-			const auto priceRect = RectF(pos_.x + calcMaxNameWidth, pos_.y + sumHeight[rowCount] + yMargin * 2, calcMaxPriceWidth, namePriceHeight[rowCount]).stretched(-xMargin, -yMargin);
-			priceRects.push_back(priceRect);
-		}
-
 		isFocus = !guiHandled;
 
-		for (auto itemIndex : step(rowCount))
+		for (size_t itemIndex = rowBegin; itemIndex < rowEnd; ++itemIndex)
 		{
-			const auto& namePos = nameRects[itemIndex].pos;
-			if (auto nameEditPtr = itemNameEdit.at(itemIndex); nameEditPtr && nameEditPtr->isData)
+			if (const auto& nameCell = layout.nameCells[itemIndex])
 			{
-				auto nameRect = drawEditableText(nameEditPtr->name, font, namePos, Palette::Lime.withAlpha(255), MarkType::Goods, itemIndex, 0, calcMaxNameWidth - xMargin, isFocus);
-				auto nameTexRect = texture(nameEditPtr->nameTexRegion.movedBy(-textureTopLeft)).scaled(drawScale).draw(nameRect.bl() + Vec2(0, yInnerMargin));
+				drawEditableText(nameCell.value(), font, isFocus);
+				texture(nameCell->texRegion.movedBy(-textureTopLeft)).scaled(layout.drawScale).draw(nameCell->region.bl() + Vec2(0, yInnerMargin));
 			}
 
-			const auto pricePos = priceRects[itemIndex].pos;
-			if (auto priceEditPtr = itemPriceEdit.at(itemIndex); priceEditPtr && priceEditPtr->isData)
+			if (const auto& priceCell = layout.priceCells[itemIndex])
 			{
-				auto priceRect = drawEditableText(Format(priceEditPtr->price), font, pricePos, Palette::Cyan.withAlpha(255), MarkType::Price, itemIndex, 0, calcMaxPriceWidth - xMargin * 2, isFocus);
-				auto priceTexRect = texture(priceEditPtr->priceTexRegion.movedBy(-textureTopLeft)).scaled(drawScale).draw(priceRect.bl() + Vec2(0, yInnerMargin));
+				drawEditableText(priceCell.value(), font, isFocus);
+				texture(priceCell->texRegion.movedBy(-textureTopLeft)).scaled(layout.drawScale).draw(priceCell->region.bl() + Vec2(0, yInnerMargin));
 			}
 
-			if (auto discountEditPtr = itemDiscountEdit.at(itemIndex); discountEditPtr && discountEditPtr->isData)
+			for (const auto& discountCell : layout.discountCells[itemIndex])
 			{
-				for (const auto& [discountIndex, discount] : Indexed(discountEditPtr->discount))
-				{
-					const auto& rect = discountRects[itemIndex][discountIndex];
-					auto discountRect = drawEditableText(Format(discount), font, rect.pos, Palette::Cyan.withAlpha(255), MarkType::Price, itemIndex, 1 + discountIndex, calcMaxDiscountWidth[discountIndex] - xMargin * 2, isFocus);
-					auto discountTexRect = texture(discountEditPtr->discountTexRegion[discountIndex].movedBy(-textureTopLeft)).scaled(drawScale).draw(discountRect.bl() + Vec2(0, yInnerMargin));
-				}
+				drawEditableText(discountCell, font, isFocus);
+				texture(discountCell.texRegion.movedBy(-textureTopLeft)).scaled(layout.drawScale).draw(discountCell.region.bl() + Vec2(0, yInnerMargin));
 			}
 		}
 
-		if (showSum)
+		// 合計額
 		{
-			Line(pos0.x + xOuterMargin, nameRects.back().bottomY() + yMargin * 2, pos0.x + xOuterMargin + sumOfWidth, nameRects.back().bottomY() + yMargin * 2).draw();
-			const auto sumRect = font(sumOfPrice).draw(priceRects.back().pos);
+			layout.sumLine.draw();
+			font(layout.sumOfPrice).draw(priceRects.back().pos);
 		}
 
 		// 要素の削除の描画
 		if (!textEditing())
 		{
 			const double deleteButtonSize = 20;
-			for (auto rowIndex : step(rowCount))
+			for (size_t rowIndex = rowBegin; rowIndex < rowEnd; ++rowIndex)
 			{
 				const RectF nameDeleteButton(Arg::topRight = nameRects[rowIndex].tr(), deleteButtonSize, nameRects[rowIndex].h);
 				if (nameDeleteButton.mouseOver())
@@ -644,18 +949,12 @@ public:
 		// 要素の追加
 		if (!textEditing())
 		{
-			auto intermedialPos = pos_ + Vec2(0, -yMargin);
-			for (auto itemIndex : step(rowCount + 1))
+			for (size_t itemIndex = rowBegin; itemIndex <= rowEnd; ++itemIndex)
 			{
-				if (1 <= itemIndex)
-				{
-					intermedialPos.y += namePriceHeight[itemIndex - 1];
-				}
-
-				RectF nameIntermedialRect(calcMaxNameWidth, yMargin * 2);
+				const auto intermedialY = layout.itemsPos.y - yMargin + layout.sumHeight[itemIndex];
 
-				const auto nameRect = RectF(intermedialPos.x, intermedialPos.y, calcMaxNameWidth, yMargin * 2).stretched(0, -xMargin, 0, 0);
-				const auto priceRect = RectF(intermedialPos.x + calcMaxNameWidth, intermedialPos.y, calcMaxPriceWidth, yMargin * 2).stretched(-xMargin, 0);
+				const auto nameRect = RectF(layout.itemsPos.x, intermedialY, calcMaxNameWidth, yMargin * 2).stretched(0, -xMargin, 0, 0);
+				const auto priceRect = RectF(layout.itemsPos.x + calcMaxNameWidth, intermedialY, calcMaxPriceWidth, yMargin * 2).stretched(-xMargin, 0);
 				const auto bothRect = RectF(Arg::topRight = nameRect.tr(), nameRect.w * 0.5, nameRect.h);
 				const auto bothRectDraw = RectF(nameRect.pos, calcMaxNameWidth + calcMaxPriceWidth, nameRect.h);
 
@@ -680,41 +979,49 @@ public:
 			}
 		}
 
+		const auto region = layout.region.movedBy(pos0);
+
 		if (operationOpt)
 		{
 			const auto& operation = operationOpt.value();
 
 			if (operation.operationType == EditRowOp::OperationType::Remove)
 			{
+				EditCommand command;
+				command.type = EditCommand::Type::RemoveRow;
+
+				Optional<size_t> physicalIndex;
 				switch (operation.columnType)
 				{
 				case EditRowOp::Name:
-					if (auto itemNamePtr = itemNameEdit.at(operation.rowIndex))
-					{
-						itemNamePtr->isVisible = false;
-					}
+					command.target = MarkType::Goods;
+					physicalIndex = itemNameEdit.toPhysicalIndex(operation.rowIndex);
 					break;
 				case EditRowOp::Price:
-					if (auto itemPricePtr = itemPriceEdit.at(operation.rowIndex))
-					{
-						itemPricePtr->isVisible = false;
-					}
+					command.target = MarkType::Price;
+					physicalIndex = itemPriceEdit.toPhysicalIndex(operation.rowIndex);
 					break;
 				case EditRowOp::Discount:
-					if (auto itemDiscountPtr = itemDiscountEdit.at(operation.rowIndex))
-					{
-						itemDiscountPtr->isVisible = false;
-					}
+					command.target = MarkType::Price;
+					command.subIndex = 1 + operation.subIndex;
+					physicalIndex = itemDiscountEdit.toPhysicalIndex(operation.rowIndex);
 					break;
 				default:
 					break;
 				}
+
+				if (physicalIndex)
+				{
+					command.index = physicalIndex.value();
+					redo(command);
+					pendingCommands.push_back(command);
+				}
 			}
 
 			operationOpt = none;
 		}
 
-		return RectF(pos0, sumOfWidth + xOuterMargin * 2, priceRects.back().bottomY() - pos0.y + yOuterMargin);
+		return region;
 	}
 
 	String id() const
@@ -729,18 +1036,19 @@ public:
 
 	String csvPath() const
 	{
-		return date.format(U"yyyy年MM月") + U".csv";
-	}
-
-	CSV openCSV() const
-	{
-		return CSV(csvPath());
+		return LedgerMonthPath(date);
 	}
 
 	// 品名, 値段, 店名, 購入日, 登録日時, レシートID
-	void writeData() const
+	// 戻り値は登録日時、同じレシートが登録済みで保存しなかった場合は none
+	// 月のファイル全体は読み書きせず、新しい行だけを末尾に追記する
+	// 書き込みは Ledger のスレッドで行い、終わったら version が変わる
+	Optional<String> writeData() const
 	{
-		auto csv = openCSV();
+		ScopedFrameTimer timer(FrameStage::CsvIO);
+		ScopedTrace trace(U"writeData", U"csv");
+
+		Array<Array<String>> rows;
 
 		const auto idStr = id();
 		const auto dateStr = buyDateFormat();
@@ -772,69 +1080,81 @@ public:
 
 			String priceStr = Format(price);
 
-			csv.writeRow(nameStr, priceStr, shopName, dateStr, nowStr, idStr);
+			rows.push_back({ nameStr, priceStr, shopName, dateStr, nowStr, idStr });
 		}
 
-		csv.save(csvPath());
-	}
-
-	void deleteByRegisterDate(const String& registerDate) const
-	{
-		auto readCsv = openCSV();
-		CSV writeCSV;
+		// 月の読み込みが終わるまでは登録済みかどうかを確かめられないので、保存しない
+		if (!Ledger::Instance().month(csvPath()))
+		{
+			Print << U"{} を読み込み中です。読み込みが終わってから保存してください"_fmt(csvPath());
+			return none;
+		}
 
-		for (auto i : step(readCsv.rows()))
+		// 同じレシートを読み取り直して保存した場合は、二重に計上しないよう保存しない
+		if (const auto registered = Ledger::Instance().findDuplicate(csvPath(), rows))
 		{
-			const auto row = readCsv.getRow(i);
-			if (Label::Size <= row.size())
+			Print << U"同じレシートが {} に登録済みです"_fmt(registered.value());
+			return none;
+		}
+
+		Ledger::Instance().append(csvPath(), rows, [path = csvPath()](bool succeeded)
 			{
-				if (row[Label::RegisterDate] != registerDate)
-				{
-					for (const auto& cell : row)
-					{
-						writeCSV.write(cell);
-					}
-					writeCSV.newLine();
-				}
-				else
+				if (!succeeded)
 				{
-					for (const auto& cell : row)
-					{
-						//Console << U"削除：" << cell;
-					}
+					Print << U"{} に保存できませんでした"_fmt(path);
 				}
-			}
-		}
+			});
 
-		writeCSV.save(csvPath());
+		return nowStr;
 	}
 
-	Array<Array<String>> searchData() const
+	// 削除済み印を追記するだけで、ファイルの書き直しは Ledger がまとめて行う
+	void deleteByRegisterDate(const String& registerDate) const
 	{
-		const auto csv = openCSV();
-		const auto searchID = buyDateFormat();
+		ScopedFrameTimer timer(FrameStage::CsvIO);
+		ScopedTrace trace(U"deleteByRegisterDate", U"csv");
 
-		Array<Array<String>> matchedRows;
-
-		for (auto i : step(csv.rows()))
-		{
-			const auto row = csv.getRow(i);
-			if (Label::Size <= row.size())
+		Ledger::Instance().removeByRegisterDate(csvPath(), registerDate, [path = csvPath()](bool succeeded)
 			{
-				if (row[Label::BuyDate] == searchID)
+				if (!succeeded)
 				{
-					matchedRows.push_back(row);
+					Print << U"{} から削除できませんでした"_fmt(path);
 				}
-			}
-		}
+			});
+	}
+
+	// 購入日が同じ行を返す
+	Array<Array<String>> searchData() const
+	{
+		ScopedFrameTimer timer(FrameStage::CsvIO);
 
-		return matchedRows;
+		return Ledger::Instance().rowsByBuyDate(csvPath(), buyDateFormat());
 	}
 
-	void drawGrid(const RectF& editRect, int marginX, int32 leftMargin, int32 topMargin, const Font& largeFont, const Vec2& buttonSize)
+	/// @param searchPanel 全レシートで共有する検索欄（レシートを切り替えたり、マークを付け直しても入力を残す）
+	/// @param rollupPanel 全レシートで共有する集計（購入日か家計簿が変わった時だけ集計し直す）
+	void drawGrid(const RectF& editRect, int marginX, int32 leftMargin, int32 topMargin, const Font& largeFont, const Vec2& buttonSize, LedgerSearchPanel& searchPanel, RollupPanel& rollupPanel)
 	{
+		ScopedFrameTimer timer(FrameStage::Grid);
+
+		// 保存・削除・読み込みが終わって家計簿が変わっていたら読み直す
+		if (ledgerVersion != Ledger::Instance().version(csvPath()))
+		{
+			reloadCSV();
+		}
+
 		const Vec2 textRect2Pos = editRect.tr() + Vec2(marginX, 0);
-		const RectF textRect2_ = RectF(textRect2Pos, Scene::Width() - leftMargin - textRect2Pos.x, Scene::Height() - topMargin * 2);
+		RectF textRect2_ = RectF(textRect2Pos, Scene::Width() - leftMargin - textRect2Pos.x, Scene::Height() - topMargin * 2);
+
+		// 幅に余裕がある時は、右端に検索欄と集計を表示する
+		if (RollupPanel::Width * 2 < textRect2_.w)
+		{
+			textRect2_.w -= RollupPanel::Width + marginX;
+
+			const RectF searchRect(textRect2_.tr() + Vec2(marginX, 0), RollupPanel::Width, LedgerSearchPanel::Height);
+			searchPanel.draw(searchRect, FontAsset(U"TableFont"));
+			rollupPanel.draw(RectF(searchRect.bl() + Vec2(0, 10), RollupPanel::Width, textRect2_.h - searchRect.h - 10), FontAsset(U"TableFont"), date);
+		}
 
 		{
 			const RectF textRect2 = textRect2_.stretched(-40);
@@ -864,13 +1184,20 @@ public:
 				{
 					if (updated.value())
 					{
-						writeData();
-						reloadCSV();
+						// 保存した行は編集中の表と同じ内容なので、書き込みの完了を待たずに登録データに加える
+						if (const auto registerDate = writeData())
+						{
+							tableDataList.emplace(registerDate.value(), temporaryData);
+							gridDirty = true;
+						}
 						saveButton.lateRelease();
 					}
 				}
 
-				temporaryData.draw(pos);
+				if (region2.intersects(textRect2))
+				{
+					temporaryData.draw(pos);
+				}
 				pos = region2.bl() + Vec2(0, 30);
 			}
 
@@ -885,10 +1212,21 @@ public:
 				pos = region2.bl() + Vec2(0, 10);
 			}
 
+			// 表示範囲に入る登録データだけを描画する
+			if (gridDirty || gridLabelHeight != largeFont.height())
+			{
+				updateGridOffsets(largeFont.height());
+			}
+
+			const double listTop = pos.y;
+			size_t dataIndex = std::upper_bound(gridOffsets.begin(), gridOffsets.end() - 1, textRect2.y - listTop) - gridOffsets.begin();
+			dataIndex = (dataIndex == 0) ? 0 : dataIndex - 1;
+
 			Optional<String> deleteRegisterDate;
-			for (const auto& [dataIndex, data] : Indexed(tableDataList))
+			for (; dataIndex < tableDataList.size() && listTop + gridOffsets[dataIndex] < textRect2.bottomY(); ++dataIndex)
 			{
-				const auto& [registerDate, tableData] = data;
+				const auto& [registerDate, tableData] = *std::next(tableDataList.begin(), dataIndex);
+				pos.y = listTop + gridOffsets[dataIndex];
 
 				if (2 <= tableData.rows())
 				{
@@ -906,16 +1244,14 @@ public:
 				}
 
 				tableRegion = RectF(textRect2.x, pos.y, textRect2.w, textRect2.h);
-
-				const auto region = tableData.region(tableRegion.pos);
 				tableData.draw(tableRegion.pos);
-				pos = region.bl() + Vec2(0, 10);
 			}
 
 			if (deleteRegisterDate)
 			{
 				deleteByRegisterDate(deleteRegisterDate.value());
-				reloadCSV();
+				tableDataList.erase(deleteRegisterDate.value());
+				gridDirty = true;
 			}
 		}
 
@@ -924,11 +1260,461 @@ public:
 
 private:
 
+	void updateGridOffsets(double labelHeight)
+	{
+		gridOffsets.clear();
+
+		double offset = 0.0;
+		for (const auto& [registerDate, tableData] : tableDataList)
+		{
+			gridOffsets.push_back(offset);
+
+			if (2 <= tableData.rows())
+			{
+				offset += labelHeight + 10;
+			}
+			offset += tableData.region().h + 10;
+		}
+		gridOffsets.push_back(offset);
+
+		gridLabelHeight = labelHeight;
+		gridDirty = false;
+	}
+
+	// 画面内に入る商品の行の範囲 [begin, end)
+	std::pair<size_t, size_t> visibleRowRange(double top, double bottom) const
+	{
+		const auto rowCount = layout.nameRects.size();
+		const auto first = layout.sumHeight.begin();
+		const auto last = layout.sumHeight.begin() + rowCount + 1;
+
+		const size_t upper = std::upper_bound(first, last, top - layout.itemsPos.y) - first;
+		const size_t begin = (upper == 0) ? 0 : upper - 1;
+		const size_t end = Min<size_t>(std::lower_bound(first, last, bottom - layout.itemsPos.y) - first, rowCount);
+
+		return { begin, Max(begin, end) };
+	}
+
+	static EditTextCell MakeTextCell(const String& str, const Font& font, const Vec2& pos, Color color, MarkType markType, size_t editIndex, size_t editIndex2, double width)
+	{
+		EditTextCell cell;
+		cell.text = str;
+		cell.wrappedText = WrapByWidth(font, str, width);
+		cell.region = font(cell.wrappedText).region(pos);
+		cell.width = width;
+		cell.color = color;
+		cell.markType = markType;
+		cell.editIndex = editIndex;
+		cell.editIndex2 = editIndex2;
+		return cell;
+	}
+
+	void updateLayout(const EditLayoutKey& key, const Font& font, const Point& textureTopLeft)
+	{
+		layout = EditLayout{};
+		layout.key = key;
+		layoutDirty = false;
+
+		const Vec2 pos0{ 0, 0 }; // draw() の pos0 を原点とする
+		const auto rowCount = visibleRowCount();
+
+		double sumOfTexHeight = 0.0;
+		int32 numOfTexHeight = 0;
+		for (auto rowIndex : step(rowCount))
+		{
+			if (auto nameEditPtr = itemNameEdit.at(rowIndex))
+			{
+				if (!nameEditPtr->isNameTexEmpty())
+				{
+					sumOfTexHeight += nameEditPtr->nameTexRegion.h;
+					++numOfTexHeight;
+				}
+			}
+			if (auto priceEditPtr = itemPriceEdit.at(rowIndex))
+			{
+				if (!priceEditPtr->isPriceTexEmpty())
+				{
+					sumOfTexHeight += priceEditPtr->priceTexRegion.h;
+					++numOfTexHeight;
+				}
+			}
+		}
+
+		const double averageTexHeight = sumOfTexHeight / numOfTexHeight;
+		const double drawScale = 0.8 * font.height() / averageTexHeight;
+		layout.drawScale = drawScale;
+
+		const int32 maxNameWidth = 300;
+		const int32 maxPriceWidth = 80;
+
+		const int xMargin = 10;
+		const int yMargin = 12;
+		const int yInnerMargin = 8;
+
+		const int xOuterMargin = 40;
+		const int yOuterMargin = 50;
+
+		Array<double> nameWidth;
+		Array<double> priceWidth;
+		Array<double> namePriceHeight;
+
+		Array<Array<double>> discountWidth;
+
+		size_t maxDiscountIndex = 0;
+		int32 sumOfPrice = 0;
+		for (auto rowIndex : step(rowCount))
+		{
+			double maxHeight = 0;
+
+			if (auto nameEditPtr = itemNameEdit.at(rowIndex); nameEditPtr && nameEditPtr->isData)
+			{
+				const auto nameStrRegion = font(WrapByWidth(font, nameEditPtr->name, maxNameWidth - xMargin)).region();
+				const auto nameTexSize = nameEditPtr->nameTexRegion.size * drawScale;
+				nameWidth.push_back(Max(nameStrRegion.w, nameTexSize.x) + xMargin);//一番左端だけ空けないのでマージンは1つ分
+				maxHeight = Max(maxHeight, nameStrRegion.h + nameTexSize.y);
+			}
+			else // 末尾以降 or ダミー
+			{
+				nameWidth.push_back(0);
+			}
+
+			if (auto priceEditPtr = itemPriceEdit.at(rowIndex); priceEditPtr && priceEditPtr->isData)
+			{
+				const auto priceStrRegion = font(WrapByWidth(font, Format(priceEditPtr->price), maxPriceWidth - xMargin * 2)).region();
+				const auto priceTexSize = priceEditPtr->priceTexRegion.size * drawScale;
+				priceWidth.push_back(Max(priceStrRegion.w, priceTexSize.x) + xMargin * 2);
+				maxHeight = Max(maxHeight, priceStrRegion.h + priceTexSize.y);
+
+				sumOfPrice += priceEditPtr->price;
+			}
+			else // 末尾以降 or ダミー
+			{
+				priceWidth.push_back(0);
+			}
+
+			if (auto discountEditPtr = itemDiscountEdit.at(rowIndex); discountEditPtr && discountEditPtr->isData)
+			{
+				Array<double> currentWidth;
+
+				for (const auto& [discountIndex, discount] : Indexed(discountEditPtr->discount))
+				{
+					const auto discountStrRegion = font(WrapByWidth(font, Format(discount), maxPriceWidth - xMargin * 2)).region();
+					const auto discountTexSize = discountEditPtr->discountTexRegion[discountIndex].size * drawScale;
+					currentWidth.push_back(Max(discountStrRegion.w, discountTexSize.x) + xMargin * 2);
+					maxHeight = Max(maxHeight, discountStrRegion.h + discountTexSize.y);
+
+					sumOfPrice += discount;
+					maxDiscountIndex = Max(maxDiscountIndex, discountIndex);
+				}
+
+				discountWidth.push_back(currentWidth);
+			}
+			else
+			{
+				Array<double> currentWidth;
+				discountWidth.push_back(currentWidth);
+			}
+
+			namePriceHeight.push_back(maxHeight + yInnerMargin + yMargin * 2);
+		}
+
+		// 合計額
+		{
+			const auto priceStrRegion = font(WrapByWidth(font, Format(sumOfPrice), maxPriceWidth - xMargin * 2)).region();
+			priceWidth.push_back(priceStrRegion.w + xMargin * 2);
+			namePriceHeight.push_back(priceStrRegion.h + yMargin * 2);
+		}
+
+		const double calcMaxNameWidth = *std::max_element(nameWidth.begin(), nameWidth.end());
+		const double calcMaxPriceWidth = *std::max_element(priceWidth.begin(), priceWidth.end());
+
+		// 各列の最大幅を計算
+		Array<double> calcMaxDiscountWidth(maxDiscountIndex + 1, 0.0);
+		for (const auto& [itemIndex, itemDiscounts] : Indexed(discountWidth))
+		{
+			for (const auto& [discountIndex, width] : Indexed(itemDiscounts))
+			{
+				calcMaxDiscountWidth[discountIndex] = Max(calcMaxDiscountWidth[discountIndex], width);
+			}
+		}
+
+		Array<double> sumHeight(1, 0);
+		std::partial_sum(namePriceHeight.begin(), namePriceHeight.end(), std::back_inserter(sumHeight));
+
+		const double sumOfWidth = calcMaxNameWidth + calcMaxPriceWidth + calcMaxDiscountWidth.sum();
+
+		int32 maxWidth = sumOfWidth;
+
+		Vec2 pos_ = pos0 + Vec2(xOuterMargin, yOuterMargin);
+		{
+			layout.shopNameCell = MakeTextCell(shopName, font, pos_, Palette::Orange.withAlpha(255), MarkType::ShopName, 0, 0, maxWidth);
+			pos_ = layout.shopNameCell.region.bl() + Vec2(0, yMargin * 2);
+		}
+		{
+			pos_ += Vec2(0, yMargin);
+			const int32 values[] = { date.year, date.month, date.day, hours, minutes };
+			const double widths[] = { 60, 30, 30, 30, 30 };
+			const StringView labels[] = { U"年", U"月", U"日", U"時", U"分" };
+
+			Vec2 cellPos = pos_;
+			for (size_t i = 0; i < std::size(values); ++i)
+			{
+				layout.dateCells.push_back(MakeTextCell(Format(values[i]), font, cellPos, Palette::Greenyellow.withAlpha(255), MarkType::Date, i, 0, widths[i]));
+				const auto labelRegion = font(labels[i]).region(layout.dateCells.back().region.tr() + Vec2(10, 0));
+				layout.dateLabels.emplace_back(String{ labels[i] }, labelRegion.pos);
+				cellPos = labelRegion.tr() + Vec2(10, 0);
+			}
+			pos_ = layout.dateCells.front().region.bl() + Vec2(0, yMargin * 2);
+		}
+
+		for (auto itemIndex : step(rowCount))
+		{
+			const auto nameRect = RectF(pos_.x, pos_.y + sumHeight[itemIndex], calcMaxNameWidth, namePriceHeight[itemIndex]).stretched(-yMargin, -xMargin, -yMargin, 0);
+			const auto priceRect = RectF(pos_.x + calcMaxNameWidth, pos_.y + sumHeight[itemIndex], calcMaxPriceWidth, namePriceHeight[itemIndex]).stretched(-xMargin, -yMargin);
+
+			layout.nameRects.push_back(nameRect);
+			layout.priceRects.push_back(priceRect);
+
+			if (auto nameEditPtr = itemNameEdit.at(itemIndex); nameEditPtr && nameEditPtr->isData)
+			{
+				auto cell = MakeTextCell(nameEditPtr->name, font, nameRect.pos, Palette::Lime.withAlpha(255), MarkType::Goods, itemIndex, 0, calcMaxNameWidth - xMargin);
+				cell.texRegion = nameEditPtr->nameTexRegion;
+				layout.nameCells.push_back(cell);
+			}
+			else
+			{
+				layout.nameCells.push_back(none);
+			}
+
+			if (auto priceEditPtr = itemPriceEdit.at(itemIndex); priceEditPtr && priceEditPtr->isData)
+			{
+				auto cell = MakeTextCell(Format(priceEditPtr->price), font, priceRect.pos, Palette::Cyan.withAlpha(255), MarkType::Price, itemIndex, 0, calcMaxPriceWidth - xMargin * 2);
+				cell.texRegion = priceEditPtr->priceTexRegion;
+				layout.priceCells.push_back(cell);
+			}
+			else
+			{
+				layout.priceCells.push_back(none);
+			}
+
+			Array<EditTextCell> discountCells;
+			if (auto discountEditPtr = itemDiscountEdit.at(itemIndex); discountEditPtr && discountEditPtr->isData)
+			{
+				for (const auto& [discountIndex, discount] : Indexed(discountEditPtr->discount))
+				{
+					const auto discountRect = RectF(
+						pos_.x + calcMaxNameWidth + calcMaxPriceWidth,
+						pos_.y + sumHeight[itemIndex],
+						calcMaxDiscountWidth[discountIndex],
+						namePriceHeight[itemIndex]).stretched(-xMargin, -yMargin);
+
+					auto cell = MakeTextCell(Format(discount), font, discountRect.pos, Palette::Cyan.withAlpha(255), MarkType::Price, itemIndex, 1 + discountIndex, calcMaxDiscountWidth[discountIndex] - xMargin * 2);
+					cell.texRegion = discountEditPtr->discountTexRegion[discountIndex];
+					discountCells.push_back(cell);
+				}
+			}
+			layout.discountCells.push_back(discountCells);
+		}
+
+		// 合計額
+		{
+			const auto priceRect = RectF(pos_.x + calcMaxNameWidth, pos_.y + sumHeight[rowCount] + yMargin * 2, calcMaxPriceWidth, namePriceHeight[rowCount]).stretched(-xMargin, -yMargin);
+			layout.priceRects.push_back(priceRect);
+
+			const double lineY = layout.nameRects.back().bottomY() + yMargin * 2;
+			layout.sumLine = Line(pos0.x + xOuterMargin, lineY, pos0.x + xOuterMargin + sumOfWidth, lineY);
+			layout.sumOfPrice = sumOfPrice;
+		}
+
+		layout.sumHeight = sumHeight;
+		layout.itemsPos = pos_;
+		layout.calcMaxNameWidth = calcMaxNameWidth;
+		layout.calcMaxPriceWidth = calcMaxPriceWidth;
+		layout.region = RectF(pos0, sumOfWidth + xOuterMargin * 2, layout.priceRects.back().bottomY() - pos0.y + yOuterMargin);
+	}
+
+	Optional<String> getText(MarkType target, size_t index, size_t subIndex) const
+	{
+		switch (target)
+		{
+		case MarkType::ShopName:
+			return shopName;
+		case MarkType::Date:
+		{
+			const int32 values[] = { date.year, date.month, date.day, hours, minutes };
+			if (index < std::size(values))
+			{
+				return Format(values[index]);
+			}
+			return none;
+		}
+		case MarkType::Goods:
+			if (auto nameEditPtr = itemNameEdit.physical(index))
+			{
+				return nameEditPtr->name;
+			}
+			return none;
+		case MarkType::Price:
+			if (subIndex == 0)
+			{
+				if (auto priceEditPtr = itemPriceEdit.physical(index))
+				{
+					return Format(priceEditPtr->price);
+				}
+			}
+			else if (auto discountEditPtr = itemDiscountEdit.physical(index); discountEditPtr && subIndex - 1 < discountEditPtr->discount.size())
+			{
+				return Format(discountEditPtr->discount[subIndex - 1]);
+			}
+			return none;
+		default:
+			return none;
+		}
+	}
+
+	bool setText(MarkType target, size_t index, size_t subIndex, const String& text)
+	{
+		switch (target)
+		{
+		case MarkType::ShopName:
+			shopName = text;
+			updateTemporary(0);
+			return true;
+		case MarkType::Date:
+			if (auto opt = ParseIntOpt<int32>(text, 10))
+			{
+				switch (index)
+				{
+				case 0:
+					date.year = opt.value();
+					break;
+				case 1:
+					date.month = opt.value();
+					break;
+				case 2:
+					date.day = opt.value();
+					break;
+				case 3:
+					hours = opt.value();
+					break;
+				case 4:
+					minutes = opt.value();
+					break;
+				default:
+					return false;
+				}
+				reloadCSV();
+				return true;
+			}
+			return false;
+		case MarkType::Goods:
+			if (auto nameEditPtr = itemNameEdit.physical(index))
+			{
+				nameEditPtr->name = text;
+				updateTemporaryRow(itemNameEdit.toVisibleIndex(index));
+				return true;
+			}
+			return false;
+		case MarkType::Price:
+			if (auto opt = ParseIntOpt<int32>(text, 10))
+			{
+				if (subIndex == 0)
+				{
+					if (auto priceEditPtr = itemPriceEdit.physical(index))
+					{
+						priceEditPtr->price = opt.value();
+						updateTemporaryRow(itemPriceEdit.toVisibleIndex(index));
+						return true;
+					}
+				}
+				else if (auto discountEditPtr = itemDiscountEdit.physical(index); discountEditPtr && subIndex - 1 < discountEditPtr->discount.size())
+				{
+					discountEditPtr->discount[subIndex - 1] = opt.value();
+					updateTemporaryRow(itemDiscountEdit.toVisibleIndex(index));
+					return true;
+				}
+			}
+			return false;
+		default:
+			return false;
+		}
+	}
+
+	Array<String> temporaryRow(size_t rowIndex, const String& dateStr) const
+	{
+		auto nameEditPtr = itemNameEdit.at(rowIndex);
+		auto priceEditPtr = itemPriceEdit.at(rowIndex);
+		auto discountEditPtr = itemDiscountEdit.at(rowIndex);
+
+		int32 price = priceEditPtr ? priceEditPtr->price : 0;
+		if (discountEditPtr)
+		{
+			for (const auto& v : discountEditPtr->discount)
+			{
+				price += v;
+			}
+		}
+
+		const auto nameStr = nameEditPtr ? nameEditPtr->name : U"";
+		const auto priceStr = Format(price);
+
+		return { nameStr, priceStr, shopName, dateStr };
+	}
+
+	void updateTemporaryRow(const Optional<size_t>& rowIndex)
+	{
+		if (rowIndex)
+		{
+			updateTemporary(rowIndex.value(), rowIndex.value() + 1);
+		}
+	}
+
+	void applyCommand(const EditCommand& command, bool isUndo)
+	{
+		switch (command.type)
+		{
+		case EditCommand::Type::EditText:
+			setText(command.target, command.index, command.subIndex, isUndo ? command.before : command.after);
+			break;
+		case EditCommand::Type::RemoveRow:
+		{
+			// 削除・復元した行以降は表示上の行がずれる
+			size_t visibleIndex = 0;
+			if (command.target == MarkType::Goods)
+			{
+				itemNameEdit.setVisible(command.index, isUndo);
+				visibleIndex = itemNameEdit.countVisibleBefore(command.index);
+			}
+			else if (command.subIndex == 0)
+			{
+				itemPriceEdit.setVisible(command.index, isUndo);
+				visibleIndex = itemPriceEdit.countVisibleBefore(command.index);
+			}
+			else
+			{
+				itemDiscountEdit.setVisible(command.index, isUndo);
+				visibleIndex = itemDiscountEdit.countVisibleBefore(command.index);
+			}
+			updateTemporary(visibleIndex);
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
 	OrderedTable<String, SimpleTable, Greater<String>> tableDataList; // 登録日時→登録データ
 	SimpleTable temporaryData;
-	Array<Texture> writeIcons = { Texture(U"💾"_emoji),Texture(U"🗑️"_emoji) };
-	TileButton saveButton = { 0xf0c7_icon, 15, Palette1, Palette::Skyblue };
-	TileButton deleteButton = { 0xf1f8_icon, 15, Palette1, Palette::Skyblue };
+	// アイコンは RegisterAppAssets() で登録したものをすべてのレシートで共有し、ここでは押下状態だけを持つ
+	TileButton saveButton = { U"ButtonIcon.Save", 15, Palette1, Palette::Skyblue };
+	TileButton deleteButton = { U"ButtonIcon.Delete", 15, Palette1, Palette::Skyblue };
 	double gridScroll = 0;
 	TextEditor textEdit;
+	EditLayout layout;
+	bool layoutDirty = true;
+	Array<double> gridOffsets; // 登録データの表ごとの一覧内での上端位置（末尾は一覧全体の高さ）
+	double gridLabelHeight = 0.0;
+	bool gridDirty = true;
+	uint64 ledgerVersion = 0; // tableDataList を作った時の Ledger::version
+	Array<EditCommand> pendingCommands; // 未回収の編集操作
 };
\ No newline at end of file
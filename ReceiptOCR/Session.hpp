@@ -0,0 +1,340 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <cstring>
+#include "LedgerFile.hpp"
+#include "Ledger.hpp"
+
+// セッションファイルに書く値を並べる
+struct SessionWriter
+{
+	std::string bytes;
+
+	template <class Type>
+	void write(Type value)
+	{
+		static_assert(std::is_trivially_copyable_v<Type>);
+		char buffer[sizeof(Type)];
+		std::memcpy(buffer, &value, sizeof(Type));
+		bytes.append(buffer, sizeof(Type));
+	}
+
+	void write(const String& str)
+	{
+		const auto utf8 = Unicode::ToUTF8(str);
+		write(static_cast<uint32>(utf8.size()));
+		bytes.append(utf8);
+	}
+
+	void write(const Vec2& v)
+	{
+		write(v.x);
+		write(v.y);
+	}
+
+	void write(const Point& p)
+	{
+		write(p.x);
+		write(p.y);
+	}
+
+	void write(const Rect& rect)
+	{
+		write(rect.pos);
+		write(rect.size);
+	}
+
+	void write(const RectF& rect)
+	{
+		write(rect.pos);
+		write(rect.size);
+	}
+
+	void write(const Array<Vec2>& points)
+	{
+		write(static_cast<uint32>(points.size()));
+		for (const auto& p : points)
+		{
+			write(p);
+		}
+	}
+};
+
+// SessionWriter で並べた値を読む
+// 足りない場合は ok を false にして、以降は既定値を返す
+struct SessionReader
+{
+	std::string_view bytes;
+	size_t pos = 0;
+	bool ok = true;
+
+	template <class Type>
+	Type read()
+	{
+		static_assert(std::is_trivially_copyable_v<Type>);
+		Type value{};
+		if (!ok || bytes.size() < pos + sizeof(Type))
+		{
+			ok = false;
+			return value;
+		}
+		std::memcpy(&value, bytes.data() + pos, sizeof(Type));
+		pos += sizeof(Type);
+		return value;
+	}
+
+	/// @brief 要素数を読みます。残りのバイト数より多い場合は壊れているものとして 0 を返します。
+	size_t readCount()
+	{
+		const auto count = read<uint32>();
+		if (bytes.size() - pos < count)
+		{
+			ok = false;
+			return 0;
+		}
+		return count;
+	}
+
+	String readString()
+	{
+		const auto length = readCount();
+		const auto str = Unicode::FromUTF8(bytes.substr(pos, length));
+		pos += length;
+		return str;
+	}
+
+	Vec2 readVec2()
+	{
+		const auto x = read<double>();
+		return{ x, read<double>() };
+	}
+
+	Point readPoint()
+	{
+		const auto x = read<int32>();
+		return{ x, read<int32>() };
+	}
+
+	Rect readRect()
+	{
+		const auto topLeft = readPoint();
+		return{ topLeft, readPoint() };
+	}
+
+	RectF readRectF()
+	{
+		const auto topLeft = readVec2();
+		return{ topLeft, readVec2() };
+	}
+
+	Array<Vec2> readVec2s()
+	{
+		Array<Vec2> points(readCount());
+		for (auto& p : points)
+		{
+			p = readVec2();
+		}
+		return points;
+	}
+};
+
+// SessionFile::write() に渡す、前回から変わった記録
+struct SessionChanges
+{
+	size_t recordCount = 0; // 記録の数
+	Array<std::pair<uint32, std::string>> records; // 変わった記録の番号と内容
+};
+
+// 編集中の状態を記録の並びとして保存するファイル
+// ファイルは [Magic][記録数] の後に [長さ][番号][チェックサム][内容] の記録を追記していく
+// 同じ番号の記録は後のものが有効で、途中で切れた記録と壊れた記録から後は読まない
+// write() は渡された記録だけを LedgerIOThread で追記する
+// 記録数が変わった時と、追記した量が有効な記録の数倍になった時は、ReplaceFileAtomic で書き直して詰める
+// メインスレッドからのみ使う
+class SessionFile
+{
+public:
+
+	explicit SessionFile(FilePathView path)
+		: m_path{ path } {}
+
+	/// @brief 前回から変わった記録を渡し、裏で書き込みます。渡さなかった記録は前回の内容のままにします。
+	/// 記録の数を増やす場合は、増えた記録をすべて渡します。
+	void write(SessionChanges changes)
+	{
+		const bool resized = (changes.recordCount != m_written.size());
+		m_written.resize(changes.recordCount);
+
+		std::string out;
+		for (auto& [index, record] : changes.records)
+		{
+			if (changes.recordCount <= index || record == m_written[index])
+			{
+				continue;
+			}
+
+			m_liveBytes += record.size();
+			m_liveBytes -= m_written[index].size();
+			AppendRecord(out, index, record);
+			m_written[index] = std::move(record);
+		}
+
+		if (m_rewrite || resized || (CompactionRatio * m_liveBytes + CompactionSlack) < m_appendedBytes + out.size())
+		{
+			out.clear();
+			WriteValue(out, Magic);
+			WriteValue(out, static_cast<uint32>(m_written.size()));
+			for (uint32 index = 0; index < m_written.size(); ++index)
+			{
+				AppendRecord(out, index, m_written[index]);
+			}
+
+			m_liveBytes = out.size();
+			m_appendedBytes = 0;
+			m_rewrite = false;
+			post(std::move(out), true);
+			return;
+		}
+
+		if (out.empty())
+		{
+			return;
+		}
+
+		m_appendedBytes += out.size();
+		post(std::move(out), false);
+	}
+
+	/// @brief 書き込みの失敗を知らせます。メインスレッドで毎フレーム呼びます。
+	void update()
+	{
+		m_io.drain();
+	}
+
+	/// @brief 投入済みの書き込みがすべて終わるまで待ちます。
+	void waitIdle()
+	{
+		m_io.waitIdle();
+	}
+
+	/// @brief ファイルを読み、番号ごとの最新の記録を返します。
+	/// @return ファイルが無いか、記録が揃っていない場合 none
+	static Optional<Array<std::string>> Load(FilePathView path)
+	{
+		const auto bytes = ReadLedgerBytes(path);
+
+		SessionReader reader{ bytes };
+		if (reader.read<uint32>() != Magic)
+		{
+			return none;
+		}
+
+		const auto recordCount = reader.readCount();
+		if (!reader.ok)
+		{
+			return none;
+		}
+
+		Array<std::string> records(recordCount);
+		Array<bool> found(recordCount, false);
+		while (reader.pos < bytes.size())
+		{
+			const auto length = reader.readCount();
+			const auto index = reader.read<uint32>();
+			const auto hash = reader.read<uint64>();
+			if (!reader.ok || recordCount <= index || bytes.size() - reader.pos < length)
+			{
+				break;
+			}
+
+			const auto record = std::string_view{ bytes }.substr(reader.pos, length);
+			if (Hash(index, record) != hash)
+			{
+				break;
+			}
+
+			records[index] = record;
+			found[index] = true;
+			reader.pos += length;
+		}
+
+		if (!found.all())
+		{
+			return none;
+		}
+		return records;
+	}
+
+private:
+
+	static constexpr uint32 Magic = 0x31535352; // "RSS1"
+
+	// 追記した量が有効な記録の CompactionRatio 倍 + CompactionSlack を超えたら書き直す
+	static constexpr size_t CompactionRatio = 4;
+	static constexpr size_t CompactionSlack = (1 << 20);
+
+	template <class Type>
+	static void WriteValue(std::string& out, Type value)
+	{
+		char buffer[sizeof(Type)];
+		std::memcpy(buffer, &value, sizeof(Type));
+		out.append(buffer, sizeof(Type));
+	}
+
+	static void AppendRecord(std::string& out, uint32 index, std::string_view record)
+	{
+		WriteValue(out, static_cast<uint32>(record.size()));
+		WriteValue(out, index);
+		WriteValue(out, Hash(index, record));
+		out.append(record);
+	}
+
+	// FNV-1a
+	static uint64 Hash(uint32 index, std::string_view record)
+	{
+		uint64 hash = 14695981039346656037ull ^ index;
+		for (const char ch : record)
+		{
+			hash = (hash ^ static_cast<uint8>(ch)) * 1099511628211ull;
+		}
+		return hash;
+	}
+
+	void post(std::string bytes, bool replace)
+	{
+		m_io.post([this, path = m_path, bytes = std::move(bytes), replace]() -> std::function<void()>
+			{
+				bool succeeded = false;
+				if (replace)
+				{
+					succeeded = ReplaceFileAtomic(path, bytes);
+				}
+				else if (const auto fp = OpenLedgerFile(path, "ab"))
+				{
+					succeeded = WriteLedgerBytes(fp.get(), bytes) && (std::fflush(fp.get()) == 0);
+				}
+
+				if (succeeded)
+				{
+					return{};
+				}
+
+				// 次の write() で全体を書き直す
+				return [this, path]
+					{
+						m_rewrite = true;
+						Console << U"{} に書き込めませんでした"_fmt(path);
+					};
+			});
+	}
+
+	FilePath m_path;
+
+	// 最後に書き込みを投入した記録（書き直す時に使う）
+	Array<std::string> m_written;
+	size_t m_liveBytes = 0;
+	size_t m_appendedBytes = 0;
+	bool m_rewrite = true;
+
+	// 最後に宣言して最初に破棄し、残りの書き込みを終えてから止める
+	LedgerIOThread m_io;
+};
@@ -0,0 +1,217 @@
+﻿#pragma once
+#include <Siv3D.hpp> // Siv3D v0.6.15
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Chrome のトレースイベント形式 (chrome://tracing, Perfetto) で処理区間を記録する
+// 記録はスレッドごとのバッファに書き込むだけなので、複数スレッドから同時に呼んでもロックを取らない
+// start() ごとに異なる記録の開始時刻を、記録の世代としても使う
+// バッファを空にするのは持ち主のスレッドだけで、世代の変わった後の最初の record() で行う
+class TraceRecorder
+{
+public:
+
+	// name, category には文字列リテラルを渡す（ポインタのまま保持する）
+	struct Event
+	{
+		const char32_t* name = nullptr;
+		const char32_t* category = nullptr;
+		uint64 beginUs = 0;
+		uint64 durationUs = 0;
+	};
+
+	// 1 スレッドあたりの最大イベント数、超えた分は捨てる
+	static constexpr size_t ThreadCapacity = 1 << 16;
+
+	static TraceRecorder& Instance()
+	{
+		static TraceRecorder instance;
+		return instance;
+	}
+
+	static bool Enabled()
+	{
+		return s_enabled.load(std::memory_order_acquire);
+	}
+
+	/// @brief 記録を開始します。以前の記録は破棄されます。
+	/// 呼び出したスレッドをメインスレッドとして書き出します。
+	void start()
+	{
+		std::lock_guard lock{ m_mutex };
+		m_mainThread = std::this_thread::get_id();
+		m_originUs.store(Time::GetMicrosec(), std::memory_order_release);
+		s_enabled.store(true, std::memory_order_release);
+	}
+
+	void stop()
+	{
+		s_enabled.store(false, std::memory_order_release);
+	}
+
+	/// @brief 今の記録の開始時刻（記録の世代）を返します。
+	uint64 origin() const
+	{
+		return m_originUs.load(std::memory_order_acquire);
+	}
+
+	/// @brief 開始時刻が origin の記録にイベントを追加します。その後に start() を呼んでいた場合は捨てます。
+	/// @param origin イベントの開始時刻を測った時の origin()
+	void record(const Event& event, uint64 origin)
+	{
+		if (origin != m_originUs.load(std::memory_order_acquire))
+		{
+			return;
+		}
+
+		auto& buffer = LocalBuffer();
+		if (buffer.origin.load(std::memory_order_relaxed) != origin)
+		{
+			// このスレッドの新しい記録の最初のイベント。前の記録を捨ててから世代を書き換える
+			buffer.count.store(0, std::memory_order_relaxed);
+			buffer.dropped.store(0, std::memory_order_relaxed);
+			buffer.origin.store(origin, std::memory_order_release);
+		}
+
+		const size_t count = buffer.count.load(std::memory_order_relaxed);
+		if (ThreadCapacity <= count)
+		{
+			buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		buffer.events[count] = event;
+		buffer.count.store(count + 1, std::memory_order_release);
+	}
+
+	/// @brief 記録済みのイベントを JSON で保存します。記録中に呼んでも、その時点までのイベントを書き出します。
+	bool saveJSON(FilePathView path) const
+	{
+		TextWriter writer{ path };
+		if (not writer)
+		{
+			return false;
+		}
+
+		writer.writeln(U"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+		bool first = true;
+		std::lock_guard lock{ m_mutex };
+		const uint64 origin = m_originUs.load(std::memory_order_acquire);
+		for (const auto& buffer : m_buffers)
+		{
+			// まだ今の記録のイベントを書いていないバッファは、前の記録が残っているので書き出さない
+			const bool current = (buffer->origin.load(std::memory_order_acquire) == origin);
+
+			writer.write(first ? U"" : U",\n");
+			const String threadName = (buffer->owner == m_mainThread) ? U"main" : U"worker {}"_fmt(buffer->threadID);
+			writer.write(U"{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":\"{}\"}}}}"_fmt(buffer->threadID, threadName));
+			first = false;
+
+			const size_t count = (current ? buffer->count.load(std::memory_order_acquire) : 0);
+			for (size_t i = 0; i < count; ++i)
+			{
+				const auto& event = buffer->events[i];
+				writer.write(U",\n{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{},\"dur\":{},\"pid\":1,\"tid\":{}}}"_fmt(
+					Escape(event.name), Escape(event.category), event.beginUs, event.durationUs, buffer->threadID));
+			}
+
+			if (const auto dropped = (current ? buffer->dropped.load(std::memory_order_relaxed) : 0))
+			{
+				Console << U"trace: thread {} で {} 件のイベントを破棄しました"_fmt(buffer->threadID, dropped);
+			}
+		}
+
+		writer.writeln(U"\n]}");
+		return true;
+	}
+
+private:
+
+	struct ThreadBuffer
+	{
+		uint32 threadID = 0;
+		std::thread::id owner; // バッファに書き込むスレッド
+		std::unique_ptr<Event[]> events = std::make_unique<Event[]>(ThreadCapacity);
+		std::atomic<uint64> origin = 0; // count と events が属する記録の開始時刻
+		std::atomic<size_t> count = 0;
+		std::atomic<size_t> dropped = 0;
+	};
+
+	TraceRecorder() = default;
+
+	// バッファの登録はスレッドごとに一度だけ行う
+	// 終了したスレッドのバッファも書き出せるように、所有権はレコーダーが持つ
+	ThreadBuffer& LocalBuffer()
+	{
+		thread_local ThreadBuffer* buffer = nullptr;
+		if (!buffer)
+		{
+			std::lock_guard lock{ m_mutex };
+			auto& newBuffer = m_buffers.emplace_back(std::make_unique<ThreadBuffer>());
+			newBuffer->threadID = static_cast<uint32>(m_buffers.size() - 1);
+			newBuffer->owner = std::this_thread::get_id();
+			buffer = newBuffer.get();
+		}
+		return *buffer;
+	}
+
+	static String Escape(const char32_t* str)
+	{
+		String result;
+		for (const char32_t* p = str; *p; ++p)
+		{
+			if (*p == U'"' || *p == U'\\')
+			{
+				result.push_back(U'\\');
+			}
+			result.push_back(*p);
+		}
+		return result;
+	}
+
+	inline static std::atomic<bool> s_enabled = false;
+
+	mutable std::mutex m_mutex;
+	std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+	std::thread::id m_mainThread; // start() を呼んだスレッド
+	std::atomic<uint64> m_originUs = 0; // 今の記録の開始時刻
+};
+
+// スコープを抜けるまでを 1 つのイベントとして記録する
+// 記録していない時はフラグを 1 回読むだけ
+// 開始時刻は構築時の記録の開始時刻からの経過時間で持ち、途中で記録をやり直した場合は捨てる
+class ScopedTrace
+{
+public:
+
+	ScopedTrace(const char32_t* name, const char32_t* category)
+	{
+		if (TraceRecorder::Enabled())
+		{
+			m_event.name = name;
+			m_event.category = category;
+			m_originUs = TraceRecorder::Instance().origin();
+			m_event.beginUs = Time::GetMicrosec() - m_originUs;
+		}
+	}
+
+	~ScopedTrace()
+	{
+		if (m_event.name && TraceRecorder::Enabled())
+		{
+			m_event.durationUs = Time::GetMicrosec() - m_originUs - m_event.beginUs;
+			TraceRecorder::Instance().record(m_event, m_originUs);
+		}
+	}
+
+	ScopedTrace(const ScopedTrace&) = delete;
+	ScopedTrace& operator=(const ScopedTrace&) = delete;
+
+private:
+
+	TraceRecorder::Event m_event;
+	uint64 m_originUs = 0;
+};
@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include <iostream>
 #include <vector>
+#include <deque>
 #include <numeric>
 #include <Siv3D.hpp> // Siv3D v0.6.15
 
@@ -71,16 +72,389 @@ private:
 	std::vector<int> m_parents;
 };
 
+class FenwickTree
+{
+public:
+
+	FenwickTree() = default;
+
+	/// @brief すべての値が 0 の Fenwick 木を構築します。
+	/// @param n 要素数
+	explicit FenwickTree(size_t n)
+		: m_tree(n + 1, 0) {}
+
+	/// @brief 要素数を返します。
+	size_t size() const
+	{
+		return m_tree.size() - 1;
+	}
+
+	/// @brief 末尾に要素を追加します。
+	/// @param value 追加する要素の値
+	void push_back(int64 value)
+	{
+		// 新しいノード i は区間 (i - lowbit(i), i] の和を持つので、既存の部分和から求める
+		const size_t i = m_tree.size();
+		const size_t lowbit = i & (~i + 1);
+		m_tree.push_back(value + prefixSum(i - 1) - prefixSum(i - lowbit));
+	}
+
+	/// @brief 要素 i に delta を加算します。
+	/// @param i 要素のインデックス
+	/// @param delta 加算する値
+	void add(size_t i, int64 delta)
+	{
+		for (++i; i < m_tree.size(); i += (i & (~i + 1)))
+		{
+			m_tree[i] += delta;
+		}
+	}
+
+	/// @brief 先頭 n 要素の和を返します。
+	/// @param n 要素数
+	int64 prefixSum(size_t n) const
+	{
+		int64 sum = 0;
+		for (; 0 < n; n -= (n & (~n + 1)))
+		{
+			sum += m_tree[n];
+		}
+		return sum;
+	}
+
+	/// @brief 先頭からの和が k を超える最小のインデックスを返します。各要素が非負である必要があります。
+	/// @param k 探索する和
+	/// @return 該当するインデックス、存在しない場合は size()
+	size_t upperBound(int64 k) const
+	{
+		size_t pos = 0;
+		size_t step = 1;
+		while (step * 2 < m_tree.size())
+		{
+			step *= 2;
+		}
+
+		for (; 0 < step; step /= 2)
+		{
+			if (pos + step < m_tree.size() && m_tree[pos + step] <= k)
+			{
+				pos += step;
+				k -= m_tree[pos];
+			}
+		}
+
+		return pos;
+	}
+
+private:
+
+	// m_tree[i] は区間 (i - lowbit(i), i] の和,
+	// m_tree[0] は番兵
+	std::vector<int64> m_tree = std::vector<int64>(1, 0);
+};
+
+template <class Command>
+class EditHistory
+{
+public:
+
+	EditHistory() = default;
+
+	/// @brief 操作履歴を構築します。
+	/// @param capacity 取り消し可能な操作の最大数
+	explicit EditHistory(size_t capacity)
+		: m_capacity{ capacity } {}
+
+	/// @brief 実行済みの操作を追加します。やり直し可能な操作は破棄されます。
+	/// @param command 追加する操作
+	void push(Command command)
+	{
+		m_undoStack.push_back(std::move(command));
+		if (m_capacity < m_undoStack.size())
+		{
+			m_undoStack.pop_front();
+		}
+		m_redoStack.clear();
+	}
+
+	/// @brief 直前の操作を取り消し対象として取り出し、やり直し可能な操作に移します。
+	/// @return 取り消す操作、存在しない場合は none
+	Optional<Command> undo()
+	{
+		if (m_undoStack.empty())
+		{
+			return none;
+		}
+
+		m_redoStack.push_back(std::move(m_undoStack.back()));
+		m_undoStack.pop_back();
+		return m_redoStack.back();
+	}
+
+	/// @brief 直前に取り消した操作を取り出し、取り消し可能な操作に戻します。
+	/// @return やり直す操作、存在しない場合は none
+	Optional<Command> redo()
+	{
+		if (m_redoStack.empty())
+		{
+			return none;
+		}
+
+		m_undoStack.push_back(std::move(m_redoStack.back()));
+		m_redoStack.pop_back();
+		return m_undoStack.back();
+	}
+
+	/// @brief 直前の操作を返します。連続した操作を一つにまとめる場合に使用します。
+	Command* top()
+	{
+		return m_undoStack.empty() ? nullptr : &m_undoStack.back();
+	}
+
+	/// @brief 取り消し可能な操作の一覧を古い順に返します。
+	const std::deque<Command>& undoStack() const
+	{
+		return m_undoStack;
+	}
+
+	void clear()
+	{
+		m_undoStack.clear();
+		m_redoStack.clear();
+	}
+
+private:
+
+	size_t m_capacity = 1000;
+	std::deque<Command> m_undoStack;
+	std::deque<Command> m_redoStack;
+};
+
+// 矩形を一様な格子に登録し、点や矩形の近くにある要素だけを列挙する
+template <class Value>
+class SpatialGrid
+{
+public:
+
+	SpatialGrid() = default;
+
+	/// @brief 空の格子を構築します。
+	/// @param cellSize 格子の一辺の長さ
+	explicit SpatialGrid(double cellSize)
+		: m_cellSize{ cellSize } {}
+
+	/// @brief rect と重なるすべての格子に value を登録します。
+	void insert(const RectF& rect, const Value& value)
+	{
+		const auto [minCell, maxCell] = cellRange(rect);
+		for (int32 y = minCell.y; y <= maxCell.y; ++y)
+		{
+			for (int32 x = minCell.x; x <= maxCell.x; ++x)
+			{
+				m_cells[Point(x, y)].push_back(value);
+			}
+		}
+	}
+
+	/// @brief pos を含む格子に登録された要素を返します。
+	const Array<Value>& query(const Vec2& pos) const
+	{
+		static const Array<Value> empty;
+		const auto it = m_cells.find(cellIndex(pos));
+		return (it == m_cells.end()) ? empty : it->second;
+	}
+
+	/// @brief rect と重なる格子に登録された要素を重複なく返します。
+	Array<Value> query(const RectF& rect) const
+	{
+		Array<Value> result;
+		HashSet<Value> visited;
+
+		const auto [minCell, maxCell] = cellRange(rect);
+		for (int32 y = minCell.y; y <= maxCell.y; ++y)
+		{
+			for (int32 x = minCell.x; x <= maxCell.x; ++x)
+			{
+				if (const auto it = m_cells.find(Point(x, y)); it != m_cells.end())
+				{
+					for (const auto& value : it->second)
+					{
+						if (visited.emplace(value).second)
+						{
+							result.push_back(value);
+						}
+					}
+				}
+			}
+		}
+
+		return result;
+	}
+
+	void clear()
+	{
+		m_cells.clear();
+	}
+
+private:
+
+	Point cellIndex(const Vec2& pos) const
+	{
+		return Point(static_cast<int32>(Math::Floor(pos.x / m_cellSize)), static_cast<int32>(Math::Floor(pos.y / m_cellSize)));
+	}
+
+	// 幅や高さが負の矩形も扱えるように両端の格子を求める
+	std::pair<Point, Point> cellRange(const RectF& rect) const
+	{
+		const auto a = cellIndex(rect.pos);
+		const auto b = cellIndex(rect.pos + rect.size);
+		return { Point(Min(a.x, b.x), Min(a.y, b.y)), Point(Max(a.x, b.x), Max(a.y, b.y)) };
+	}
+
+	double m_cellSize = 64.0;
+	HashTable<Point, Array<Value>> m_cells;
+};
+
+// 同じ文字列を 1 つだけ保持し、番号で参照する
+class StringPool
+{
+public:
+
+	/// @brief str の番号を返します。初めての文字列の場合は追加します。
+	/// @param str 文字列
+	uint32 intern(const String& str)
+	{
+		if (auto it = m_ids.find(str); it != m_ids.end())
+		{
+			return it->second;
+		}
+
+		const auto id = static_cast<uint32>(m_strings.size());
+		m_strings.push_back(str);
+		m_ids.emplace(str, id);
+		return id;
+	}
+
+	/// @brief str の番号を返します。追加されていない場合は none を返します。
+	/// @param str 文字列
+	Optional<uint32> find(const String& str) const
+	{
+		if (auto it = m_ids.find(str); it != m_ids.end())
+		{
+			return it->second;
+		}
+		return none;
+	}
+
+	const String& operator[](uint32 id) const
+	{
+		return m_strings[id];
+	}
+
+	size_t size() const
+	{
+		return m_strings.size();
+	}
+
+	void clear()
+	{
+		m_strings.clear();
+		m_ids.clear();
+	}
+
+private:
+
+	Array<String> m_strings;
+	HashTable<String, uint32> m_ids;
+};
+
+// フォントごとの文字送り幅のキャッシュ
+// キャッシュの表もフォントごとの幅もロックせずに更新するので、メインスレッドからだけ使う
+class GlyphAdvanceCache
+{
+public:
+
+	/// @brief font の文字送り幅のキャッシュを返します。メインスレッドからだけ呼びます。
+	/// @param font 対象のフォント
+	static GlyphAdvanceCache& Get(const Font& font)
+	{
+		static HashTable<uint64, GlyphAdvanceCache> caches;
+		return caches[font.id().value()];
+	}
+
+	/// @brief 文字 c の文字送り幅を返します。
+	/// @param font キャッシュを取得したフォント
+	/// @param c 文字
+	double advance(const Font& font, char32 c)
+	{
+		if (auto it = m_advances.find(c); it != m_advances.end())
+		{
+			return it->second;
+		}
+
+		const double xAdvance = font.getGlyphInfo(c).xAdvance;
+		m_advances.emplace(c, xAdvance);
+		return xAdvance;
+	}
+
+private:
+
+	HashTable<char32, double> m_advances;
+};
+
+/// @brief str を幅 width に収まるように折り返し、各行の範囲を lines に格納します。
+/// GlyphAdvanceCache を使うので、メインスレッドからだけ呼びます。
+/// @param font 幅の計算に使うフォント
+/// @param str 折り返す文字列
+/// @param width 一行の最大幅
+/// @param lines 各行の範囲の格納先（str を参照する）
+inline void WrapLinesByWidth(const Font& font, StringView str, double width, Array<StringView>& lines)
+{
+	lines.clear();
+
+	auto& advances = GlyphAdvanceCache::Get(font);
+
+	size_t lineBegin = 0;
+	double lineWidth = 0.0;
+	for (size_t i = 0; i < str.size(); ++i)
+	{
+		const char32 c = str[i];
+		if (c == U'\n')
+		{
+			lines.push_back(str.substr(lineBegin, i - lineBegin));
+			lineBegin = i + 1;
+			lineWidth = 0.0;
+			continue;
+		}
+
+		// 一文字だけで幅を超える場合はその文字を一行とする
+		const double advance = advances.advance(font, c);
+		if (lineBegin < i && width < lineWidth + advance)
+		{
+			lines.push_back(str.substr(lineBegin, i - lineBegin));
+			lineBegin = i;
+			lineWidth = 0.0;
+		}
+		lineWidth += advance;
+	}
+
+	lines.push_back(str.substr(lineBegin));
+}
+
 inline String WrapByWidth(const Font& font, const String& str, double width)
 {
+	Array<StringView> lines;
+	WrapLinesByWidth(font, str, width, lines);
+
 	String drawStr;
-	for (auto c : str)
+	drawStr.reserve(str.size() + lines.size());
+	for (const auto& [i, line] : Indexed(lines))
 	{
-		if (width < font(drawStr + c).region().w)
+		if (i != 0)
 		{
 			drawStr += U'\n';
 		}
-		drawStr += c;
+		drawStr += line;
 	}
 	return drawStr;
 }
@@ -111,6 +485,16 @@ public:
 		, m_pushed{ initialValue }
 	{}
 
+	// 登録済みの TextureAsset をアイコンにする
+	// テクスチャは最初に描く時に 1 回だけ作られ、同じアイコンのボタンで共有される
+	TileButton(AssetNameView iconName, int32 iconSize, const Palette& palette, ColorF iconColor, bool initialValue = false)
+		: m_iconName{ iconName }
+		, m_iconSize{ iconSize }
+		, m_palette{ palette }
+		, m_iconColor{ iconColor }
+		, m_pushed{ initialValue }
+	{}
+
 	Optional<bool> update(const RectF& rect)
 	{
 		const bool mouseOver = rect.mouseOver();
@@ -191,11 +575,11 @@ public:
 		// アイコン
 		if (false)
 		{
-			m_icon.drawAt(rect.center(), m_palette.tileColor2.lerp(m_iconColor, t));
+			icon().drawAt(rect.center(), m_palette.tileColor2.lerp(m_iconColor, t));
 		}
 
 		{
-			m_icon.drawAt(rect.center(), m_palette.tileColor1.lerp(m_iconColor, t));
+			icon().drawAt(rect.center(), m_palette.tileColor1.lerp(m_iconColor, t));
 		}
 	}
 
@@ -203,7 +587,13 @@ private:
 
 	static constexpr double InnerBorderMargin = 3.0;
 
+	TextureRegion icon() const
+	{
+		return m_iconName.isEmpty() ? m_icon : TextureRegion{ TextureAsset(m_iconName) };
+	}
+
 	TextureRegion m_icon;
+	AssetName m_iconName;
 	int32 m_iconSize = 0;
 	Transition m_transitionPressed{ 0.09s, 0.12s };
 	Palette m_palette;